@@ -62,6 +62,24 @@
 \seealso{getbuf_info, whatbuf}
 \done
 
+\function{buffer_snapshot_line}
+\synopsis{Return a line of a buffer snapshot}
+\usage{String buffer_snapshot_line (Buffer_Snapshot_Type s, Integer n)}
+\description
+  This function returns line \var{n} of the snapshot \var{s}, including
+  its newline character if it has one.  The first line is line 1.  An
+  error is generated if the snapshot has no such line.
+\seealso{create_buffer_snapshot, buffer_snapshot_num_lines}
+\done
+
+\function{buffer_snapshot_num_lines}
+\synopsis{Return the number of lines of a buffer snapshot}
+\usage{Integer buffer_snapshot_num_lines (Buffer_Snapshot_Type s)}
+\description
+  This function returns the number of lines in the snapshot \var{s}.
+\seealso{create_buffer_snapshot, buffer_snapshot_line}
+\done
+
 \function{buffer_visible}
 \synopsis{Return the number of windows containing a specified buffer}
 \usage{Integer buffer_visible (String buf)}
@@ -113,6 +131,26 @@
 \seealso{file_time_compare, file_changed_on_disk}
 \done
 
+\function{create_buffer_snapshot}
+\synopsis{Take a read-only copy of the current buffer}
+\usage{Buffer_Snapshot_Type create_buffer_snapshot ()}
+\description
+  This function returns an object holding the accessible part of the
+  current buffer as it is now.  Later changes to the buffer do not show
+  in it, so it may be used, e.g., to write out, search or compare the
+  text after the buffer has been edited further.  The lines are shared
+  with the buffer until they are changed, so taking a snapshot is cheap
+  even for a large buffer.
+\example
+#v+
+    variable s = create_buffer_snapshot ();
+    variable i;
+    _for i (1, buffer_snapshot_num_lines (s), 1)
+      () = fputs (buffer_snapshot_line (s, i), fp);
+#v-
+\seealso{buffer_snapshot_line, buffer_snapshot_num_lines, bufsubstr}
+\done
+
 \function{delbuf}
 \synopsis{Delete a named buffer}
 \usage{Void delbuf (String buf)}
@@ -268,6 +268,61 @@
 \seealso{getkey, ungetkey}
 \done
 
+\function{key_latency_commands}
+\synopsis{Get the commands for which key latencies were recorded}
+\usage{String_Type[] key_latency_commands ()}
+\description
+  This function returns the names of the commands for which the
+  editor has recorded keystroke latencies.  The most recently used
+  commands come first.
+\seealso{key_latency_stats, key_latency_dump, key_latency_reset}
+\done
+
+\function{key_latency_dump}
+\synopsis{Write the keystroke latency statistics to a file}
+\usage{key_latency_dump (String_Type file)}
+\description
+  This function writes a table of the keystroke latency statistics to
+  the specified file.  Each line gives the command name, the number
+  of keystrokes, and the mean, median, 90th and 99th percentile, and
+  maximum latency in microseconds.  The first line, labeled
+  \exmp{*all*}, summarizes all commands.
+\notes
+  If the environment variable \var{JED_KEY_LATENCY_FILE} is set when
+  the editor exits, the statistics are written to the file that it
+  names.
+\seealso{key_latency_stats, key_latency_commands}
+\done
+
+\function{key_latency_reset}
+\synopsis{Discard the keystroke latency statistics}
+\usage{key_latency_reset ()}
+\description
+  This function discards all keystroke latency statistics recorded so
+  far.
+\seealso{key_latency_stats, key_latency_dump}
+\done
+
+\function{key_latency_stats}
+\synopsis{Get the keystroke latency statistics of a command}
+\usage{(n, mean, p50, p90, p99, max) = key_latency_stats (String_Type cmd)}
+\description
+  The editor measures the time from the arrival of a key until the
+  screen update following it has been written to the terminal, and
+  records it under the name of the command that the key invoked.
+  This function returns the number of measurements \var{n} for the
+  command \var{cmd}, the mean latency, the 50th, 90th, and 99th
+  percentiles, and the maximum latency.  All times are in
+  microseconds.  If \var{cmd} is the empty string, the values for all
+  commands together are returned.
+  Keys that a command reads by itself, e.g., using \ifun{getkey}, are
+  charged to that command.
+\notes
+  The percentiles are taken from a histogram with logarithmically
+  spaced buckets and are accurate to about 6 percent.
+\seealso{key_latency_commands, key_latency_dump, key_latency_reset}
+\done
+
 \function{keymap_p}
 \synopsis{Test if a keymap "kmap" exists}
 \usage{Integer keymap_p (String kmap);}
@@ -19,6 +19,32 @@
 \seealso{get_jed_library_path, set_jed_library_path, getenv}
 \done
 
+\variable{Undo_Buffer_Limit}
+\synopsis{Maximum size of the undo history of a buffer}
+\usage{Int_Type Undo_Buffer_Limit}
+\description
+ The undo history of each buffer is kept in a log whose memory grows
+ with the history.  When the log of a buffer takes more than
+ \var{Undo_Buffer_Limit} bytes of memory, its oldest records are
+ paged out to a temporary file, from which \ifun{undo} reads them back
+ when it reaches them.  If the temporary file cannot be created, the
+ oldest records are discarded instead.  The most recent change is
+ always kept in memory, even if it is larger than the limit.  A value
+ of zero or less removes the limit.  The default is 16 MB.
+\seealso{Undo_Total_Limit, set_undo_history_dir, set_undo_position}
+\done
+
+\variable{Undo_Total_Limit}
+\synopsis{Maximum size of the undo history of all buffers}
+\usage{Int_Type Undo_Total_Limit}
+\description
+ When the undo logs of all the buffers together take more than
+ \var{Undo_Total_Limit} bytes of memory, the oldest records are paged
+ out or discarded, starting with the buffer that has the largest log.  A value of zero
+ or less removes the limit.  The default is 64 MB.
+\seealso{Undo_Buffer_Limit}
+\done
+
 \variable{_jed_secure_mode (read-only)}
 \synopsis{Indicates if the editor is in secure mode}
 \usage{Int_Type _jed_secure_mode}
@@ -236,6 +262,29 @@
 \seealso{narrow_to_region}
 \done
 
+\function{set_undo_history_dir}
+\synopsis{Keep the undo history of files between sessions}
+\usage{set_undo_history_dir (String_Type dir)}
+\description
+ When a buffer is saved to a file, its undo history is written to a
+ file in the directory \exmp{dir}.  The name of that file is made from
+ the XXH3 hash of the contents and the canonical path of the saved
+ file.  When the same file is read later with the same contents, by
+ \ifun{find_file}, its history is loaded back, so that \ifun{undo} can
+ go back past the point where the file was read.  A copy of the file
+ under another name does not get its history.  The history of the
+ previous save of the buffer is removed from the directory, and it is
+ not written again if neither the file nor the history has changed.
+ Nothing is loaded into a buffer whose undo is turned off.  The
+ directory must exist.  An empty string turns the feature off, which
+ is the default.
+\example
+#v+
+   set_undo_history_dir (path_concat (Jed_Home_Directory, ".jed-undo"));
+#v-
+\seealso{Undo_Buffer_Limit, undo}
+\done
+
 \function{suspend}
 \synopsis{Suspend the editor}
 \usage{Void suspend ()}
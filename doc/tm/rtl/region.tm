@@ -175,6 +175,36 @@
 \seealso{pop_narrow, narrow, widen, widen_buffer}
 \done
 
+\function{sort_region_lines}
+\synopsis{Sort the lines of the region}
+\usage{Void sort_region_lines (Integer begc, Integer endc, Integer flags)}
+\description
+  This function sorts the lines of the region, from the line of the
+  mark to that of the point, by the text of each line from column
+  \var{begc} up to column \var{endc}.  If \var{endc} is not positive,
+  the text up to the end of the line is used.  Lines whose keys are
+  equal stay in the same order.  The \var{flags} parameter is a
+  bitwise-or of zero or more of the following values:
+#v+
+    JED_SORT_NUMERIC     compare the keys as numbers
+    JED_SORT_REVERSE     sort in descending order
+    JED_SORT_UNIQUE      keep only the first of lines with equal keys
+#v-
+  Numeric keys are read as decimal numbers with a period as the
+  decimal point, whatever the locale.
+
+  Marks on the sorted lines, including user marks, move with their
+  lines and keep their columns.  A mark on a line dropped by
+  \var{JED_SORT_UNIQUE} moves to the line kept in its place.
+
+  If the region ends on the last line of the buffer, a newline is
+  added to it.  The mark is popped, and the editing point is left at
+  the beginning of the line after the sorted ones.  The sort can be
+  undone in one step.  If the buffer or any line of the region is
+  read-only, an error is generated and nothing is sorted.
+\seealso{check_region, sort}
+\done
+
 \function{translate_region}
 \synopsis{translate the characters in the region according to "a"}
 \usage{Void translate_region (String_Type[256] a)}
@@ -138,7 +138,12 @@
 
   The regular expression syntax understands character classes
   like \exmp{[a-z]} and \exmp{[^a-z0-9]}, parentheses, \exmp{+}, \exmp{*}, \exmp{?}, \exmp{|}
-  and \exmp{.}. Any metacharacter can be escaped using a backslash
+  and \exmp{.}. The escape \exmp{\\u} matches one UTF-8 encoded
+  non-ASCII character, so that \exmp{([A-Za-z_]|\\u)+} matches a word
+  that contains accented or other non-ASCII letters. (In older
+  versions \exmp{\\u} matched a literal \exmp{u}; write a plain
+  \exmp{u} for that.) Any
+  metacharacter can be escaped using a backslash
   so that it can be used as a normal character, but beware that
   due to the syntax of S-Lang strings the backslash has to be
   doubled when specified as a string constant. For example:
@@ -151,10 +156,36 @@
 
   Note also that \var{dfa_build_highlight_table} must be called before
   the syntax highlighting can take effect.
-\seealso{create_syntax_table, use_syntax_table, dfa_build_highlight_table}
+\seealso{create_syntax_table, use_syntax_table, dfa_build_highlight_table, dfa_define_highlight_region}
 \seealso{WANT_SYNTAX_HIGHLIGHT, USE_ANSI_COLORS}
 \done
 
+\function{dfa_define_highlight_region}
+\synopsis{Add a multi-line DFA region to the syntax table "n"}
+\usage{Void dfa_define_highlight_region (String begin, String end, String color, String n);}
+\description
+  This function defines a region of the syntax table \var{n} that may
+  span several lines, such as a C comment. The region starts with a
+  token matching the regular expression \var{begin}, which competes
+  with the rules added by \var{dfa_define_highlight_rule} in the usual
+  way, and extends to the first match of the regular expression
+  \var{end}, which may be on a later line. The whole region is
+  highlighted in the color \var{color}. For example:
+#v+
+        dfa_define_highlight_region ("/\\*", "\\*/", "comment", "C");
+#v-
+  The region that each line starts in is kept with the line, and is
+  brought up to date after an edit in the same way as the state used
+  by the traditional highlighting scheme. Regions do not nest, and a
+  table may have at most 32 of them. The region ends where a match of
+  \var{end} is first complete.
+\notes
+  This function is only available if jed was compiled with line
+  attributes, which hold the region of each line. Use \var{#ifexists}
+  to fall back to single-line rules without it.
+\seealso{dfa_define_highlight_rule, dfa_build_highlight_table}
+\done
+
 \function{dfa_enable_highlight_cache}
 \synopsis{Enable caching of the DFA table}
 \usage{Void dfa_enable_highlight_cache (String file, String n);}
@@ -162,7 +193,6 @@
   This function enables caching of the DFA table for the
   enhanced syntax highlighting scheme belonging to the syntax
   table specified by the name \var{n}. This should be called before
-  any calls to \var{dfa_define_highlight_rule} or to
   \var{dfa_build_highlight_table}. The parameter \var{file}
   specifies the name of the file (stored in the directory set by the
   \var{set_highlight_cache_dir} function) which should be used as a cache.
@@ -175,9 +205,12 @@
   C mode, the DFA would take possibly a couple of seconds to
   compute every time Jed was started.
 
-  Transferring cache files between different computers is
-  theoretically possible but not recommended. Transferring them
-  between different versions of Jed is not guaranteed to work.
+  The cache file is a binary image of the DFA table, which is mapped
+  into memory when it is loaded. It records a hash of the rules that
+  were defined when it was created. If the rules no longer match, or
+  the file was written by a build with a different byte order or
+  layout, it is ignored, and the DFA is rebuilt and the file
+  rewritten.
 \seealso{create_syntax_table, use_syntax_table, dfa_define_highlight_rule, dfa_build_highlight_table}
 \seealso{WANT_SYNTAX_HIGHLIGHT, USE_ANSI_COLORS}
 \done
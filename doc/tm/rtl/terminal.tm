@@ -58,6 +58,32 @@
 \seealso{}
 \done
 
+\variable{TERM_BRACKETED_PASTE}
+\synopsis{Insert pasted text as a single operation}
+\usage{Int_Type TERM_BRACKETED_PASTE}
+\description
+  If this variable is non-zero, the terminal is asked to enclose
+  pasted text in the bracketed-paste sequences \exmp{ESC[200~} and
+  \exmp{ESC[201~} (DEC private mode 2004).  The opening sequence is
+  bound to the \var{bracketed_paste} command, which reads the whole
+  paste and inserts it in one step.  The pasted text is therefore
+  undone as a unit, the screen is updated once, and the text is not
+  subject to wrapping, abbreviation expansion, or automatic
+  indentation.  Carriage returns in the pasted text are converted to
+  newlines.  If the closing sequence does not arrive within a second,
+  the text read so far is inserted, and any part of the closing
+  sequence that was read is handled as ordinary input.  The default
+  value is \0.
+\notes
+  This variable is only available when running in a terminal.  Some
+  emulations rebind the \exmp{ESC [} prefix; use
+#v+
+    setkey ("bracketed_paste", "\e[200~");
+#v-
+  to restore the binding in that case.
+\seealso{TERM_SYNC_UPDATE, setkey}
+\done
+
 \variable{TERM_CANNOT_INSERT}
 \synopsis{Control the use of terminal insertion}
 \usage{Int_Type TERM_CANNOT_INSERT}
@@ -84,6 +110,23 @@
 \seealso{TERM_CANNOT_INSERT}
 \done
 
+\variable{TERM_SYNC_UPDATE}
+\synopsis{Paint each screen update atomically}
+\usage{Int_Type TERM_SYNC_UPDATE}
+\description
+  If this variable is non-zero, the output of each screen update is
+  enclosed in the synchronized output sequences (DEC private mode
+  2026).  A terminal that supports the mode will display the new
+  screen contents in one step instead of showing a partially drawn
+  screen.  This reduces flicker considerably when the editor is used
+  over a slow connection such as \exmp{ssh}.  Terminals that do not
+  support the mode silently ignore the sequences.  The default value
+  is \0.
+\notes
+  This variable is only available when running in a terminal.
+\seealso{get_term_output_stats, TERM_CANNOT_SCROLL, TERM_BRACKETED_PASTE}
+\done
+
 \variable{USE_ANSI_COLORS}
 \synopsis{Enable the use of colors}
 \usage{Int_Type USE_ANSI_COLORS}
@@ -108,6 +151,38 @@
   Note: This function is only available on Unix systems.
 \done
 
+\function{get_term_output_stats}
+\synopsis{Get statistics about the output sent to the terminal}
+\usage{(frames, bytes, last, max, scrolls) = get_term_output_stats ()}
+\description
+  This function returns five integers that describe the amount of
+  output that has been sent to the terminal by screen updates.
+  \var{frames} is the number of screen updates that painted
+  something, \var{bytes} is the total number of bytes written by
+  them, and \var{last} and \var{max} are the sizes of the last and of
+  the largest update.  \var{scrolls} is the number of times that the
+  scrolling capability of the terminal was used instead of repainting
+  the lines.
+\example
+#v+
+   variable f, b, l, m, s;
+   (f, b, l, m, s) = get_term_output_stats ();
+   vmessage ("%lu bytes/frame", b / (f + (f == 0)));
+#v-
+\notes
+  This function is only available when running in a terminal.
+\seealso{reset_term_output_stats, TERM_SYNC_UPDATE}
+\done
+
+\function{reset_term_output_stats}
+\synopsis{Reset the terminal output statistics}
+\usage{reset_term_output_stats ()}
+\description
+  This function sets the counters returned by
+  \ifun{get_term_output_stats} to zero.
+\seealso{get_term_output_stats}
+\done
+
 \function{set_term_vtxxx}
 \synopsis{Set terminal display appropriate for a vtxxx terminal}
 \description
@@ -77,7 +77,7 @@
   then the current line number will be displayed but column numbers
   will not be.  If \var{LINENUMBERS} is \2, the both line a column
   numbers will be displayed.
-\seealso{set_status_line}
+\seealso{set_status_line, set_line_number_mode}
 \done
 
 \variable{Simulate_Graphic_Chars}
@@ -272,6 +272,48 @@
 \seealso{DISPLAY_TIME,LINENUMBERS, Global_Top_Status_Line, Status_Line_String}
 \done
 
+\function{set_line_number_mode}
+\synopsis{Control the display of line numbers in the window gutter}
+\usage{set_line_number_mode (Int_Type mode)}
+\description
+  This function controls whether or not the line numbers of the
+  current buffer are shown in a column to the left of the text.  If
+  \var{mode} is \0, the line numbers are not shown.  If it is \1,
+  the line numbers are shown.  If it is \2, the numbers are shown
+  relative to the current line, i.e., as the distance from the
+  current line, with the current line showing its absolute number.
+  A negative value toggles the display.
+\notes
+  Only the rows whose numbers change are redrawn.  In particular,
+  moving the cursor in the relative mode rewrites the number column
+  but not the text of the window.
+\seealso{toggle_line_number_mode, LINENUMBERS}
+\done
+
+\function{set_soft_wrap_mode}
+\synopsis{Wrap long lines at the window edge}
+\usage{set_soft_wrap_mode (Int_Type mode)}
+\description
+  If \var{mode} is non-zero, lines of the current buffer that are
+  wider than the window are continued on the following screen rows
+  instead of being truncated or scrolled horizontally.  If \var{mode}
+  is \0, long lines are displayed as usual.  A negative value
+  toggles the mode.  The buffer itself is not changed.
+
+  In this mode, recentering and the paging commands count screen rows
+  rather than lines.  The number of rows that each line occupies is
+  cached per window, so long lines are not measured again on every
+  update.
+
+  A tab or a double width character that would cross the edge of the
+  window is moved whole to the next row.
+\notes
+  The top of the window is the beginning of a line, unless the current
+  line is taller than the window.  Then the window starts partway
+  through the line so that the cursor stays in view.
+\seealso{toggle_soft_wrap_mode, set_line_number_mode, HORIZONTAL_PAN}
+\done
+
 \function{splitwindow}
 \synopsis{Split the current window vertically}
 \usage{Void splitwindow ();}
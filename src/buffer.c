@@ -579,6 +579,107 @@ static unsigned char NewLine_Buffer[1] = /*{{{*/
 
 /*}}}*/
 
+/* The data of a line may be shared with other lines, e.g., with the lines
+ * of a region that was copied to another buffer.  It is preceded by a count
+ * of the lines using it and by the number of bytes allocated for it, except
+ * for NewLine_Buffer, which is shared by all lines that hold just a newline.
+ * Shared data must not be changed in place: remake_line and
+ * jed_unshare_line give CLine a copy of its own.
+ */
+typedef struct
+{
+   unsigned int refs;
+   unsigned int space;
+}
+Line_Data_Header_Type;
+
+#define LINE_DATA_HEADER_SIZE	sizeof (Line_Data_Header_Type)
+#define LINE_DATA_HEADER(d)	(((Line_Data_Header_Type *) (d)) - 1)
+#define LINE_DATA_REFS(d)	(LINE_DATA_HEADER(d)->refs)
+#define LINE_DATA_SPACE(d)	(LINE_DATA_HEADER(d)->space)
+#define LINE_DATA_IS_SHARED(d) \
+   (((d) == NewLine_Buffer) || (LINE_DATA_REFS(d) > 1))
+
+/* Lines this long grow by half of their size at a time, so that building
+ * one by many small appends does not copy it over and over.  Only the last
+ * line grown this way keeps the extra room; it is given back when another
+ * line grows, when the buffer is saved, and when the editor is idle.
+ */
+#define LINE_GROWTH_THRESHOLD	256
+static Line *Slack_Line;
+
+static unsigned char *alloc_line_data (unsigned int size) /*{{{*/
+{
+   unsigned char *d;
+
+   if (NULL == (d = (unsigned char *) SLmalloc (size + LINE_DATA_HEADER_SIZE)))
+     return NULL;
+
+   d += LINE_DATA_HEADER_SIZE;
+   LINE_DATA_REFS(d) = 1;
+   LINE_DATA_SPACE(d) = size;
+   return d;
+}
+
+/*}}}*/
+
+static unsigned char *realloc_line_data (unsigned char *d, unsigned int size) /*{{{*/
+{
+   d = (unsigned char *) SLrealloc ((char *) (d - LINE_DATA_HEADER_SIZE),
+				    size + LINE_DATA_HEADER_SIZE);
+   if (d == NULL)
+     return NULL;
+
+   d += LINE_DATA_HEADER_SIZE;
+   LINE_DATA_SPACE(d) = size;
+   return d;
+}
+
+/*}}}*/
+
+static void release_line_data (unsigned char *d) /*{{{*/
+{
+   if (d == NewLine_Buffer)
+     return;
+
+   if (--LINE_DATA_REFS(d) == 0)
+     SLfree ((char *) (d - LINE_DATA_HEADER_SIZE));
+}
+
+/*}}}*/
+
+/* Give back the extra room of the line that grew last.  Unless all is
+ * non-zero, the current line keeps it, as it may still be growing.
+ */
+void jed_trim_line_slack (int all) /*{{{*/
+{
+   Line *l = Slack_Line;
+   unsigned char *d;
+   unsigned int size;
+
+   if ((l == NULL) || ((l == CLine) && (all == 0)))
+     return;
+   Slack_Line = NULL;
+
+   d = l->data;
+   if (LINE_DATA_IS_SHARED(d))
+     return;
+
+   size = ((unsigned int) l->len + 3) & ~3U;
+   if ((size == 0) || (size >= LINE_DATA_SPACE(d)))
+     return;
+
+   if (NULL == (d = realloc_line_data (d, size)))
+     return;			       /* it keeps the room then */
+
+   l->data = d;
+#ifdef KEEP_SPACE_INFO
+   l->space = size;
+#endif
+}
+
+/*}}}*/
+
 typedef struct Bunch_Lines_Type /*{{{*/
 {
    struct Bunch_Lines_Type *next;
@@ -762,6 +863,8 @@ static void destroy_bunch_line(Line *l) /*{{{*/
 	     else
 	       {
 		  Number_Freed++;
+		  /* The next line freed is likely to be in the same bunch */
+		  slast = b;
 	       }
 
 	     Last_Free_Group = b;
@@ -800,7 +903,7 @@ Line *make_line1(unsigned int size) /*{{{*/
 	     chunk = 1;
 #endif
 	  }
-	else data = (unsigned char *) SLmalloc (chunk);   /* was chunk + 1 */
+	else data = alloc_line_data (chunk);   /* was chunk + 1 */
      }
 
    if ((new_line == NULL) || (data == NULL))
@@ -870,14 +973,32 @@ unsigned char *make_line(unsigned int size) /*{{{*/
 
 void free_line(Line *line) /*{{{*/
 {
-   register unsigned char *dat = line->data;
-
-   if (dat != NewLine_Buffer) SLfree ((char *)dat);
+   if (line == Slack_Line) Slack_Line = NULL;
+   release_line_data (line->data);
    destroy_bunch_line(line);
 }
 
 /*}}}*/
 
+/* Free the list of lines that starts at l and ends with a NULL next link.
+ * Lines made one after another share a bunch, and the search for the bunch
+ * of a line starts at the bunch of the line freed before it, so a run of
+ * lines is freed without searching the bunches for each of them.
+ */
+void jed_free_line_list (Line *l) /*{{{*/
+{
+   Line *next;
+
+   while (l != NULL)
+     {
+	next = l->next;
+	free_line (l);
+	l = next;
+     }
+}
+
+/*}}}*/
+
 /* deletes the line we are on and returns the prev one.  It does not
  * delete the top line of the buffer.   Furthermore, it does not
  *  update any marks.  */
@@ -915,7 +1036,7 @@ int delete_line() /*{{{*/
 unsigned char *remake_line(unsigned int size) /*{{{*/
 {
    unsigned char *d = CLine->data;
-   unsigned int mask;
+   unsigned int mask, space;
 #if defined(SIXTEEN_BIT_SYSTEM)
    mask = 0xFFFCu;
 #else
@@ -923,20 +1044,42 @@ unsigned char *remake_line(unsigned int size) /*{{{*/
 #endif
    size = (unsigned) (size + 3) & mask;   /* 4 byte chunks */
 
-   if (d == NewLine_Buffer)
+   if (LINE_DATA_IS_SHARED(d))
      {
-	if (NULL != (d = (unsigned char *) SLmalloc (size))) *d = '\n';
+	unsigned char *d1 = alloc_line_data (size);
+
+	if (d1 != NULL)
+	  {
+	     unsigned int len = (unsigned int) CLine->len;
+	     if (d == NewLine_Buffer) len = 1;
+	     if (len > size) len = size;
+	     SLMEMCPY ((char *) d1, (char *) d, len);
+	     release_line_data (d);
+	  }
+	d = d1;
      }
    else
      {
-#if 1				       /* NOTE: This was #if 0.  Why??? */
-#ifndef KEEP_SPACE_INFO
-	if ((((CLine->len + 3) & mask) == size)
-	    && (size + 8 < (unsigned) CLine->len))/* realloc if the new size is less than the old */
-	  return d;
-#endif
-#endif
-	d = (unsigned char *) SLrealloc ((char *) d, size);
+	space = LINE_DATA_SPACE(d);
+	if (size <= space)
+	  {
+	     /* Keep the room of a line that is growing. */
+	     if ((size == space) || (CLine == Slack_Line))
+	       return d;
+	  }
+	else if (size >= LINE_GROWTH_THRESHOLD)
+	  {
+	     unsigned int grown = space + space / 2;
+
+	     if ((grown > size) && (grown > space))
+	       size = (grown + 3) & mask;
+	     if (CLine != Slack_Line)
+	       {
+		  jed_trim_line_slack (1);
+		  Slack_Line = CLine;
+	       }
+	  }
+	d = realloc_line_data (d, size);
      }
 
    if (d == NULL)
@@ -948,7 +1091,7 @@ unsigned char *remake_line(unsigned int size) /*{{{*/
      }
 
 #ifdef KEEP_SPACE_INFO
-   CLine->space = size;
+   CLine->space = LINE_DATA_SPACE(d);
 #endif
    CLine->data = d;
    return(d);
@@ -956,6 +1099,241 @@ unsigned char *remake_line(unsigned int size) /*{{{*/
 
 /*}}}*/
 
+void jed_unshare_line (void) /*{{{*/
+{
+   if (LINE_DATA_IS_SHARED(CLine->data))
+     (void) remake_line ((unsigned int) CLine->len);
+}
+
+/*}}}*/
+
+/* Count back in the newline that narrowing hides just past the end of l,
+ * putting one there if an edit overwrote it.  Only the data beyond the
+ * text of l may change, and that is copied first if it is shared.
+ * Returns -1 if there was no memory for it.
+ */
+int jed_show_hidden_newline (Line *l) /*{{{*/
+{
+   unsigned char *d = l->data;
+   unsigned int len = (unsigned int) l->len;
+
+   if ((d != NewLine_Buffer)
+       && ((len >= LINE_DATA_SPACE(d)) || (d[len] != '\n')))
+     {
+	if (LINE_DATA_IS_SHARED(d) || (len >= LINE_DATA_SPACE(d)))
+	  {
+	     unsigned char *d1 = alloc_line_data ((len + 4) & ~3U);
+
+	     if (d1 == NULL)
+	       return -1;
+	     SLMEMCPY ((char *) d1, (char *) d, len);
+	     release_line_data (d);
+	     l->data = d = d1;
+#ifdef KEEP_SPACE_INFO
+	     l->space = LINE_DATA_SPACE(d);
+#endif
+	  }
+	d[len] = '\n';
+     }
+   l->len++;
+   return 0;
+}
+
+/*}}}*/
+
+/*{{{ Buffer snapshots */
+
+/* A snapshot holds the lines of the accessible part of a buffer as they
+ * were when it was taken.  It shares their data, so taking one costs a
+ * pointer and a length for each line, and a later edit copies just the
+ * lines that it changes.
+ */
+typedef struct
+{
+   unsigned char *data;
+   unsigned int len;
+}
+Snapshot_Line_Type;
+
+struct _Jed_Buffer_Snapshot_Type
+{
+   unsigned int num_lines;
+   Snapshot_Line_Type *lines;
+};
+
+Jed_Buffer_Snapshot_Type *jed_create_buffer_snapshot (void) /*{{{*/
+{
+   Jed_Buffer_Snapshot_Type *s;
+   Snapshot_Line_Type *sl, *slmax;
+   Line *l;
+
+   if (Max_LineNum > UINT_MAX / sizeof (Snapshot_Line_Type))
+     {
+	msg_error ("Too many lines for a snapshot.");
+	return NULL;
+     }
+
+   if (NULL == (s = (Jed_Buffer_Snapshot_Type *) jed_malloc0 (sizeof (Jed_Buffer_Snapshot_Type))))
+     return NULL;
+
+   if (NULL == (s->lines = (Snapshot_Line_Type *) SLmalloc (1 + Max_LineNum * sizeof (Snapshot_Line_Type))))
+     {
+	SLfree ((char *) s);
+	return NULL;
+     }
+
+   sl = s->lines;
+   slmax = sl + Max_LineNum;
+   for (l = CBuf->beg; (l != NULL) && (sl < slmax); l = l->next)
+     {
+	sl->data = l->data;
+	sl->len = (unsigned int) l->len;
+	if (l->data != NewLine_Buffer)
+	  LINE_DATA_REFS(l->data) += 1;
+	sl++;
+     }
+   s->num_lines = (unsigned int) (sl - s->lines);
+   return s;
+}
+
+/*}}}*/
+
+void jed_free_buffer_snapshot (Jed_Buffer_Snapshot_Type *s) /*{{{*/
+{
+   unsigned int i;
+
+   if (s == NULL)
+     return;
+
+   for (i = 0; i < s->num_lines; i++)
+     release_line_data (s->lines[i].data);
+
+   SLfree ((char *) s->lines);
+   SLfree ((char *) s);
+}
+
+/*}}}*/
+
+unsigned int jed_buffer_snapshot_num_lines (Jed_Buffer_Snapshot_Type *s) /*{{{*/
+{
+   return s->num_lines;
+}
+
+/*}}}*/
+
+/* Returns the data of line n of s, where the first line is 1, and sets
+ * *lenp to its length, or returns NULL if there is no such line.
+ */
+unsigned char *jed_buffer_snapshot_line (Jed_Buffer_Snapshot_Type *s, unsigned int n, unsigned int *lenp) /*{{{*/
+{
+   if ((n == 0) || (n > s->num_lines))
+     return NULL;
+
+   *lenp = s->lines[n - 1].len;
+   return s->lines[n - 1].data;
+}
+
+/*}}}*/
+
+static void destroy_snapshot (SLtype type, VOID_STAR s) /*{{{*/
+{
+   (void) type;
+   jed_free_buffer_snapshot ((Jed_Buffer_Snapshot_Type *) s);
+}
+
+/*}}}*/
+
+static SLang_MMT_Type *pop_snapshot (Jed_Buffer_Snapshot_Type **sp) /*{{{*/
+{
+   SLang_MMT_Type *mmt;
+
+   if (NULL == (mmt = SLang_pop_mmt (JED_SNAPSHOT_TYPE)))
+     return NULL;
+
+   *sp = (Jed_Buffer_Snapshot_Type *) SLang_object_from_mmt (mmt);
+   return mmt;
+}
+
+/*}}}*/
+
+void create_buffer_snapshot (void) /*{{{*/
+{
+   Jed_Buffer_Snapshot_Type *s;
+   SLang_MMT_Type *mmt;
+
+   if (NULL == (s = jed_create_buffer_snapshot ()))
+     return;
+
+   if (NULL == (mmt = SLang_create_mmt (JED_SNAPSHOT_TYPE, (VOID_STAR) s)))
+     {
+	jed_free_buffer_snapshot (s);
+	return;
+     }
+
+   if (-1 == SLang_push_mmt (mmt))
+     SLang_free_mmt (mmt);
+}
+
+/*}}}*/
+
+int buffer_snapshot_num_lines (void) /*{{{*/
+{
+   Jed_Buffer_Snapshot_Type *s;
+   SLang_MMT_Type *mmt;
+   int n;
+
+   if (NULL == (mmt = pop_snapshot (&s)))
+     return -1;
+
+   n = (int) s->num_lines;
+   SLang_free_mmt (mmt);
+   return n;
+}
+
+/*}}}*/
+
+void buffer_snapshot_line (int *np) /*{{{*/
+{
+   Jed_Buffer_Snapshot_Type *s;
+   SLang_MMT_Type *mmt;
+   unsigned char *data;
+   unsigned int len;
+   char *str;
+
+   if (NULL == (mmt = pop_snapshot (&s)))
+     return;
+
+   if ((*np <= 0)
+       || (NULL == (data = jed_buffer_snapshot_line (s, (unsigned int) *np, &len))))
+     {
+	SLang_verror (SL_INVALID_PARM, "Snapshot has no line %d", *np);
+	SLang_free_mmt (mmt);
+	return;
+     }
+
+   if (NULL != (str = SLmake_nstring ((char *) data, len)))
+     (void) SLang_push_malloced_string (str);
+   SLang_free_mmt (mmt);
+}
+
+/*}}}*/
+
+int jed_register_snapshot_class (void) /*{{{*/
+{
+   SLang_Class_Type *cl;
+
+   if (NULL == (cl = SLclass_allocate_class ("Buffer_Snapshot_Type")))
+     return -1;
+
+   (void) SLclass_set_destroy_function (cl, destroy_snapshot);
+
+   return SLclass_register_class (cl, JED_SNAPSHOT_TYPE, sizeof (Jed_Buffer_Snapshot_Type), SLANG_CLASS_TYPE_MMT);
+}
+
+/*}}}*/
+
+/*}}}*/
+
 void uniquely_name_buffer (Buffer *b, SLFUTURE_CONST char *trry) /*{{{*/
 {
    Buffer *bnext;
@@ -1157,34 +1535,63 @@ void goto_line (int *np) /*{{{*/
 
 /*}}}*/
 
-Line *dup_line(Line *l) /*{{{*/
+/* Returns a new line, not linked into any buffer, holding the n bytes at
+ * s, or NULL upon failure.
+ */
+Line *jed_create_line (unsigned char *s, unsigned int n) /*{{{*/
 {
-   Line *neew;
-   int n;
-   unsigned char *p, *q;
+   Line *l;
+   unsigned char *data;
 
-#ifdef KEEP_SPACE_INFO
-   n = l->space;
-#else
-   n = l->len;
-#endif
+   if (NULL == (l = create_line_from_bunch ()))
+     return NULL;
 
-   neew = (Line *) SLmalloc (sizeof(Line));
-   if ((neew == NULL) ||
-       (NULL == (neew->data = (unsigned char *) SLmalloc (n))))
+   if ((n == 1) && (*s == '\n'))
+     data = NewLine_Buffer;
+   else if (NULL != (data = alloc_line_data ((n + 3) & ~3U)))
+     SLMEMCPY ((char *) data, (char *) s, n);
+   else
      {
-	exit_error("Out of memory", 0);
+	destroy_bunch_line (l);
+	return NULL;
      }
+
+   l->next = l->prev = NULL;
+   l->data = data;
+   l->len = n;
+#ifdef KEEP_SPACE_INFO
+   l->space = (data == NewLine_Buffer) ? 1 : ((n + 3) & ~3U);
+#endif
+#if JED_HAS_LINE_ATTRIBUTES
+   l->flags = 0;
+#endif
+   return l;
+}
+
+/*}}}*/
+
+/* Returns a new line, not linked into any buffer, that shares the data of
+ * l.
+ */
+Line *dup_line(Line *l) /*{{{*/
+{
+   Line *neew;
+
+   if (NULL == (neew = create_line_from_bunch ()))
+     return NULL;
+
    neew->next = l->next;
    neew->prev = l->prev;
-   neew->len = n;
+   neew->data = l->data;
+   neew->len = l->len;
 #ifdef KEEP_SPACE_INFO
    neew->space = l->space;
 #endif
-   p = neew->data;
-   q = l->data;
-
-   while (n--) *p++ = *q++;
+#if JED_HAS_LINE_ATTRIBUTES
+   neew->flags = 0;
+#endif
+   if (neew->data != NewLine_Buffer)
+     LINE_DATA_REFS(neew->data) += 1;
    return(neew);
 }
 
@@ -1485,7 +1892,7 @@ void check_line() /*{{{*/
 {
    if ((CLine->len == 1) && (*CLine->data == '\n') && (CLine->data != NewLine_Buffer))
      {
-	SLfree ((char *)CLine->data);
+	release_line_data (CLine->data);
 	CLine->data = NewLine_Buffer;
 #ifdef KEEP_SPACE_INFO
 	CLine->space = 1;
@@ -60,7 +60,12 @@ typedef struct Line
     * Finally, assuming at least 32 bit integers, the last 16 bits may be
     * used for the syntax state of the line. For instance, if the line is in
     * a string, the string character may be specified by the some of the bits,
-    * which is useful if there are more than one.
+    * which is useful if there are more than one.  The DFA highlighter
+    * keeps the region (e.g., a multi-line comment) that the line starts
+    * in, as defined by dfa_define_highlight_region, in bits 16-23.
+    * Bits 24-31 summarize the delimiters of the line for goto_match: the
+    * number of unmatched open and close delimiters outside of comments
+    * and strings, if the line is known to start and end in code.
     */
    unsigned int flags;
 # define JED_LINE_IN_COMMENT_MINVAL (1)
@@ -85,7 +90,24 @@ typedef struct Line
    (line)->flags |= ((val)&JED_LINE_IN_BITS)
 
 # define JED_LINE_HAS_EOL_COMMENT	0x0010
-# define JED_LINE_SYNTAX_BITS		0x001F
+
+# define JED_LINE_DFA_REGION_BITS	0x00FF0000
+# define JED_GET_LINE_DFA_REGION(line) \
+   (((line)->flags & JED_LINE_DFA_REGION_BITS) >> 16)
+# define JED_SET_LINE_DFA_REGION(line,r) \
+   (line)->flags &= ~JED_LINE_DFA_REGION_BITS; \
+   (line)->flags |= (((r) << 16) & JED_LINE_DFA_REGION_BITS)
+
+# define JED_LINE_SYNTAX_BITS		(0x001F|JED_LINE_DFA_REGION_BITS)
+
+# define JED_LINE_DELIM_BITS		0xFF000000
+# define JED_LINE_DELIMS_KNOWN		0x80000000
+# define JED_LINE_DELIM_MAX		7
+# define JED_GET_LINE_DELIM_OPENS(line) (((line)->flags >> 24) & 0x7)
+# define JED_GET_LINE_DELIM_CLOSES(line) (((line)->flags >> 27) & 0x7)
+# define JED_SET_LINE_DELIMS(line,opens,closes) \
+   (line)->flags &= ~JED_LINE_DELIM_BITS; \
+   (line)->flags |= JED_LINE_DELIMS_KNOWN | ((opens) << 24) | ((closes) << 27)
 
 # define JED_LINE_HIDDEN		0x0020
 # define JED_LINE_IS_READONLY		0x0040
@@ -116,11 +138,32 @@ typedef struct Mark
 #define VISIBLE_COLUMN_MARK	0x0400
 #define NARROW_REGION_MARK	0x0800
 #define JED_LINE_MARK		0x1000
+#define MARK_LINENUM_CURRENT	0x2000
 
 #define VISIBLE_MARK_MASK	(VISIBLE_MARK|VISIBLE_COLUMN_MARK)
   }
 Mark;
 
+/* S-Lang class ids of the objects that jed hands to the interpreter.
+ * User defined classes must be numbered 128 and up.
+ */
+#define JED_MARK_TYPE		128
+#define JED_SNAPSHOT_TYPE	129
+
+/* When the num_lines lines from line number linenum on are replaced by
+ * the num_to lines in the array to, the marks on the old line linenum + i
+ * move to the line to[map[i]].  See jed_replace_lines_above.
+ */
+typedef struct
+{
+   unsigned int linenum;
+   unsigned int num_lines;
+   unsigned int *map;
+   Line **to;
+   unsigned int num_to;
+}
+Jed_Line_Map_Type;
+
 #define JED_MAX_MARK_ARRAY_SIZE 5
 typedef struct Jed_Mark_Array_Type
 {
@@ -130,6 +173,8 @@ typedef struct Jed_Mark_Array_Type
 }
 Jed_Mark_Array_Type;
 
+typedef struct _User_Mark_Index_Type User_Mark_Index_Type;
+
 extern unsigned int LineNum;	       /* current line number */
 extern unsigned int Max_LineNum;       /* max line number */
 
@@ -140,6 +185,7 @@ typedef struct Narrow_Type
    Line *beg, *end;		       /* pointers to lines to linkup with */
    Line *beg1, *end1;		       /* beg and end before narrow */
    int is_region;
+   int newline_shown;		       /* set by jed_join_narrowed_lines */
 } Narrow_Type;
 
 #if JED_HAS_SAVE_NARROW
@@ -213,7 +259,7 @@ struct _Buffer
    unsigned int ndown;	       /* lines below narrow */
    Mark *marks;
    Mark *spots;
-   Mark *user_marks;
+   User_Mark_Index_Type *user_marks;  /* see paste.c */
    unsigned int modes;	       /* c-mode, wrap, etc... */
    SLKeyMap_List_Type *keymap;       /* keymap attached to this buffer */
    struct _Buffer *next;	       /*  */
@@ -259,12 +305,21 @@ struct _Buffer
 #if JED_HAS_LINE_ATTRIBUTES
    unsigned int max_unparsed_line_num;
    unsigned int min_unparsed_line_num;
+   /* The line that a partial parse stopped at, and its number.  Any
+    * change to the buffer forgets it.
+    */
+   Line *parse_resume_line;
+   unsigned int parse_resume_line_num;
 #endif
 #if JED_HAS_MENUS
    Menu_Bar_Type *menubar;
 #endif
 #if JED_HAS_DISPLAY_LINE_NUMBERS
    int line_num_display_size;
+   int line_num_relative;	       /* numbers relative to the current line */
+#endif
+#if JED_HAS_SOFT_WRAP
+   int soft_wrap;		       /* wrap long lines at the window edge */
 #endif
 };
 
@@ -371,6 +426,10 @@ extern void goto_line(int *);
 extern Line *make_line1(unsigned int);
 extern unsigned char *make_line(unsigned int);
 extern unsigned char *remake_line(unsigned int);
+extern void jed_unshare_line (void);
+extern int jed_show_hidden_newline (Line *);
+extern void jed_free_line_list (Line *);
+extern void jed_trim_line_slack (int);
 
 extern Buffer *make_buffer(char *, char *, char *);
 extern void uniquely_name_buffer(Buffer *, SLFUTURE_CONST char *);
@@ -385,6 +444,17 @@ extern int what_line(void);
 extern int erase_buffer(void);
 extern void mark_buffer_modified (Buffer *, int, int);
 extern Line *dup_line(Line *);
+extern Line *jed_create_line (unsigned char *, unsigned int);
+
+typedef struct _Jed_Buffer_Snapshot_Type Jed_Buffer_Snapshot_Type;
+extern Jed_Buffer_Snapshot_Type *jed_create_buffer_snapshot (void);
+extern void jed_free_buffer_snapshot (Jed_Buffer_Snapshot_Type *);
+extern unsigned int jed_buffer_snapshot_num_lines (Jed_Buffer_Snapshot_Type *);
+extern unsigned char *jed_buffer_snapshot_line (Jed_Buffer_Snapshot_Type *, unsigned int, unsigned int *);
+extern void create_buffer_snapshot (void);
+extern int buffer_snapshot_num_lines (void);
+extern void buffer_snapshot_line (int *);
+extern int jed_register_snapshot_class (void);
 extern void free_line(Line *);
 extern void check_buffers(void);
 extern int buffer_exists(Buffer *);
@@ -395,6 +465,7 @@ extern int Number_Two;
 extern int Number_Ten;
 extern void mark_undo_boundary(Buffer *);
 extern void delete_undo_ring(Buffer *);
+extern void record_lines_deletion (Line *, int);
 
 extern int Batch;		       /* JED used in batch mode. */
 extern void touch_screen(void);
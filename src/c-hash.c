@@ -10,6 +10,7 @@
 #define XXH_IMPLEMENTATION
 #define XXH_STATIC_LINKING_ONLY
 #include "xxhash.h"
+#include "c-hash.h"
 
 int32_t xxh32(const char *s, int32_t seed)	{ return XXH32(s, strlen(s), seed); }
 int64_t xxh64(const char *s, int64_t seed)	{ return XXH64(s, strlen(s), seed); }
@@ -0,0 +1,25 @@
+/*
+ *	XXH3, XXH32, XXH64 - hash encoding functions
+ *
+ *	See xxhash.h for authors and license details
+ */
+
+#if !defined(__C_HASH_H)
+#define __C_HASH_H
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* XXH3 hash of the contents of file, or 0 if it cannot be read */
+int64_t xxh64_hash_file(const char *file);
+
+size_t c_hash_init();
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -555,6 +555,133 @@ int quoted_insert()
 
 /*}}}*/
 
+/*{{{ bracketed_paste_cmd */
+
+static int insert_pasted_text (unsigned char *buf, unsigned int len)
+{
+   CHECK_READ_ONLY
+
+   if (CBuf == MiniBuffer)
+     {
+	unsigned int i;
+	/* The minibuffer is a single line */
+	for (i = 0; i < len; i++)
+	  if (buf[i] == '\n') buf[i] = ' ';
+     }
+
+   if (-1 == jed_insert_nbytes (buf, len))
+     return -1;
+
+   return 1;
+}
+
+/* This is bound to the "ESC [ 200 ~" sequence that a terminal sends in front
+ * of pasted text when bracketed-paste mode is on.  Everything up to the
+ * closing "ESC [ 201 ~" is collected into a buffer and inserted with a single
+ * call to jed_insert_nbytes.  A paste is therefore one command: one undo
+ * group, one screen update, and none of the per-character processing
+ * (wrapping, abbrevs, auto-indentation) that would mangle the text.
+ */
+int bracketed_paste_cmd (void)
+{
+   static SLCONST char *end_seq = "\033[201~";
+   unsigned char *buf;
+   unsigned int len, max_len, nmatched;
+   int last_was_cr = 0;
+   int timed_out = 0;
+   int ret;
+
+   max_len = 1024;
+   if (NULL == (buf = (unsigned char *) SLmalloc (max_len)))
+     return -1;
+   len = 0;
+   nmatched = 0;
+
+   while (end_seq[nmatched] != 0)
+     {
+	int ch;
+
+	/* Do not hang if the terminator never arrives */
+	if (0 == input_pending (&Number_Ten))
+	  {
+	     timed_out = 1;
+	     break;
+	  }
+
+	ch = jed_getkey ();
+	if (SLKeyBoard_Quit || (SLang_get_error () == SL_USER_BREAK))
+	  break;
+
+	if (ch == (unsigned char) end_seq[nmatched])
+	  {
+	     nmatched++;
+	     continue;
+	  }
+
+	if (len + nmatched + 1 > max_len)
+	  {
+	     unsigned char *newbuf;
+	     unsigned int new_max = 2 * max_len + nmatched;
+
+	     newbuf = (unsigned char *) SLrealloc ((char *) buf, new_max);
+	     if (newbuf == NULL)
+	       {
+		  SLfree ((char *) buf);
+		  return -1;
+	       }
+	     buf = newbuf;
+	     max_len = new_max;
+	  }
+
+	if (nmatched)
+	  {
+	     /* A false start: the bytes belong to the text */
+	     memcpy (buf + len, end_seq, nmatched);
+	     len += nmatched;
+	     nmatched = 0;
+	     last_was_cr = 0;
+	     if (ch == (unsigned char) end_seq[0])
+	       {
+		  nmatched = 1;
+		  continue;
+	       }
+	  }
+
+	/* Terminals send CR for a newline; map both CR and CRLF to LF */
+	if (ch == '\r')
+	  {
+	     buf[len++] = '\n';
+	     last_was_cr = 1;
+	     continue;
+	  }
+	if ((ch == '\n') && last_was_cr)
+	  {
+	     last_was_cr = 0;
+	     continue;
+	  }
+	last_was_cr = 0;
+	buf[len++] = (unsigned char) ch;
+     }
+
+   /* What was read of a terminator that never finished may be the start
+    * of the next key, e.g., a lone ESC, so it is read again.
+    */
+   if (timed_out && nmatched)
+     ungetkey_string ((char *) end_seq, (int) nmatched);
+
+   if (SLKeyBoard_Quit || (SLang_get_error () == SL_USER_BREAK))
+     ret = 0;
+   else if (len == 0)
+     ret = 1;
+   else
+     ret = insert_pasted_text (buf, len);
+
+   SLfree ((char *) buf);
+   return ret;
+}
+
+/*}}}*/
+
 /*{{{ kill_line */
 
 /* FIXME: MULTIBYTE unsafe */
@@ -726,19 +853,20 @@ static void scroll_completion (int dir)
 
 int goto_bottom_of_window (void)
 {
-   int n;
+   int n, above, nlines;
 
-   n = JWindow->rows - window_line ();
+   jed_window_line_span (&above, &nlines);
+   n = nlines - 1 - above;
 
    return n == next_visible_lines (n);
 }
 
 void goto_top_of_window (void)
 {
-   int n;
+   int above, nlines;
 
-   n = window_line () - 1;
-   (void) prev_visible_lines (n);
+   jed_window_line_span (&above, &nlines);
+   (void) prev_visible_lines (above);
 }
 
 static int Last_Page_Line;
@@ -1234,6 +1362,7 @@ int jed_quit_jed(int status)
 
    jed_reset_display();
    reset_tty();
+   jed_dump_key_latency_at_exit ();
 #ifdef VMS
    vms_cancel_exithandler();
 #endif
@@ -36,6 +36,7 @@ extern int pageup_cmd(void);
 extern int jed_scroll_left_cmd (void);
 extern int jed_scroll_right_cmd (void);
 extern int quoted_insert(void);
+extern int bracketed_paste_cmd(void);
 extern void indent_to(int);
 extern int goto_column1(int *);
 extern void goto_column(int *);
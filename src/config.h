@@ -83,6 +83,7 @@
 #define HAVE_SYMLINK 1
 #define HAVE_GETHOSTNAME 1
 #define HAVE_FSYNC 1
+#define HAVE_MMAP 1
 
 /* Define if you have the vsnprintf, snprintf functions and they return
  * EOF upon failure.
@@ -15,9 +15,19 @@
 /* This file is included by syntax.c */
 
 #include "dfasyntx.h"
-#include "version.h"
+#include "xxhash.h"
 
 #define USE_DFA_CACHE	1
+
+#if USE_DFA_CACHE && defined(HAVE_MMAP)
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <sys/mman.h>
+# include <fcntl.h>
+# ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+# endif
+#endif
 /*
  * The minimum number of "unsigned char"s we need to store at least
  * UCHAR_MAX+1 bits.
@@ -29,6 +39,46 @@
 typedef struct NFA NFA;
 typedef struct Accept Accept;
 typedef struct DFA DFA;
+typedef struct DFA_Accepts DFA_Accepts;
+typedef struct DFA_Accept_Info DFA_Accept_Info;
+typedef struct DFA_Region DFA_Region;
+
+/*
+ * DFA states are numbered from 0, and a transition is stored as the
+ * number of the state it leads to.  DFA_NO_STATE marks the error state,
+ * and DFA_UNBUILT a transition of a lazily built table that has not
+ * been computed yet, so a table can hold at most DFA_MAX_STATES states.
+ */
+typedef unsigned short DFA_State_Num;
+#define DFA_NO_STATE ((DFA_State_Num) 0xFFFF)
+#define DFA_UNBUILT ((DFA_State_Num) 0xFFFE)
+#define DFA_MAX_STATES 0xFFFE
+
+/*
+ * A lazily built table keeps at most this many states. When it is
+ * full, all but the two start states are discarded and rebuilt as
+ * they are reached again.
+ */
+#define DFA_LAZY_MAX_STATES 4096
+
+/* The number of buckets used to find a DFA state by its NFA set */
+#define DFA_STATE_HASH_SIZE 1024
+
+/*
+ * State 0 is the normal start state, and state 1 is the start state at
+ * the beginning of a line.
+ */
+#define DFA_START_STATE 0
+#define DFA_BOL_STATE 1
+
+#define DFA_NO_ACCEPT 0xFFFF
+
+/*
+ * Regions are numbered from 1; 0 means "not in a region". The number
+ * of the region a line starts in is kept in its flags, which have room
+ * for 255 of them, but few languages need more than two or three.
+ */
+#define DFA_MAX_REGIONS 32
 
 /*
  * Set of characters. Note that this will not be the only kind of
@@ -61,15 +111,49 @@ struct Accept
    int state;
    int is_quick, is_end;
    int colour, is_preproc, is_keyword;
+   int region;			       /* region the token begins, or 0 */
+   int index;			       /* position in accept_info */
 };
 
 struct DFA
 {
    DFA *next;
+   DFA *hash_next;
    int number;
    unsigned char *nfa_set;	       /* the corresp. set of NFA states */
    Accept *accept, *accept_end;
-   DFA *where_to[UCHAR_MAX+1];
+};
+
+/*
+ * The parts of an Accept structure needed while highlighting. These
+ * and the structures below contain no pointers, so that they can be
+ * used directly from a mapped cache file.
+ */
+struct DFA_Accept_Info
+{
+   int colour;
+   short is_quick, is_end, is_preproc, is_keyword;
+   short region, reserved;
+};
+
+/*
+ * The accepting rules of a DFA state, as indices into accept_info,
+ * or DFA_NO_ACCEPT.
+ */
+struct DFA_Accepts
+{
+   unsigned short accept, accept_end;
+};
+
+/*
+ * A region is started by a token of the main table and runs, possibly
+ * over several lines, up to the first match of its end pattern. The end
+ * pattern has a small table of its own.
+ */
+struct DFA_Region
+{
+   Highlight *end;
+   int colour;
 };
 
 /*
@@ -80,20 +164,60 @@ struct DFA
  * equivalence classes, accomplished by storing, in equiv[c], the
  * lowest value in the same equivalence class as c. "accept" is a
  * list of accepting states in the NFA, together with their colours
- * and properties, and "dfa" is the actual DFA table.
+ * and properties, and "dfa" is the list of DFA states.
+ *
+ * The transitions are not stored per character. Each equivalence
+ * class is numbered densely in class_of[], and "trans" is a matrix
+ * of dfa_states rows by num_classes columns, so that the state
+ * reached from state s on character c is
+ * trans[s*num_classes + class_of[c]]. "accepts" holds the accepting
+ * rules of each state, indexed by state number, and "accept_info"
+ * the rules themselves. Only these arrays are used while
+ * highlighting.
+ *
+ * While the DFA is being built, "states" maps state numbers to the
+ * list nodes and "state_hash" finds a state by its NFA set. Unless
+ * the table is to be saved to a cache, it is built lazily: the
+ * transitions start out as DFA_UNBUILT, and each is computed the
+ * first time the highlighter takes it.
  *
  * DFA tables can take some time to generate - over a second on my
  * 486 for C mode - and so instead of generating them every time
- * Jed needs them, I support a caching option.
+ * Jed needs them, I support a caching option. "rules_hash" is a
+ * hash of the rules that have been defined, which identifies the
+ * cache file that matches them. A table loaded from a cache has no
+ * NFA or DFA lists, and its arrays point into "cache_data".
+ *
+ * "regions" holds the multi-line regions; region r is regions[r-1].
+ * Their end tables are small and are never cached.
  */
 struct Highlight
 {
    int nfa_states, dfa_states;
    NFA *nfa;
    unsigned char equiv[EQUIV_TABLE_SIZE];
+   unsigned char class_of[EQUIV_TABLE_SIZE];
+   int num_classes;
    Accept *accept;
    DFA *dfa;
+   DFA_State_Num *trans;
+   DFA_Accepts *accepts;
+   DFA_Accept_Info *accept_info;
+   int num_accepts;
+   int max_dfa_states;		       /* number of rows allocated */
+   DFA *dfa_tail;
+   DFA **states;
+   DFA **state_hash;
+   unsigned char *work_set;	       /* a working set of NFA states */
+   int nfa_set_size;
+   int is_lazy;
    char *filename;
+   XXH64_hash_t rules_hash;
+   unsigned char *cache_data;
+   unsigned long cache_size;
+   int cache_is_mapped;
+   DFA_Region regions[DFA_MAX_REGIONS];
+   int num_regions;
 };
 
 /*
@@ -106,9 +230,16 @@ static int parse_reg2 (Highlight *, char **, int *, int *, int *);
 static int parse_reg3 (Highlight *, char **, int *, int *, int *);
 static int parse_reg4 (Highlight *, char **, int *, int *, int *);
 static void add_nfa_trans (Highlight *, int , int , Set);
+static void add_utf8_trans (Highlight *, int *, int *);
 static int get_lexeme (char **, int *);
 static void eat_lexeme (char **, int *);
 static void compute_closure (Highlight *, unsigned char *);
+static int compute_classes (unsigned char *, unsigned char *);
+static int grow_dfa_tables (Highlight *, int);
+static int make_accept_info (Highlight *);
+static int add_dfa_state (Highlight *, unsigned char *);
+static int compute_dfa_transition (Highlight *, int, int);
+static void discard_dfa (Highlight *);
 
 /*
  * Parser error codes.
@@ -135,7 +266,7 @@ static Highlight *init_highlight (void)
 #define FLAG_KEYWORD  2
 #define FLAG_PREPROC  4
 static void add_rule (Highlight *h, char *rule, int length,
-		      int flags, int colour)
+		      int flags, int colour, int region)
 {
    int start = 0, end = 0;
    int is_begin, is_end;
@@ -168,6 +299,7 @@ static void add_rule (Highlight *h, char *rule, int length,
 	acc->is_keyword = ((flags & FLAG_KEYWORD) ? 1 : 0);
 	acc->colour = colour;
 	acc->is_end = is_end;
+	acc->region = region;
      }
    else
      {
@@ -201,10 +333,15 @@ static void add_rule (Highlight *h, char *rule, int length,
  *   reg4   : char
  *          | char-set
  *          | .
+ *          | \u
  *          | ( reg1 )
  *
  * Lexemes are: all chars (0 to 255), caret, dollar, vbar, star,
- * plus, query, lbracket, rbracket, dash, dot, lparen and rparen.
+ * plus, query, lbracket, rbracket, dash, dot, lparen, rparen and
+ * utf8. The last, written \u, matches the UTF-8 encoding of one
+ * non-ASCII character, so that rules such as "([A-Za-z_]|\u)+" keep
+ * multibyte characters inside their tokens.  Older versions read \u
+ * as an escaped `u', like any other escaped character.
  */
 
 #define LEX_CARET (UCHAR_MAX+1+(unsigned char)'^')
@@ -220,6 +357,7 @@ static void add_rule (Highlight *h, char *rule, int length,
 #define LEX_LPAREN (UCHAR_MAX+1+(unsigned char)'(')
 #define LEX_RPAREN (UCHAR_MAX+1+(unsigned char)')')
 #define LEX_ENDOFTEXT (2*UCHAR_MAX+2)
+#define LEX_UTF8 (2*UCHAR_MAX+3)
 #define is_normal_char(lex) ((lex)<=UCHAR_MAX)
 
 static int parse_regexp (Highlight *h, char **text, int *length,
@@ -281,7 +419,7 @@ static int parse_reg2 (Highlight *h, char **text, int *length,
 
    while ((lex=get_lexeme(text, length)) == LEX_LPAREN ||
 	  lex == LEX_LBRACKET || lex == LEX_DASH ||
-	  lex == LEX_DOT || is_normal_char(lex))
+	  lex == LEX_DOT || lex == LEX_UTF8 || is_normal_char(lex))
      {
 	int st = en;
 	en = 0;
@@ -353,6 +491,13 @@ static int parse_reg4 (Highlight *h, char **text, int *length,
 	return 0;
      }
 
+   if (lex == LEX_UTF8)
+     {
+	eat_lexeme (text, length);
+	add_utf8_trans (h, start, end);
+	return 0;
+     }
+
     /*
      * OK, all other possibilities now involve a character set. So
      * create one.
@@ -436,6 +581,48 @@ static int parse_reg4 (Highlight *h, char **text, int *length,
    return 0;
 }
 
+/*
+ * Add NFA transitions from *start to *end that match one UTF-8 encoded
+ * non-ASCII character: a lead byte, then as many continuation bytes as
+ * it calls for.
+ */
+static void add_utf8_trans (Highlight *h, int *start, int *end)
+{
+   Set lead, cont;
+   int need[3];		       /* states expecting 1, 2 or 3 more bytes */
+   int c;
+
+   if (!*start)
+     *start = h->nfa_states++;
+   if (!*end)
+     *end = h->nfa_states++;
+   need[0] = h->nfa_states++;
+   need[1] = h->nfa_states++;
+   need[2] = h->nfa_states++;
+
+   empty_set ((char *)cont, SET_SIZE);
+   for (c = 0x80; c <= 0xBF; c++)
+     add_to_set (cont, c);
+   add_nfa_trans (h, need[0], *end, cont);
+   add_nfa_trans (h, need[1], need[0], cont);
+   add_nfa_trans (h, need[2], need[1], cont);
+
+   empty_set ((char *)lead, SET_SIZE);
+   for (c = 0xC2; c <= 0xDF; c++)
+     add_to_set (lead, c);
+   add_nfa_trans (h, *start, need[0], lead);
+
+   empty_set ((char *)lead, SET_SIZE);
+   for (c = 0xE0; c <= 0xEF; c++)
+     add_to_set (lead, c);
+   add_nfa_trans (h, *start, need[1], lead);
+
+   empty_set ((char *)lead, SET_SIZE);
+   for (c = 0xF0; c <= 0xF4; c++)
+     add_to_set (lead, c);
+   add_nfa_trans (h, *start, need[2], lead);
+}
+
 /*
  * Add an NFA transition.
  */
@@ -513,6 +700,8 @@ static int get_lexeme (char **text, int *length)
 	if (*length == 1)
 	  return '\\';
 	t++;
+	if (*t == 'u')
+	  return LEX_UTF8;
 	/* fall through */
       default:
 	return (int) ((unsigned char) *t);
@@ -533,160 +722,413 @@ static void eat_lexeme (char **text, int *length)
      (*text) += 1, (*length) -= 1;
 }
 
-static void make_dfa (Highlight *h)
+/*
+ * Number the equivalence classes densely: class_of[c] is the index
+ * of the class containing c. Returns the number of classes.
+ */
+static int compute_classes (unsigned char *equiv, unsigned char *class_of)
 {
-   int setsize;
-   DFA *tail, *next, *search;
-   unsigned char *destination;	       /* a working set */
-   int c, dest_empty;
-   NFA *n;
+   int c, n = 0;
+
+   for (c = 0; c < EQUIV_TABLE_SIZE; c++)
+     {
+	if (equiv[c] == c)
+	  class_of[c] = (unsigned char) n++;
+	else
+	  class_of[c] = class_of[equiv[c]];
+     }
+   return n;
+}
+
+/*
+ * Make sure that the transition matrix has room for num_states rows.
+ */
+static int grow_dfa_tables (Highlight *h, int num_states)
+{
+   DFA_State_Num *trans;
+   DFA_Accepts *accepts;
+   DFA **states;
+   int n;
+
+   if (num_states <= h->max_dfa_states)
+     return 0;
+
+   n = h->max_dfa_states ? 2 * h->max_dfa_states : 64;
+   if (n < num_states)
+     n = num_states;
+   if (n > DFA_MAX_STATES)
+     n = DFA_MAX_STATES;
+   if (num_states > n)
+     return -1;
+
+   trans = (DFA_State_Num *) SLrealloc ((char *) h->trans,
+					n * h->num_classes * sizeof (DFA_State_Num));
+   if (trans == NULL)
+     return -1;
+   h->trans = trans;
+
+   accepts = (DFA_Accepts *) SLrealloc ((char *) h->accepts, n * sizeof (DFA_Accepts));
+   if (accepts == NULL)
+     return -1;
+   h->accepts = accepts;
+
+   states = (DFA **) SLrealloc ((char *) h->states, n * sizeof (DFA *));
+   if (states == NULL)
+     return -1;
+   h->states = states;
+
+   h->max_dfa_states = n;
+   return 0;
+}
+
+/*
+ * Number the accepting rules and copy the parts that the
+ * highlighter needs into the accept_info array.
+ */
+static int make_accept_info (Highlight *h)
+{
+   Accept *a;
+   int n;
+
+   n = 0;
+   for (a = h->accept; a != NULL; a = a->next)
+     n++;
+   if (n >= DFA_NO_ACCEPT)
+     return -1;
+
+   h->accept_info = (DFA_Accept_Info *) SLmalloc ((n + 1) * sizeof (DFA_Accept_Info));
+   if (h->accept_info == NULL)
+     return -1;
+   h->num_accepts = n;
+
+   n = 0;
+   for (a = h->accept; a != NULL; a = a->next)
+     {
+	DFA_Accept_Info *info = h->accept_info + n;
+
+	info->colour = a->colour;
+	info->is_quick = (short) a->is_quick;
+	info->is_end = (short) a->is_end;
+	info->is_preproc = (short) a->is_preproc;
+	info->is_keyword = (short) a->is_keyword;
+	info->region = (short) a->region;
+	info->reserved = 0;
+	a->index = n++;
+     }
+   return 0;
+}
+
+static unsigned int hash_nfa_set (Highlight *h, unsigned char *set)
+{
+   return (unsigned int) XXH3_64bits (set, h->nfa_set_size) & (DFA_STATE_HASH_SIZE - 1);
+}
+
+static int find_dfa_state (Highlight *h, unsigned char *set)
+{
+   DFA *d;
+
+   for (d = h->state_hash[hash_nfa_set (h, set)]; d != NULL; d = d->hash_next)
+     {
+	if (!memcmp ((char *) d->nfa_set, (char *) set, h->nfa_set_size))
+	  return d->number;
+     }
+   return -1;
+}
+
+/*
+ * Add a DFA state for the given set of NFA states, none of whose
+ * transitions are known yet. Returns the number of the new state,
+ * or -1 upon failure.
+ */
+static int add_dfa_state (Highlight *h, unsigned char *set)
+{
+   DFA *d;
    Accept *a;
+   DFA_State_Num *row;
+   unsigned int hash;
+   int i;
+
+   if (-1 == grow_dfa_tables (h, h->dfa_states + 1))
+     return -1;
+
+   if (NULL == (d = (DFA *) SLmalloc (sizeof (DFA))))
+     return -1;
+   memset ((char *) d, 0, sizeof (DFA));
+
+   if (NULL == (d->nfa_set = (unsigned char *) SLmalloc (h->nfa_set_size)))
+     {
+	SLfree ((char *) d);
+	return -1;
+     }
+   memcpy ((char *) d->nfa_set, (char *) set, h->nfa_set_size);
+
+   d->number = h->dfa_states++;
+   if (h->dfa == NULL)
+     h->dfa = d;
+   else
+     h->dfa_tail->next = d;
+   h->dfa_tail = d;
+   h->states[d->number] = d;
+
+   hash = hash_nfa_set (h, set);
+   d->hash_next = h->state_hash[hash];
+   h->state_hash[hash] = d;
 
+    /*
+     * Check the acceptance properties of the state: we need to know
+     * if it contains any accepting NFA-states, and whether they are
+     * constrained to be accepting only at the beginning or end of
+     * the line.
+     */
+   for (a = h->accept; a; a = a->next)
+     {
+	if (is_in_set (d->nfa_set, a->state))
+	  {
+	     d->accept_end = a;
+	     if (!a->is_end)
+	       d->accept = a;
+	  }
+     }
+   h->accepts[d->number].accept
+     = d->accept ? d->accept->index : DFA_NO_ACCEPT;
+   h->accepts[d->number].accept_end
+     = d->accept_end ? d->accept_end->index : DFA_NO_ACCEPT;
+
+   row = h->trans + d->number * h->num_classes;
+   for (i = 0; i < h->num_classes; i++)
+     row[i] = DFA_UNBUILT;
+
+   return d->number;
+}
+
+/*
+ * Free the DFA states numbered keep and above.
+ */
+static void free_dfa_states (Highlight *h, int keep)
+{
+   int i;
+
+   for (i = keep; i < h->dfa_states; i++)
+     {
+	DFA *d = h->states[i];
+	SLfree ((char *) d->nfa_set);
+	SLfree ((char *) d);
+     }
+   if (keep < h->dfa_states)
+     h->dfa_states = keep;
+
+   memset ((char *) h->state_hash, 0, DFA_STATE_HASH_SIZE * sizeof (DFA *));
+   h->dfa = h->dfa_tail = NULL;
+   for (i = 0; i < h->dfa_states; i++)
+     {
+	DFA *d = h->states[i];
+	unsigned int hash = hash_nfa_set (h, d->nfa_set);
+
+	d->next = NULL;
+	if (h->dfa == NULL)
+	  h->dfa = d;
+	else
+	  h->dfa_tail->next = d;
+	h->dfa_tail = d;
+
+	d->hash_next = h->state_hash[hash];
+	h->state_hash[hash] = d;
+     }
+}
+
+/*
+ * Compute the transition from state s on the character c, which is
+ * the representative member of its equivalence class, and add the
+ * state that it leads to if that is new. Returns the state reached,
+ * DFA_NO_STATE for the error state, or -1 upon failure.
+ */
+static int compute_dfa_transition (Highlight *h, int s, int c)
+{
+   unsigned char *destination = h->work_set;
+   unsigned char *from = h->states[s]->nfa_set;
+   int dest_empty = 1;
+   int to;
+   NFA *n;
+
+   empty_set ((char *)destination, h->nfa_set_size);
+
+   for (n = h->nfa; n; n = n->next)
+     {
+	if (is_in_set (from, n->from) &&
+	    !n->is_empty && is_in_set (n->set, c))
+	  {
+	     add_to_set (destination, n->to);
+	     dest_empty = 0;
+	  }
+     }
+
+   if (dest_empty)
+     to = DFA_NO_STATE;
+   else
+     {
+	compute_closure (h, destination);
+	to = find_dfa_state (h, destination);
+	if ((to == -1)
+	    && (-1 == (to = add_dfa_state (h, destination))))
+	  return -1;
+     }
+
+   h->trans[s * h->num_classes + h->class_of[c]] = (DFA_State_Num) to;
+   return to;
+}
+
+/*
+ * Set up the construction of the DFA: allocate the working storage
+ * and add the two start states.
+ */
+static int start_dfa (Highlight *h)
+{
     /*
      * First calculate the size of array we will need to store a
      * set of NFA states. Allocate our temporary set variables.
      */
-   setsize = (h->nfa_states + CHAR_BIT - 1) / CHAR_BIT;
-   destination = (unsigned char *)SLmalloc(setsize);
-   if (!destination)
-     return;
+   h->nfa_set_size = (h->nfa_states + CHAR_BIT - 1) / CHAR_BIT;
+   h->dfa_states = 0;
+   h->num_classes = compute_classes (h->equiv, h->class_of);
+
+   if ((NULL == (h->work_set = (unsigned char *) SLmalloc (h->nfa_set_size)))
+       || (NULL == (h->state_hash = (DFA **) SLmalloc (DFA_STATE_HASH_SIZE * sizeof (DFA *))))
+       || (-1 == make_accept_info (h)))
+     return -1;
+   memset ((char *) h->state_hash, 0, DFA_STATE_HASH_SIZE * sizeof (DFA *));
 
     /*
      * Now define our first DFA state. This is the epsilon-closure
      * of NFA state zero, and is the normal start state for the DFA.
      */
-   h->dfa_states = 0;
-
-   h->dfa = tail = (DFA *) SLmalloc(sizeof(DFA));
-   if (tail == NULL)
-     goto error;
-
-   memset ((char *) tail, 0, sizeof (DFA));
-
-   if (NULL == (tail->nfa_set = (unsigned char *)SLmalloc(setsize)))
-     goto error;
-
-   /* tail->next = NULL;  memset has done this */
-
-   tail->number = h->dfa_states++;
-   empty_set ((char *) tail->nfa_set, setsize);
-   add_to_set (tail->nfa_set, 0);
-   compute_closure (h, tail->nfa_set);
+   empty_set ((char *) h->work_set, h->nfa_set_size);
+   add_to_set (h->work_set, 0);
+   compute_closure (h, h->work_set);
+   if (DFA_START_STATE != add_dfa_state (h, h->work_set))
+     return -1;
 
     /*
      * Our second DFA state is the epsilon-closure of NFA states
      * zero and one, and is the start state for the DFA when we are
      * at the beginning of a line.
      */
-   if (NULL == (tail->next = (DFA *) SLmalloc(sizeof(DFA))))
-     goto error;
-   tail = tail->next;
-   memset ((char *) tail, 0, sizeof (DFA));
+   empty_set ((char *) h->work_set, h->nfa_set_size);
+   add_to_set (h->work_set, 0);
+   add_to_set (h->work_set, 1);
+   compute_closure (h, h->work_set);
+   if (DFA_BOL_STATE != add_dfa_state (h, h->work_set))
+     return -1;
 
-   if (NULL == (tail->nfa_set = (unsigned char *) SLmalloc(setsize)))
-     goto error;
+   return 0;
+}
 
-   /* tail->next = NULL; */
+/*
+ * Free everything that describes the DFA.
+ */
+static void discard_dfa (Highlight *h)
+{
+   if (h->states != NULL)
+     free_dfa_states (h, 0);
+   SLfree ((char *) h->trans);
+   SLfree ((char *) h->accepts);
+   SLfree ((char *) h->accept_info);
+   SLfree ((char *) h->states);
+   SLfree ((char *) h->state_hash);
+   SLfree ((char *) h->work_set);
+   h->trans = NULL;
+   h->accepts = NULL;
+   h->accept_info = NULL;
+   h->states = NULL;
+   h->state_hash = NULL;
+   h->work_set = NULL;
+   h->dfa = h->dfa_tail = NULL;
+   h->max_dfa_states = 0;
+   h->dfa_states = 0;
+   h->is_lazy = 0;
+}
 
-   tail->number = h->dfa_states++;
-   empty_set ((char *) tail->nfa_set, setsize);
-   add_to_set (tail->nfa_set, 0);
-   add_to_set (tail->nfa_set, 1);
-   compute_closure (h, tail->nfa_set);
+/*
+ * Build the whole DFA, so that it can be saved to a cache file.
+ */
+static void make_dfa (Highlight *h)
+{
+   int s, c;
+
+   if (-1 == start_dfa (h))
+     goto error;
 
     /*
-     * Next, work along the DFA processing each state in turn.
+     * Work along the DFA processing each state in turn. We need
+     * only consider transitions on a representative member of each
+     * equivalence class.
      */
-   for (next = h->dfa; next; next=next->next)
+   for (s = 0; s < h->dfa_states; s++)
      {
-	/*
-	 * We have a state from which we wish to compute all the
-	 * transitions. Of course we need only consider transitions
-	 * on a representative member of each equivalence class.
-	 */
 	for (c = 0; c < EQUIV_TABLE_SIZE; c++)
 	  {
-	     if (h->equiv[c] == c)
-	       {
-		  empty_set ((char *)destination, setsize);
-		  dest_empty = 1;
-
-		  for (n = h->nfa; n; n = n->next)
-		    {
-		       if (is_in_set (next->nfa_set, n->from) &&
-			   !n->is_empty && is_in_set (n->set, c))
-			 {
-			    add_to_set (destination, n->to);
-			    dest_empty = 0;
-			 }
-		    }
-		  compute_closure (h, destination);
-
-		  if (dest_empty)
-		    search = NULL;
-		  else
-		    {
-		       for (search = h->dfa; search; search = search->next)
-			 if (!memcmp((char *) search->nfa_set, (char *) destination, setsize))
-			   break;
-
-		       if (!search)
-			 {
-			    if (NULL == (search = tail->next = (DFA *) SLmalloc(sizeof(DFA))))
-			      goto error;
-			    tail = tail->next;
-			    if (NULL == (tail->nfa_set = (unsigned char *)SLmalloc(setsize)))
-			      goto error;
-			    tail->next = NULL;
-			    tail->number = h->dfa_states++;
-			    memcpy ((char *) tail->nfa_set, (char *)destination, setsize);
-			 }
-		    }
-
-		  next->where_to[c] = search;
-	       }
-	     else
-	       next->where_to[c] = next->where_to[h->equiv[c]];
-	  }
-
-	/*
-	 * Having done the transitions for the state, let us also
-	 * check its acceptance properties: we need to know if it
-	 * contains any accepting NFA-states, and whether they are
-	 * constrained to be accepting only at the beginning or end
-	 * of the line.
-	 */
-	next->accept = next->accept_end = NULL;
-	for (a = h->accept; a; a = a->next)
-	  {
-	     if (is_in_set (next->nfa_set, a->state))
-	       {
-		  next->accept_end = a;
-		  if (!a->is_end)
-		    next->accept = a;
-	       }
+	     if ((h->equiv[c] == c)
+		 && (-1 == compute_dfa_transition (h, s, c)))
+	       goto error;
 	  }
      }
-
-    /*
-     * Free the temporary variables.
-     */
-   SLfree ((char *)destination);
    return;
 
     /*
-     * Get here if a malloc returned null; clean up the mess.
+     * Get here if a malloc returned null, or the table grew too
+     * large; clean up the mess.
      */
    error:
-   for (tail = h->dfa; tail; tail=tail->next)
+   if (h->dfa_states >= DFA_MAX_STATES)
+     msg_error ("DFA syntax table has too many states");
+   discard_dfa (h);
+}
+
+/*
+ * Set up a DFA whose states are built as the highlighter reaches them.
+ */
+static void make_lazy_dfa (Highlight *h)
+{
+   if (-1 == start_dfa (h))
      {
-	if (tail->nfa_set)
-	  SLfree ((char *)tail->nfa_set);
-	next = tail->next;
-	SLfree ((char *)tail);
-	tail = next;
+	discard_dfa (h);
+	return;
+     }
+   h->is_lazy = 1;
+}
+
+/*
+ * Called by the highlighter to take a transition from state s on the
+ * character ch that has not been computed yet.
+ */
+static unsigned int lazy_dfa_transition (Highlight *h, unsigned int s, unsigned char ch)
+{
+   int to;
+
+   if (h->dfa_states >= DFA_LAZY_MAX_STATES)
+     {
+	/*
+	 * The table is full: throw away all of the states except the
+	 * start states, keeping the one we are in.
+	 */
+	int i;
+
+	if (s > DFA_BOL_STATE)
+	  memcpy ((char *) h->work_set, (char *) h->states[s]->nfa_set, h->nfa_set_size);
+
+	free_dfa_states (h, DFA_BOL_STATE + 1);
+	for (i = 0; i < (DFA_BOL_STATE + 1) * h->num_classes; i++)
+	  h->trans[i] = DFA_UNBUILT;
+
+	if ((s > DFA_BOL_STATE)
+	    && (-1 == (int) (s = (unsigned int) add_dfa_state (h, h->work_set))))
+	  return DFA_NO_STATE;
      }
-   h->dfa = NULL;
+
+   to = compute_dfa_transition (h, (int) s, h->equiv[ch]);
+   if (to == -1)
+     return DFA_NO_STATE;
+
+   return (unsigned int) to;
 }
 
 /*
@@ -718,202 +1160,243 @@ static void compute_closure (Highlight *h, unsigned char *set)
 }
 
 #if USE_DFA_CACHE
-
 /*
- * I'm going to do this quite a bit in the next routine, so let's
- * make life easier for myself.
+ * The DFA cache is a binary file that holds the arrays used by the
+ * highlighter, so that it can be mapped into memory and used as is.
+ * It begins with a DFA_Cache_Header, which is followed by
+ * num_accepts DFA_Accept_Info structures, dfa_states DFA_Accepts
+ * structures, and finally the dfa_states by num_classes transition
+ * matrix. All of these are written in the native byte order and
+ * layout, and the header records enough to detect a file written by
+ * a different build: the format number, a byte-order marker, and
+ * the sizes of the structures.
+ *
+ * The header also holds an XXH3 hash of the highlighting rules, in
+ * the order in which they were defined. A cache file whose hash does
+ * not match the current rules is ignored, and the table is rebuilt
+ * and the file rewritten.
  */
-#define get(buf) do { \
-	if (!fgets((buf),sizeof((buf)),fp)) goto error; \
-	(buf)[strcspn((buf), "\n")] = '\0'; \
-    } while (0)
+#define DFA_CACHE_MAGIC		"JEDDFA\032"   /* 8 bytes with the NUL */
+#define DFA_CACHE_FORMAT	2
+#define DFA_CACHE_BYTE_ORDER	0x01020304UL
 
-/*
- * Cache routine: try to load a DFA out of the cache.
- */
+typedef struct
+{
+   char magic[8];
+   unsigned int format;
+   unsigned int byte_order;
+   unsigned int header_size;
+   unsigned int sizes;		       /* sizes of the structures below */
+   unsigned int num_accepts;
+   unsigned int dfa_states;
+   unsigned int num_classes;
+   unsigned int reserved;
+   XXH64_hash_t rules_hash;
+   unsigned char equiv[EQUIV_TABLE_SIZE];
+}
+DFA_Cache_Header;
 
-/* FIXME!!!  This routine allocates arrays of Accept, DFA, etc structures
- * and turns them into linked lists.  However, elsewhere each node in the
- * list is allocated.  So, the free_highlight_table routine cannot be used
- * with a DFA read from the cache.  Perhaps the best and easiest fix would
- * be to add a "free" method to the Highlight structure.
- *
- * There is currently no way of knowing if the set of regular expressions
- * matches those implicit in the cache.  It would be nice to write out the
- * list of regular expressions used and compare those with the desired
- * expressions, or to compute and compare MD5 checksums.
+#define DFA_CACHE_SIZES \
+   ((sizeof (DFA_Accept_Info) << 16) | (sizeof (DFA_Accepts) << 8) \
+    | sizeof (DFA_State_Num))
+
+static unsigned long dfa_cache_size (unsigned int num_accepts,
+				     unsigned int dfa_states,
+				     unsigned int num_classes)
+{
+   return sizeof (DFA_Cache_Header)
+     + num_accepts * sizeof (DFA_Accept_Info)
+     + dfa_states * sizeof (DFA_Accepts)
+     + (unsigned long) dfa_states * num_classes * sizeof (DFA_State_Num);
+}
+
+/*
+ * Read the whole of a cache file into memory, mapping it if possible.
  */
-static int load_dfa (Highlight *h, char *name)
+static int map_dfa_cache (Highlight *h)
 {
-   FILE *fp;
-   char buffer[2048], buf2[2048];
-   unsigned char equiv[EQUIV_TABLE_SIZE];
-   int i, j;
-   Accept *accept = NULL;
-   int accepts;
-   DFA *dfa = NULL;
-   int dfa_states;
+#ifdef HAVE_MMAP
+   struct stat st;
+   void *addr;
+   int fd;
 
-   if (h->filename == NULL)
-     return 0;		       /* don't have caching enabled */
+   if (-1 == (fd = open (h->filename, O_RDONLY)))
+     return -1;
 
-   fp = fopen (h->filename, "r");
-   if (fp == NULL)
-     return 0;		       /* can't open the file */
+   if ((-1 == fstat (fd, &st))
+       || (st.st_size < (off_t) sizeof (DFA_Cache_Header)))
+     {
+	(void) close (fd);
+	return -1;
+     }
 
-    /*
-     * Check the first line: "DFA cache: %s".
-     */
-   get(buffer);
-   (void) SLsnprintf (buf2, sizeof (buf2), "DFA cache: %s", name);
-   if (strcmp(buffer, buf2))
-     goto error;		       /* not the right syntax table */
+   addr = mmap (NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   (void) close (fd);
+   if (addr == MAP_FAILED)
+     return -1;
 
-   get(buffer);
-   (void) SLsnprintf (buf2, sizeof (buf2), "Version: %s", JED_VERSION_STR);
-   if (strcmp(buffer, buf2))
-     goto error;		       /* Not built with this executable */
+   h->cache_data = (unsigned char *) addr;
+   h->cache_size = (unsigned long) st.st_size;
+   h->cache_is_mapped = 1;
+   return 0;
+#else
+   FILE *fp;
+   long size;
+   unsigned char *data;
 
-    /*
-     * Check the next line: "equiv".
-     */
-   get(buffer);
-   if (strcmp(buffer, "equiv"))
-     goto error;
+   if (NULL == (fp = fopen (h->filename, "rb")))
+     return -1;
 
-    /*
-     * Read in the equivalence classes.
-     */
-   i = 0;
-   while (i < EQUIV_TABLE_SIZE)
+   if ((-1 == fseek (fp, 0, SEEK_END))
+       || (-1 == (size = ftell (fp)))
+       || (size < (long) sizeof (DFA_Cache_Header))
+       || (-1 == fseek (fp, 0, SEEK_SET))
+       || (NULL == (data = (unsigned char *) SLmalloc (size))))
      {
-	char *p, *q, *r;
-	unsigned int e;
-
-	get(buffer);
+	fclose (fp);
+	return -1;
+     }
 
-	p = q = buffer;
-	while (*p && i < EQUIV_TABLE_SIZE)
-	  {
-	     q = p + strcspn(p, " ");
-	     r = q + strspn(q, " ");
-	     *q = '\0';
-	     sscanf(p, "%x", &e);
-	     equiv[i++] = e;
-	     p = r;
-	  }
+   if (1 != fread (data, size, 1, fp))
+     {
+	SLfree ((char *) data);
+	fclose (fp);
+	return -1;
      }
+   fclose (fp);
 
-    /*
-     * Read in the accepting states.
-     */
-   get(buffer);
-   if (!sscanf(buffer, "accept %d", &accepts))
-     goto error;
-   accept = (Accept *) SLmalloc(sizeof(Accept) * accepts);
-   if (!accept)
+   h->cache_data = data;
+   h->cache_size = (unsigned long) size;
+   h->cache_is_mapped = 0;
+   return 0;
+#endif
+}
+
+static void unmap_dfa_cache (Highlight *h)
+{
+   if (h->cache_data == NULL)
+     return;
+#ifdef HAVE_MMAP
+   if (h->cache_is_mapped)
+     (void) munmap ((void *) h->cache_data, (size_t) h->cache_size);
+   else
+#endif
+     SLfree ((char *) h->cache_data);
+   h->cache_data = NULL;
+   h->cache_size = 0;
+   h->cache_is_mapped = 0;
+}
+
+/*
+ * Cache routine: try to load a DFA out of the cache. The file is
+ * used only if it was written from the rules that have been defined,
+ * and its contents are checked so that a damaged file cannot send
+ * the highlighter outside of the tables.  Returns 1 if the table was
+ * loaded, 0 if there is no cache to read, and -1 if the cache is stale
+ * or damaged.
+ */
+static int load_dfa (Highlight *h)
+{
+   DFA_Cache_Header *hdr;
+   unsigned char class_of[EQUIV_TABLE_SIZE];
+   DFA_Accept_Info *accept_info;
+   DFA_Accepts *accepts;
+   DFA_State_Num *trans;
+   unsigned int i, n;
+
+   if (h->filename == NULL)
+     return 0;		       /* don't have caching enabled */
+
+   if (-1 == map_dfa_cache (h))
+     return 0;		       /* can't read the file */
+
+   hdr = (DFA_Cache_Header *) h->cache_data;
+   if ((0 != memcmp (hdr->magic, DFA_CACHE_MAGIC, sizeof (hdr->magic)))
+       || (hdr->format != DFA_CACHE_FORMAT)
+       || (hdr->byte_order != DFA_CACHE_BYTE_ORDER)
+       || (hdr->header_size != sizeof (DFA_Cache_Header))
+       || (hdr->sizes != DFA_CACHE_SIZES))
+     goto error;		       /* Not written by this build */
+
+   if (hdr->rules_hash != h->rules_hash)
+     goto error;		       /* The rules have changed */
+
+   if ((hdr->dfa_states < 2) || (hdr->dfa_states > DFA_MAX_STATES)
+       || (hdr->num_accepts >= DFA_NO_ACCEPT)
+       || (hdr->num_classes != (unsigned int) compute_classes (hdr->equiv, class_of))
+       || (h->cache_size != dfa_cache_size (hdr->num_accepts, hdr->dfa_states,
+					    hdr->num_classes)))
      goto error;
-   for (i=0; i<accepts; i++)
+
+   for (i = 0; i < EQUIV_TABLE_SIZE; i++)
      {
-	if (i == accepts-1)
-	  accept[i].next = NULL;
-	else
-	  accept[i].next = accept+i+1;
-	get(buffer);
-	if (sscanf (buffer, "%d %d %d %d %d %d",
-		    &accept[i].state, &accept[i].is_quick,
-		    &accept[i].is_end, &accept[i].colour,
-		    &accept[i].is_preproc, &accept[i].is_keyword) != 6)
+	if (hdr->equiv[i] > i)
 	  goto error;
      }
 
-    /*
-     * Read in the DFA.
-     */
-   get(buffer);
-   if (!sscanf(buffer, "dfa %d", &dfa_states))
-     goto error;
-   dfa = (DFA *) SLmalloc(sizeof(DFA) * dfa_states);
-   if (!dfa)
-     goto error;
-   for (i=0; i<dfa_states; i++)
+   accept_info = (DFA_Accept_Info *) (h->cache_data + sizeof (DFA_Cache_Header));
+   accepts = (DFA_Accepts *) (accept_info + hdr->num_accepts);
+   trans = (DFA_State_Num *) (accepts + hdr->dfa_states);
+
+   for (i = 0; i < hdr->num_accepts; i++)
      {
-	int astate, estate;
-	char *p, *q, *r;
+	if ((accept_info[i].region < 0)
+	    || (accept_info[i].region > h->num_regions))
+	  goto error;
+     }
 
-	if (i == dfa_states-1)
-	  dfa[i].next = NULL;
-	else
-	  dfa[i].next = dfa+i+1;
-	dfa[i].accept = dfa[i].accept_end = NULL;
-	get(buffer);
-	if (sscanf (buffer, "%d %d %d:",
-		    &dfa[i].number, &astate, &estate) != 3)
+   for (i = 0; i < hdr->dfa_states; i++)
+     {
+	if (((accepts[i].accept != DFA_NO_ACCEPT)
+	     && (accepts[i].accept >= hdr->num_accepts))
+	    || ((accepts[i].accept_end != DFA_NO_ACCEPT)
+		&& (accepts[i].accept_end >= hdr->num_accepts)))
 	  goto error;
-	for (j=0; j<accepts; j++)
-	  {
-	     if (accept[j].state == astate)
-	       dfa[i].accept = accept+j;
-	     if (accept[j].state == estate)
-	       dfa[i].accept_end = accept+j;
-	  }
-	p = strchr(buffer, ':');
-	if (!p)
+     }
+
+   n = hdr->dfa_states * hdr->num_classes;
+   for (i = 0; i < n; i++)
+     {
+	if ((trans[i] != DFA_NO_STATE) && (trans[i] >= hdr->dfa_states))
 	  goto error;
-	p++;
-	p += strspn(p, " ");
-	for (j=0; j<EQUIV_TABLE_SIZE; j++)
-	  {
-	     if (equiv[j] == j)
-	       {
-		  q = p + strcspn(p, " ");
-		  r = q + strspn(q, " ");
-		  *q = '\0';
-		  astate = atoi(p);
-		  if (astate >= 0)
-		    dfa[i].where_to[j] = dfa+astate;
-		  else
-		    dfa[i].where_to[j] = NULL;
-		  p = r;
-	       }
-	     else
-	       dfa[i].where_to[j] = dfa[i].where_to[equiv[j]];
-	  }
      }
 
     /*
-     * If we've got here, we're actually done. So free the previous
-     * list of Accept structures, set up the Highlight structure,
-     * and leave.
+     * If we've got here, we're actually done. Set up the Highlight
+     * structure to use the tables in the file, and leave.
      */
-     {
-	Accept *a, *b;
-	a = h->accept;
-	while (a)
-	  {
-	     b = a;
-	     a = a->next;
-	     SLfree ((char *)b);
-	  }
-     }
-   h->dfa_states = dfa_states;
-   h->dfa = dfa;
-   h->accept = accept;
-   memcpy ((char *) h->equiv, (char *) equiv, sizeof(equiv));
-   fclose (fp);
+   h->dfa_states = (int) hdr->dfa_states;
+   h->num_classes = (int) hdr->num_classes;
+   h->num_accepts = (int) hdr->num_accepts;
+   h->accept_info = accept_info;
+   h->accepts = accepts;
+   h->trans = trans;
+   h->max_dfa_states = 0;
+   memcpy ((char *) h->equiv, (char *) hdr->equiv, sizeof(h->equiv));
+   memcpy ((char *) h->class_of, (char *) class_of, sizeof(class_of));
    return 1;
 
     /*
      * We only get here on error.
      */
    error:
-   SLfree ((char *)dfa);
-   SLfree ((char *)accept);
-   if (fp != NULL) fclose(fp);
-   return 0;
+   unmap_dfa_cache (h);
+   return -1;
+}
+
+/*
+ * Cache routine: returns non-zero if the existing cache file may be
+ * replaced.  Opening it for update changes nothing.
+ */
+static int dfa_cache_is_writable (Highlight *h)
+{
+   FILE *fp;
+
+   if (NULL == (fp = fopen (h->filename, "r+b")))
+     return 0;
+   (void) fclose (fp);
+   return 1;
 }
-#undef get
-#endif				       /* USE_DFA_CACHE */
 
 /*
  * Cache routine: try to save a DFA into the cache, if we have
@@ -921,81 +1404,75 @@ static int load_dfa (Highlight *h, char *name)
  * be in /usr/lib/jed/lib, in which case we can't save cache files
  * ourselves but shouldn't actually moan about it.)
  *
- * The DFA cache format is as follows: the first line contains "DFA
- * cache: %s" where %s is the name of the syntax table. The next
- * line contains "equiv". Next the equivalence classes are stored:
- * 256 hex bytes, on 16 lines of 16, separated by spaces, denoting
- * for each character code in turn the lowest character code
- * equivalent to that character. Thus if all characters are
- * equivalent, 256 zeros will be stored, and if all characters are
- * distinct in behaviour, the numbers 0 through 255 will be stored
- * in order.
- *
- * The next line contains "accept %d", where %d is the number of
- * Accept structures. The Accept structures are stored next: each
- * line contains one structure. The line contains six integers,
- * separated by spaces: the members @state@, @is_quick@, @is_end@,
- * @colour@, @is_preproc@ and @is_keyword@ of the structure.
- *
- * The next line contains "dfa %d", where %d is the number of DFA
- * states. Thereafter the actual DFA states are given. Each line
- * contains one state: it begins with the number of the state, the
- * @state@ member of the Accept structure in its @accept@ field,
- * the same for its @accept_end@ field, then a colon, then the
- * numbers of each transition on a representative character,
- * separated by spaces. (A representative character is defined as
- * one which has the lowest character code in its equivalence
- * class.)
+ * The file is written under a temporary name and renamed into place,
+ * so that another Jed mapping the old file never sees it partially
+ * written.
  */
-#if USE_DFA_CACHE
-static void save_dfa (Highlight *h, char *name)
+static void save_dfa (Highlight *h)
 {
+   DFA_Cache_Header hdr;
    FILE *fp;
-   int i;
-   DFA *d;
-   Accept *a;
+   char *tmpfile;
+   unsigned int len;
+   int ok;
 
    if (!h->filename)
      return;			       /* don't have caching enabled */
 
-   fp = fopen (h->filename, "w");
-   if (!fp)
-     return;			       /* didn't have access, or something */
-
-   /* FIXME!!! Check the return values from the fprintf functions.  Upon
-    * failure, remove the file.
-    */
-   fprintf(fp, "DFA cache: %s\nVersion: %s\nequiv\n", name, JED_VERSION_STR);
+   len = strlen (h->filename);
+   if (NULL == (tmpfile = SLmalloc (len + 5)))
+     return;
+   strcpy (tmpfile, h->filename);
+   strcpy (tmpfile + len, ".tmp");
 
-    /* write the equivalence classes */
-   for (i=0; i<EQUIV_TABLE_SIZE; i++)
+   fp = fopen (tmpfile, "wb");
+   if (!fp)
      {
-	fprintf(fp, "%02X%c", h->equiv[i], ((i+1) % 16 ? ' ' : '\n'));
+	SLfree (tmpfile);
+	return;			       /* didn't have access, or something */
      }
 
-    /* write the accepting states */
-   for (i=0, a=h->accept; a; a=a->next, i++);
-   fprintf(fp, "accept %d\n", i);
-   for (a=h->accept; a; a=a->next)
-     fprintf(fp, "%d %d %d %d %d %d\n",
-	     a->state, a->is_quick, a->is_end,
-	     a->colour, a->is_preproc, a->is_keyword);
+   memset ((char *) &hdr, 0, sizeof (hdr));
+   memcpy (hdr.magic, DFA_CACHE_MAGIC, sizeof (hdr.magic));
+   hdr.format = DFA_CACHE_FORMAT;
+   hdr.byte_order = DFA_CACHE_BYTE_ORDER;
+   hdr.header_size = sizeof (DFA_Cache_Header);
+   hdr.sizes = DFA_CACHE_SIZES;
+   hdr.num_accepts = (unsigned int) h->num_accepts;
+   hdr.dfa_states = (unsigned int) h->dfa_states;
+   hdr.num_classes = (unsigned int) h->num_classes;
+   hdr.rules_hash = h->rules_hash;
+   memcpy ((char *) hdr.equiv, (char *) h->equiv, sizeof (hdr.equiv));
+
+   ok = ((1 == fwrite ((char *) &hdr, sizeof (hdr), 1, fp))
+	 && (h->num_accepts == (int) fwrite ((char *) h->accept_info, sizeof (DFA_Accept_Info),
+					     h->num_accepts, fp))
+	 && (h->dfa_states == (int) fwrite ((char *) h->accepts, sizeof (DFA_Accepts),
+					    h->dfa_states, fp))
+	 && (h->dfa_states == (int) fwrite ((char *) h->trans,
+					    h->num_classes * sizeof (DFA_State_Num),
+					    h->dfa_states, fp)));
+
+   if (0 != fclose (fp))
+     ok = 0;
+
+   if ((ok == 0) || (-1 == rename (tmpfile, h->filename)))
+     (void) remove (tmpfile);
+
+   SLfree (tmpfile);
+}
 
-    /* write the DFA itself */
-   fprintf(fp, "dfa %d\n", h->dfa_states);
+/*
+ * Add a rule to the hash that identifies the cache file.
+ */
+static void hash_dfa_rule (Highlight *h, char *rule, int flags, int colour)
+{
+   int info[2];
 
-   for (d = h->dfa; d; d = d->next)
-     {
-	fprintf(fp, "%d %d %d:", d->number,
-		d->accept ? d->accept->state : -1,
-		d->accept_end ? d->accept_end->state : -1);
-	for (i=0; i<EQUIV_TABLE_SIZE; i++)
-	  if (h->equiv[i] == i)
-	    fprintf(fp, " %d",
-		    d->where_to[i] ? d->where_to[i]->number : -1);
-	fprintf(fp, "\n");
-     }
-   fclose (fp);
+   info[0] = flags;
+   info[1] = colour;
+   h->rules_hash = XXH3_64bits_withSeed (rule, strlen (rule), h->rules_hash);
+   h->rules_hash = XXH3_64bits_withSeed (info, sizeof (info), h->rules_hash);
 }
 #endif				       /* USE_DFA_CACHE */
 
@@ -1066,8 +1543,8 @@ static void dump_it (Highlight *h)
 	for (c=0; c<EQUIV_TABLE_SIZE; c++)
 	  if (h->equiv[c] == c)
 	  {
-	     printf(", to %d on ",
-		    df->where_to[c] ? df->where_to[c]->number : -1);
+	     DFA_State_Num to = h->trans[df->number * h->num_classes + h->class_of[c]];
+	     printf(", to %d on ", (to == DFA_NO_STATE) ? -1 : (int) to);
 	     if (isprint(c))
 	       putchar (c);
 	     else
@@ -1081,154 +1558,248 @@ static void dump_it (Highlight *h)
 }
 #endif				       /* TEST_MODE */
 
-static int dfa_try_keyword (register unsigned char *q, int n,
-			    register char *t, int case_sense)
+static int get_keyword_color (Syntax_Table_Type *st, unsigned char *p, int n, int *colourp)
 {
-   unsigned char *p;
-   int m, result;
+   int i;
 
-   if (!t)
-     return 0;
+   if (n <= 0)
+     return -1;
 
-   while (*t)
-     {
-	p = q;
-	m = n;
-	result = 0;
-	while (m--)
-	  {
-	     unsigned char star_p = *p++;
-	     unsigned char star_t = *t++;
-	     if (!case_sense)
-	       star_p = (unsigned char) LOWER_CASE (star_p);
-
-	     result = star_p - star_t;
-	     if (result)
-	       break;
-	  }
-	t += m;
+   if (-1 == (i = jed_find_keyword (st, p, (unsigned int) n)))
+     return -1;
 
-	if (result < 0)
-	  return 0;
-	else if (result == 0)
-	  return 1;
-     }
+   *colourp = JKEY_COLOR+i;
    return 0;
 }
 
-static int get_keyword_color (Syntax_Table_Type *st, unsigned char *p, int n, int *colourp)
+/*
+ * Match one token at p, starting from DFA state d. If a rule accepts,
+ * *acceptp is set to it and the end of the longest token is returned.
+ * Otherwise *acceptp is NULL, and the end of the unmatched text is
+ * returned.
+ */
+static unsigned char *dfa_match_token (Highlight *h, unsigned char *p,
+				       unsigned char *pmax, unsigned int d,
+				       DFA_Accept_Info **acceptp)
 {
-   int i, case_sense;
+   DFA_State_Num *trans = h->trans;
+   DFA_Accepts *accepts = h->accepts;
+   DFA_Accept_Info *accept_info = h->accept_info;
+   unsigned char *class_of = h->class_of;
+   unsigned int num_classes = (unsigned int) h->num_classes;
+   DFA_Accept_Info *last_accept;
+   unsigned char *last_acc_pos, *q;
+
+   last_acc_pos = NULL;
+   last_accept = NULL;
+
+   q = p;
+   while (q < pmax)
+     {
+	unsigned int accept;
 
-   if ((n <= 0) || (n > MAX_KEYWORD_LEN))
-     return -1;
+	unsigned int next = trans[d * num_classes + class_of[*q]];
 
-   case_sense = !(st->flags & SYNTAX_NOT_CASE_SENSITIVE);
+	if (next == DFA_UNBUILT)
+	  {
+	     next = lazy_dfa_transition (h, d, *q);
+	     trans = h->trans;	       /* these may have moved */
+	     accepts = h->accepts;
+	  }
+	q++;
+	d = next;
 
-   for (i=0; i<MAX_KEYWORD_TABLES; i++)
-     {
-	if (dfa_try_keyword (p, n, st->keywords[i][n-1], case_sense))
+	if (d == DFA_NO_STATE)
 	  {
-	     *colourp = JKEY_COLOR+i;
-	     return 0;
+	     if (last_accept == NULL)
+	       {
+		  if ((*p & 0x80) && Jed_UTF8_Mode)
+		    q = SLutf8_skip_chars (p, pmax, 1, NULL, 1);
+		  else
+		    q = p + 1;
+	       }
+	     break;		       /* error state */
 	  }
+
+	if (q == pmax)
+	  accept = accepts[d].accept_end;
+	else
+	  accept = accepts[d].accept;
+
+	if (accept == DFA_NO_ACCEPT)
+	  continue;
+
+	/*
+	 * We have hit an accepting state: record it.
+	 */
+	last_accept = accept_info + accept;
+	last_acc_pos = q;
+	if (last_accept->is_quick)
+	  break;
      }
-   return -1;
+
+   *acceptp = last_accept;
+   if (last_accept != NULL)
+     return last_acc_pos;
+
+   /* Here, either q == pmax or the DFA reached its error state */
+   return q;
 }
 
-static void dfa_syntax_highlight (unsigned char *p, unsigned char *pmax,
-				  Syntax_Table_Type *st)
+/*
+ * Look for the end of a region in [p, pmax), where bol is the start of
+ * the line. Returns the position just after the end pattern, or NULL if
+ * the region carries on past pmax. The start states of an end table
+ * loop on every character, so a single pass finds the first place where
+ * a match of the end pattern is complete.
+ */
+static unsigned char *dfa_find_region_end (Highlight *e, unsigned char *bol,
+					   unsigned char *p, unsigned char *pmax)
 {
-   DFA *d;
-   Highlight *h;
-   int preproc = -1;
+   DFA_Accept_Info *accept;
+   unsigned char *q;
 
-   if ((st == NULL) || (NULL == (h = st->hilite)))
-     return;
+   if ((e == NULL) || (e->trans == NULL) || (p == pmax))
+     return NULL;
+
+   q = dfa_match_token (e, p, pmax,
+			(p == bol) ? DFA_BOL_STATE : DFA_START_STATE,
+			&accept);
+   if (accept == NULL)
+     return NULL;
+   return q;
+}
 
-   d = h->dfa->next;		       /* the first time, start at state 1 */
+/*
+ * Highlight the line [p, pmax), which starts inside the given region
+ * (0 for none), and return the region that it ends inside. If do_write
+ * is 0, the line is only scanned for the region.
+ */
+static int dfa_scan_line (Syntax_Table_Type *st, Highlight *h,
+			  unsigned char *p, unsigned char *pmax,
+			  int region, int do_write)
+{
+   unsigned char *bol = p;
+   unsigned int d;
+   int preproc = -1;
+
+   d = DFA_BOL_STATE;		       /* the first time, start at state 1 */
    while (p < pmax)
      {
-	Accept *last_accept;
-	unsigned char *last_acc_pos, *q;
+	DFA_Accept_Info *accept;
+	unsigned char *q;
+	int colour;
 
-	last_acc_pos = NULL;
-	last_accept = NULL;
-
-	q = p;
-	while (q < pmax)
+	if (region)
 	  {
-	     Accept *accept;
+	     DFA_Region *r = h->regions + (region - 1);
 
-	     if (NULL == (d = d->where_to[*q++]))
+	     q = dfa_find_region_end (r->end, bol, p, pmax);
+	     if (q == NULL)
+	       q = pmax;
+	     else
+	       region = 0;
+
+	     if (do_write)
 	       {
-		  if (last_accept == NULL)
-		    {
-		       if ((*p & 0x80) && Jed_UTF8_Mode)
-			 q = SLutf8_skip_chars (p, pmax, 1, NULL, 1);
-		       else
-			 q = p + 1;
-		    }
-		  break;		       /* error state */
+		  colour = r->colour;
+		  if ((preproc != -1) && (colour != JCOM_COLOR))
+		    colour = preproc;
+		  (void) write_using_color (p, q, colour);
 	       }
+	     p = q;
+	     d = DFA_START_STATE;
+	     continue;
+	  }
 
-	     if (q == pmax)
-	       accept = d->accept_end;
-	     else
-	       accept = d->accept;
-
-	     if (accept == NULL)
-	       continue;
-
-	     /*
-	      * We have hit an accepting state: record it.
-	      */
-	     last_accept = accept;
-	     last_acc_pos = q;
-	     if (last_accept->is_quick)
-	       break;
+	q = dfa_match_token (h, p, pmax, d, &accept);
+	d = DFA_START_STATE;
+
+	if (accept != NULL)
+	  region = accept->region;
+
+	if (do_write == 0)
+	  {
+	     p = q;
+	     continue;
 	  }
 
-	/* If last_accept is NULL, then accept is also NULL */
-	if (last_accept != NULL)
+	if (accept != NULL)
 	  {
-	     int colour = last_accept->colour;
+	     colour = accept->colour;
 
-	     if (last_accept->is_keyword)
-	       (void) get_keyword_color (st, p, last_acc_pos-p, &colour);
+	     if (accept->is_keyword)
+	       (void) get_keyword_color (st, p, q-p, &colour);
 
-	     if (last_accept->is_preproc)
-	       preproc = last_accept->colour;
+	     if (accept->is_preproc)
+	       preproc = accept->colour;
 	     else if ((preproc != -1) && (colour != JCOM_COLOR))
 	       colour = preproc;
-
-             p = write_using_color(p, last_acc_pos, colour);
 	  }
+	else if (preproc != -1)
+	  colour = preproc;
 	else
-	  {
-	     /* Here, accept = last_accept = NULL
-	      * and either q == pmax or d==NULL
-	      */
-	     if (preproc != -1)
-	       p = write_using_color (p, q, preproc);
-	     else
-	       p = write_using_color (p, q, JNORMAL_COLOR);
-	  }
-	d = h->dfa;
+	  colour = JNORMAL_COLOR;
+
+	p = write_using_color (p, q, colour);
      }
+   return region;
 }
 
+static void dfa_syntax_highlight (unsigned char *p, unsigned char *pmax,
+				  Syntax_Table_Type *st, int region)
+{
+   Highlight *h;
+
+   if ((st == NULL) || (NULL == (h = st->hilite)) || (h->trans == NULL))
+     return;
+
+   if ((region < 0) || (region > h->num_regions))
+     region = 0;
+
+   (void) dfa_scan_line (st, h, p, pmax, region, 1);
+}
+
+#if JED_HAS_LINE_ATTRIBUTES
+int jed_dfa_has_regions (Syntax_Table_Type *st)
+{
+   return ((st != NULL) && st->use_dfa_syntax
+	   && (st->hilite != NULL) && (st->hilite->trans != NULL)
+	   && (st->hilite->num_regions > 0));
+}
+
+/*
+ * Return the region that the line l ends inside, given the region that
+ * its flags say it starts in.
+ */
+int jed_dfa_line_exit_region (Syntax_Table_Type *st, Line *l)
+{
+   Highlight *h = st->hilite;
+   unsigned int len = (unsigned int) l->len;
+   int region = (int) JED_GET_LINE_DFA_REGION(l);
+
+   if (LINE_HAS_NEWLINE(l))
+     len--;
+
+   if (region > h->num_regions)
+     region = 0;
+
+   return dfa_scan_line (st, h, l->data, l->data + len, region, 0);
+}
+#endif
+
 void jed_dfa_free_highlight_table (Highlight *h)
 {
-   (void) h;
-   /* Until the reading of the cache gets fixed, do nothing except leak,...*/
-#if 0
    NFA *nfa;
    Accept *accept;
+   int i;
 
    if (h == NULL)
      return;
 
+   for (i = 0; i < h->num_regions; i++)
+     jed_dfa_free_highlight_table (h->regions[i].end);
+
    nfa = h->nfa;
    while (nfa != NULL)
      {
@@ -1243,17 +1814,14 @@ void jed_dfa_free_highlight_table (Highlight *h)
 	SLfree ((char *) accept);
 	accept = next;
      }
-   dfa = h->dfa;
-   while (dfa != NULL)
-     {
-	DFA *next = dfa->next;
-	SLfree ((char *) dfa->nfa_set);
-	SLfree ((char *) dfa);
-	dfa = next;
-     }
+#if USE_DFA_CACHE
+   if (h->cache_data != NULL)
+     unmap_dfa_cache (h);
+   else
+#endif
+     discard_dfa (h);
    SLfree (h->filename);
    SLfree ((char *) h);
-#endif
 }
 
 static Highlight *find_highlight_table (char *name, int init)
@@ -1281,8 +1849,8 @@ static void define_highlight_rule (char *rule, char *colour, char *name)
    if (NULL == (hilite = find_highlight_table (name, 1)))
      return;
 
-   if (hilite->dfa)
-     return;			       /* don't need to */
+   if (hilite->trans != NULL)
+     return;			       /* too late: the table is built */
 
    while (*colour == 'K' || *colour == 'P' || *colour == 'Q')
      {
@@ -1302,13 +1870,69 @@ static void define_highlight_rule (char *rule, char *colour, char *name)
      }
 
    if ( (i = jed_get_color_obj (colour)) != -1)
-     add_rule (hilite, rule, strlen(rule), flags, i);
+     {
+	add_rule (hilite, rule, strlen(rule), flags, i, 0);
+#if USE_DFA_CACHE
+	hash_dfa_rule (hilite, rule, flags, i);
+#endif
+     }
 }
 
-/* FIXME:
- * If a cache table already exists, any additional rules will get ignored
- * making the dfa_build_highlight_table_hook useless.  The init_dfa_callback
- * hook looks more or less like:
+#if JED_HAS_LINE_ATTRIBUTES
+/* A region begins with a token matching the "begin" pattern and runs
+ * to the first match of the "end" pattern, which may be on a later line.
+ * The whole of it is drawn in the given colour.  The region that a line
+ * starts in is kept with the line, so regions need line attributes.
+ */
+static void define_highlight_region (char *begin, char *end, char *colour, char *name)
+{
+   Highlight *hilite;
+   Highlight *e;
+   Set all;
+   int i;
+
+   if (NULL == (hilite = find_highlight_table (name, 1)))
+     return;
+
+   if (hilite->trans != NULL)
+     return;			       /* too late: the table is built */
+
+   if (hilite->num_regions == DFA_MAX_REGIONS)
+     {
+	msg_error ("Too many DFA highlight regions");
+	return;
+     }
+
+   if (-1 == (i = jed_get_color_obj (colour)))
+     return;
+
+   if (NULL == (e = init_highlight ()))
+     return;
+   add_rule (e, end, strlen (end), FLAG_QUICK, i, 0);
+   if (e->accept == NULL)
+     {
+	jed_dfa_free_highlight_table (e);
+	return;
+     }
+
+   /* Let a match of the end pattern begin anywhere */
+   fill_set (all, sizeof (Set));
+   add_nfa_trans (e, 0, 0, all);
+   add_nfa_trans (e, 1, 0, all);
+
+   hilite->regions[hilite->num_regions].end = e;
+   hilite->regions[hilite->num_regions].colour = i;
+   hilite->num_regions++;
+
+   add_rule (hilite, begin, strlen (begin), 0, i, hilite->num_regions);
+#if USE_DFA_CACHE
+   hash_dfa_rule (hilite, begin, 0x100 + hilite->num_regions, i);
+   hash_dfa_rule (hilite, end, -1, i);
+#endif
+}
+#endif				       /* JED_HAS_LINE_ATTRIBUTES */
+
+/* The init_dfa_callback hook looks more or less like:
  *
  *    dfa_enable_highlight_cache ("cache.dfa", "syntax-table");
  *    dfa_define_highlight_rule ("pattern", "color-obj", "syntax-table");
@@ -1317,12 +1941,17 @@ static void define_highlight_rule (char *rule, char *colour, char *name)
  *    dfa_define_highlight_rule ("pattern", "color-obj", "syntax-table");
  *    dfa_build_highlight_table ("tag");
  *
- * The problem is that if "cache.dfa" already exists, it will be loaded and
- * used.
+ * The cache is consulted here rather than when it is enabled, so that the
+ * rules added by the dfa_build_highlight_table_hook are part of the hash
+ * that selects it.
  */
 static void build_highlight_table (char *name)
 {
    Highlight *hilite;
+   int i;
+#if USE_DFA_CACHE
+   int status;
+#endif
 
    if (-1 == SLang_run_hooks ("dfa_build_highlight_table_hook", 1, name))
      return;
@@ -1330,16 +1959,36 @@ static void build_highlight_table (char *name)
    if (NULL == (hilite = find_highlight_table (name, 0)))
      return;
 
-   if (NULL == hilite->dfa)
+   if (hilite->trans != NULL)
+     return;
+
+   for (i = 0; i < hilite->num_regions; i++)
+     make_lazy_dfa (hilite->regions[i].end);
+
+#if USE_DFA_CACHE
+   if (1 == (status = load_dfa (hilite)))
+     return;
+
+   /* The whole table is only worth building when it is going to be
+    * saved: when the cache files are being created in batch mode, or when
+    * a cache is stale because the rules changed.  Replacing it then means
+    * that only the first use of the new rules pays for the build.  A
+    * missing cache is left to preparse.sl, since an interactive session
+    * should not stall to create one that the user never asked for.
+    */
+   if ((hilite->filename != NULL)
+       && (Batch || ((status == -1) && dfa_cache_is_writable (hilite))))
      {
 	jed_vmessage (1, "Creating DFA syntax table for %s...", name);
 	make_dfa (hilite);
-#if USE_DFA_CACHE
-	if (hilite->filename)
-	  save_dfa (hilite, name);
-#endif
+	if (hilite->trans != NULL)
+	  save_dfa (hilite);
 	message ("");
+	return;
      }
+#endif
+
+   make_lazy_dfa (hilite);
 }
 
 static void enable_highlight_cache (char *file, char *name)
@@ -1355,9 +2004,6 @@ static void enable_highlight_cache (char *file, char *name)
 
    /* Ok to fail */
    hilite->filename = SLmake_string (file);
-
-   if (!hilite->dfa)
-     load_dfa (hilite, name);
 #else
    (void) file;
    (void) name;
@@ -1402,18 +2048,32 @@ static void use_dfa_syntax (int *x)
 	    || (-1 == SLang_end_arg_list ())
 	    || (1 != SLexecute_function (t->init_dfa_callback))
 	    || (NULL == t->hilite)
-	    || (NULL == t->hilite->dfa))
+	    || (NULL == t->hilite->trans))
 	  {
 	     t->use_dfa_syntax = 0;
 	     return;
 	  }
      }
    t->use_dfa_syntax = 1;
+
+#if JED_HAS_LINE_ATTRIBUTES
+   /* The region states of the lines are only kept up to date while the
+    * DFA highlighting is in use.
+    */
+   if (t->hilite->num_regions && (t == CBuf->syntax_table))
+     {
+	CBuf->min_unparsed_line_num = 1;
+	CBuf->max_unparsed_line_num = CBuf->nup + Max_LineNum + CBuf->ndown;
+     }
+#endif
 }
 
 static SLang_Intrin_Fun_Type DFA_Intrinsics [] =
 {
    MAKE_INTRINSIC_SSS("dfa_define_highlight_rule", define_highlight_rule, VOID_TYPE),
+#if JED_HAS_LINE_ATTRIBUTES
+   MAKE_INTRINSIC_4("dfa_define_highlight_region", define_highlight_region, VOID_TYPE, STRING_TYPE, STRING_TYPE, STRING_TYPE, STRING_TYPE),
+#endif
    MAKE_INTRINSIC_S("dfa_build_highlight_table", build_highlight_table, VOID_TYPE),
    MAKE_INTRINSIC_SS("_dfa_enable_highlight_cache", enable_highlight_cache, VOID_TYPE),
    MAKE_INTRINSIC_I("use_dfa_syntax", use_dfa_syntax, VOID_TYPE),
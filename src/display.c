@@ -9,6 +9,7 @@
 #include "jed-feat.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <slang.h>
 
 #include "jdmacros.h"
@@ -43,6 +44,199 @@ void flush_output (void)
    SLtt_flush_output ();
 }
 
+#ifndef IBMPC_SYSTEM
+/* Terminal output accounting and synchronized update mode.
+ *
+ * The SLsmg primitives are routed through the functions below so that the
+ * bytes sent to the terminal can be attributed to a frame.  A frame is opened
+ * by the first primitive that actually paints something and it is closed by
+ * the flush at the end of SLsmg_refresh.  When Term_Sync_Update is non-zero,
+ * the frame is bracketed by the DEC private mode 2026 sequences so that the
+ * terminal presents it atomically.  Terminals that do not know the mode
+ * ignore it.  A refresh that only moves the cursor does not open a frame.
+ *
+ * Window scrolls go through the scroll region primitives, i.e., SLsmg
+ * moves the lines on the terminal instead of repainting them.  This
+ * requires TERM_CANNOT_SCROLL to be 0.
+ */
+static int Term_Sync_Update = 0;
+static int In_Frame;
+static unsigned long Frame_Start_Chars;
+
+static unsigned long Num_Frames;
+static unsigned long Num_Frame_Bytes;
+static unsigned long Max_Frame_Bytes;
+static unsigned long Last_Frame_Bytes;
+static unsigned long Num_Scrolls;
+
+static void begin_frame (void)
+{
+   if (In_Frame)
+     return;
+
+   In_Frame = 1;
+   Frame_Start_Chars = SLtt_Num_Chars_Output;
+   if (Term_Sync_Update)
+     SLtt_write_string ("\033[?2026h");
+}
+
+static void end_frame (void)
+{
+   unsigned long n;
+
+   if (In_Frame == 0)
+     return;
+
+   if (Term_Sync_Update)
+     SLtt_write_string ("\033[?2026l");
+   In_Frame = 0;
+
+   n = SLtt_Num_Chars_Output - Frame_Start_Chars;
+   Last_Frame_Bytes = n;
+   Num_Frame_Bytes += n;
+   if (n > Max_Frame_Bytes) Max_Frame_Bytes = n;
+   Num_Frames++;
+}
+
+static void frame_set_scroll_region (int r1, int r2)
+{
+   begin_frame ();
+   SLtt_set_scroll_region (r1, r2);
+}
+
+static void frame_reverse_index (int n)
+{
+   begin_frame ();
+   Num_Scrolls++;
+   SLtt_reverse_index (n);
+}
+
+static void frame_delete_nlines (int n)
+{
+   begin_frame ();
+   Num_Scrolls++;
+   SLtt_delete_nlines (n);
+}
+
+static void frame_cls (void)
+{
+   begin_frame ();
+   SLtt_cls ();
+}
+
+static void frame_del_eol (void)
+{
+   begin_frame ();
+   SLtt_del_eol ();
+}
+
+static void frame_smart_puts (SLsmg_Char_Type *neww, SLsmg_Char_Type *oldd, int len, int row)
+{
+   begin_frame ();
+   SLtt_smart_puts (neww, oldd, len, row);
+}
+
+/* When Term_Bracketed_Paste is non-zero, the terminal is asked to wrap
+ * pasted text in ESC[200~ ... ESC[201~ so that it reaches the
+ * bracketed_paste command instead of being typed in key by key.  The mode
+ * is (re)enabled lazily by the next flush, which also covers the return
+ * from a suspension or a subshell.  It is off by default, since keymaps
+ * that rebind the ESC [ prefix would otherwise see the sequences as keys.
+ */
+static int Term_Bracketed_Paste = 0;
+static int Bracketed_Paste_Active;
+
+static int frame_flush_output (void)
+{
+   end_frame ();
+   if ((Term_Bracketed_Paste != 0) != Bracketed_Paste_Active)
+     {
+	Bracketed_Paste_Active = !Bracketed_Paste_Active;
+	SLtt_write_string (Bracketed_Paste_Active ? "\033[?2004h" : "\033[?2004l");
+     }
+   return SLtt_flush_output ();
+}
+
+static int frame_reset_video (void)
+{
+   end_frame ();
+   if (Bracketed_Paste_Active)
+     {
+	SLtt_write_string ("\033[?2004l");
+	Bracketed_Paste_Active = 0;
+     }
+   return SLtt_reset_video ();
+}
+
+static void init_frame_terminal (void)
+{
+   SLsmg_Term_Type tt;
+
+   memset ((char *) &tt, 0, sizeof (SLsmg_Term_Type));
+
+   tt.tt_normal_video = SLtt_normal_video;
+   tt.tt_set_scroll_region = frame_set_scroll_region;
+   tt.tt_goto_rc = SLtt_goto_rc;
+   tt.tt_reverse_index = frame_reverse_index;
+   tt.tt_reset_scroll_region = SLtt_reset_scroll_region;
+   tt.tt_delete_nlines = frame_delete_nlines;
+   tt.tt_cls = frame_cls;
+   tt.tt_del_eol = frame_del_eol;
+   tt.tt_smart_puts = frame_smart_puts;
+   tt.tt_flush_output = frame_flush_output;
+   tt.tt_reset_video = frame_reset_video;
+   tt.tt_init_video = SLtt_init_video;
+
+   tt.tt_screen_rows = &SLtt_Screen_Rows;
+   tt.tt_screen_cols = &SLtt_Screen_Cols;
+   tt.tt_term_cannot_scroll = &SLtt_Term_Cannot_Scroll;
+   tt.tt_has_alt_charset = &SLtt_Has_Alt_Charset;
+   tt.tt_use_blink_for_acs = &SLtt_Use_Blink_For_ACS;
+   tt.tt_graphic_char_pairs = &SLtt_Graphics_Char_Pairs;
+
+   tt.unicode_ok = &Jed_UTF8_Mode;
+
+   SLsmg_set_terminal_info (&tt);
+}
+
+static void get_term_output_stats (void)
+{
+   (void) SLang_push_ulong (Num_Frames);
+   (void) SLang_push_ulong (Num_Frame_Bytes);
+   (void) SLang_push_ulong (Last_Frame_Bytes);
+   (void) SLang_push_ulong (Max_Frame_Bytes);
+   (void) SLang_push_ulong (Num_Scrolls);
+}
+
+static void reset_term_output_stats (void)
+{
+   Num_Frames = Num_Frame_Bytes = Max_Frame_Bytes = Last_Frame_Bytes = 0;
+   Num_Scrolls = 0;
+}
+
+static SLang_Intrin_Fun_Type Display_Intrinsics [] =
+{
+   MAKE_INTRINSIC_0("get_term_output_stats", get_term_output_stats, VOID_TYPE),
+   MAKE_INTRINSIC_0("reset_term_output_stats", reset_term_output_stats, VOID_TYPE),
+   SLANG_END_INTRIN_FUN_TABLE
+};
+
+static SLang_Intrin_Var_Type Display_Variables [] =
+{
+   MAKE_VARIABLE("TERM_SYNC_UPDATE", &Term_Sync_Update, INT_TYPE, 0),
+   MAKE_VARIABLE("TERM_BRACKETED_PASTE", &Term_Bracketed_Paste, INT_TYPE, 0),
+   MAKE_VARIABLE(NULL, NULL, 0, 0)
+};
+
+static int display_init_slang (void)
+{
+   if ((-1 == SLadd_intrin_fun_table (Display_Intrinsics, NULL))
+       || (-1 == SLadd_intrin_var_table (Display_Variables, NULL)))
+     return -1;
+   return 0;
+}
+#endif				       /* !IBMPC_SYSTEM */
+
 static void get_screen_size (int *r, int *c)
 {
    SLtt_get_screen_size ();
@@ -78,9 +272,17 @@ static void get_terminfo (void)
 
 #ifdef REAL_UNIX_SYSTEM
    SLtt_Force_Keypad_Init = 1;
+#endif
+#ifndef IBMPC_SYSTEM
+   (void) jed_add_init_slang_hook (display_init_slang);
 #endif
    if (Batch == 0)
-     SLtt_get_terminfo ();
+     {
+	SLtt_get_terminfo ();
+#ifndef IBMPC_SYSTEM
+	init_frame_terminal ();
+#endif
+     }
 }
 
 void (*tt_get_terminfo)(void)	= get_terminfo;
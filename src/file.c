@@ -1242,6 +1242,7 @@ int write_file_with_backup(char *dirfile) /*{{{*/
 	  CBuf->flags &= ~FILE_MODIFIED;
 
 	mark_buffer_modified (CBuf, 0, 1);
+	jed_trim_line_slack (1);
      }
 #ifndef VMS
    /* error -- put it back */
@@ -1853,6 +1854,7 @@ int read_file_pointer(int fp) /*{{{*/
      {
 	n++;
 #ifdef KEEP_SPACE_INFO
+	jed_unshare_line ();
 	if (CLine->space < num)
 #endif
 	  remake_line(CLine->len + num + 1);
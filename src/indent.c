@@ -189,9 +189,16 @@ int _jed_is_eol_comment_start (Syntax_Table_Type *table, Line *l,
    return 0;
 }
 
-static int parse_to_point1 (Syntax_Table_Type *table,
+/* Return the syntax state at pmax on the line l.  If delims is non-NULL,
+ * the unmatched open and close delimiters outside of comments and strings
+ * are counted in delims[0] and delims[1], and delims[2] is set if the line
+ * contains something, e.g., SGML markup, that the delimiter matching
+ * routines do not skip in the same way.
+ */
+static int parse_to_point2 (Syntax_Table_Type *table,
 			    Line *l,
-			    unsigned char *pmax)
+			    unsigned char *pmax,
+			    unsigned int *delims)
 {
    unsigned char ch;
    int quote, flags, lval;
@@ -293,6 +300,8 @@ static int parse_to_point1 (Syntax_Table_Type *table,
 
 	if (syntax[ch] & HTML_START_SYNTAX)
 	  {
+	     if (delims != NULL)
+	       delims[2] = 1;
 	     p = find_string_end (table, p+1, pmax, table->sgml_stop_char);
 	     if (p == NULL)
 	       return JED_LINE_IN_HTML_MINVAL;
@@ -321,12 +330,29 @@ static int parse_to_point1 (Syntax_Table_Type *table,
 	  return JED_LINE_HAS_EOL_COMMENT;
 #endif
 
+	if ((delims != NULL)
+	    && (syntax[ch] & (OPEN_DELIM_SYNTAX|CLOSE_DELIM_SYNTAX)))
+	  {
+	     if (syntax[ch] & OPEN_DELIM_SYNTAX)
+	       delims[0]++;
+	     else if (delims[0])
+	       delims[0]--;
+	     else
+	       delims[1]++;
+	  }
 	p++;
      }
 
    return 0;
 }
 
+static int parse_to_point1 (Syntax_Table_Type *table,
+			    Line *l,
+			    unsigned char *pmax)
+{
+   return parse_to_point2 (table, l, pmax, NULL);
+}
+
 static void goto_effective_eol (Syntax_Table_Type *table) /*{{{*/
 {
    unsigned int flags;
@@ -601,6 +627,54 @@ static int goto_string_end (Syntax_Table_Type *table, unsigned char ch)
      }
 }
 
+#if JED_HAS_LINE_ATTRIBUTES
+/* Move up over whole lines that cannot hold the delimiter matching the
+ * current one, as given by their delimiter summaries, and adjust the
+ * nesting level accordingly.  Returns -1 if the top of the buffer was
+ * passed, otherwise 0 with the point on a line that must be scanned.
+ */
+static int skip_balanced_lines_up (int *levelp)
+{
+   int level = *levelp;
+
+   while ((CLine->flags & JED_LINE_DELIMS_KNOWN)
+	  && ((int) JED_GET_LINE_DELIM_OPENS(CLine) < level))
+     {
+	level += (int) JED_GET_LINE_DELIM_CLOSES(CLine)
+	  - (int) JED_GET_LINE_DELIM_OPENS(CLine);
+	if (0 == jed_up (1))
+	  {
+	     *levelp = level;
+	     return -1;
+	  }
+     }
+   *levelp = level;
+   return 0;
+}
+
+/* As above, but moving down.  Returns -1 if the end of the buffer was
+ * passed.
+ */
+static int skip_balanced_lines_down (int *levelp)
+{
+   int level = *levelp;
+
+   while ((CLine->flags & JED_LINE_DELIMS_KNOWN)
+	  && ((int) JED_GET_LINE_DELIM_CLOSES(CLine) < level))
+     {
+	level += (int) JED_GET_LINE_DELIM_OPENS(CLine)
+	  - (int) JED_GET_LINE_DELIM_CLOSES(CLine);
+	if (0 == jed_down (1))
+	  {
+	     *levelp = level;
+	     return -1;
+	  }
+     }
+   *levelp = level;
+   return 0;
+}
+#endif
+
 /* Go backward looking for the matching ch--- not the char that matches ch.
  * Rather, ch is the matching character.
  * This routine returns:
@@ -611,7 +685,8 @@ static int goto_string_end (Syntax_Table_Type *table, unsigned char ch)
  *     beginning of the string.
  *   0 if not found.  The point is left where we gave up
  *   2 if went back too far
- * count is the number of lines to go back
+ * count is the number of lines to go back.  Lines that are skipped by
+ * means of their delimiter summaries do not count.
  */
 
 static int backward_goto_match (int count, unsigned char ch) /*{{{*/
@@ -623,6 +698,7 @@ static int backward_goto_match (int count, unsigned char ch) /*{{{*/
    Syntax_Table_Type *table;
    unsigned int this_syntax;
    unsigned char *pmax;
+   int use_delims;
    unsigned char com_start_char, com_stop_char;
    unsigned char sgml_start_char, sgml_stop_char;
 
@@ -631,6 +707,8 @@ static int backward_goto_match (int count, unsigned char ch) /*{{{*/
 
    syntax = table->char_syntax;
    quote = table->quote_char;
+   /* The line summaries are only valid for the buffer's own table */
+   use_delims = (table == CBuf->syntax_table);
 
    level = 1;
 
@@ -821,6 +899,14 @@ static int backward_goto_match (int count, unsigned char ch) /*{{{*/
 	count--;
 	if (table->flags & SINGLE_LINE_STRINGS)
 	  in_string = 0;
+#if JED_HAS_LINE_ATTRIBUTES
+	if (use_delims && count && (in_string == 0) && (in_comment == 0)
+	    && (-1 == skip_balanced_lines_up (&level)))
+	  {
+	     bol ();
+	     break;
+	  }
+#endif
 	goto_effective_eol (table);
 	pmax = CLine->data + Point;
      }
@@ -854,11 +940,13 @@ static int forward_goto_match (unsigned char ch) /*{{{*/
    unsigned int this_syntax;
    Syntax_Table_Type *table;
    unsigned char com_start_char;
+   int use_delims;
 
    if (NULL == (table = setup_for_match (&p, &ch, &want_ch)))
      return 0;
 
    syntax = table->char_syntax;
+   use_delims = (table == CBuf->syntax_table);
 
    in_string = in_comment = 0;
    lval = parse_to_point1 (table, CLine, CLine->data + Point);
@@ -1010,6 +1098,14 @@ static int forward_goto_match (unsigned char ch) /*{{{*/
 		 || (0 == is_fortran_comment (CLine, table)))
 	       break;
 	  }
+#if JED_HAS_LINE_ATTRIBUTES
+	if (use_delims && (in_string == 0) && (in_comment == 0)
+	    && (-1 == skip_balanced_lines_down (&level)))
+	  {
+	     eol ();
+	     return 0;
+	  }
+#endif
      }
 }
 
@@ -1055,7 +1151,7 @@ static int parse_to_point (void) /*{{{*/
 
    if (table == NULL) return 0;
 #if JED_HAS_LINE_ATTRIBUTES
-   jed_syntax_parse_buffer (0);
+   jed_syntax_parse_to_line (LineNum + CBuf->nup);
 #endif
 
    lval = parse_to_point1 (table, CLine, CLine->data + Point);
@@ -1391,6 +1487,8 @@ static void use_syntax_table (char *s) /*{{{*/
 
 /*}}}*/
 
+static void free_keyword_hash (Syntax_Table_Type *);
+
 /* Clears everything except for the name, and links to other tables */
 static void clear_syntax_table (Syntax_Table_Type *t)
 {
@@ -1409,6 +1507,7 @@ static void clear_syntax_table (Syntax_Table_Type *t)
    if (t->hilite != NULL)
      jed_dfa_free_highlight_table (t->hilite);
 #endif
+   free_keyword_hash (t);
 
    for (i = 0; i < MAX_KEYWORD_TABLES; i++)
      {
@@ -1482,6 +1581,154 @@ void init_syntax_tables (void) /*{{{*/
 
 /*}}}*/
 
+/*{{{ Keyword lookup */
+
+/* The keyword lists of a syntax table are indexed by an open-addressed
+ * hash over the length and bytes of each keyword.  The index is built the
+ * first time that a keyword is looked up, and discarded whenever the lists
+ * change.  When a word appears in more than one list, the lowest numbered
+ * list wins, as it did when the lists were searched in order.
+ */
+typedef struct
+{
+   char *word;			       /* points into keywords[][], NULL if free */
+   unsigned char len;
+   unsigned char table_number;
+}
+Keyword_Hash_Entry_Type;
+
+struct Keyword_Hash_Type
+{
+   unsigned int mask;
+   Keyword_Hash_Entry_Type entries[1];
+};
+
+static unsigned int hash_keyword (unsigned char *s, unsigned int len)
+{
+   unsigned char *smax = s + len;
+   unsigned int h = len;
+
+   while (s < smax)
+     h = (h << 5) + h + *s++;
+
+   return h ^ (h >> 11);
+}
+
+static void free_keyword_hash (Syntax_Table_Type *table)
+{
+   if (table->keyword_hash == NULL)
+     return;
+
+   SLfree ((char *) table->keyword_hash);
+   table->keyword_hash = NULL;
+}
+
+static struct Keyword_Hash_Type *build_keyword_hash (Syntax_Table_Type *table)
+{
+   struct Keyword_Hash_Type *kh;
+   unsigned int i, len, num, size;
+
+   num = 0;
+   for (i = 0; i < MAX_KEYWORD_TABLES; i++)
+     {
+	for (len = 1; len <= MAX_KEYWORD_LEN; len++)
+	  {
+	     char *kw = table->keywords[i][len-1];
+	     if (kw != NULL)
+	       num += strlen (kw) / len;
+	  }
+     }
+
+   size = 8;
+   while (size < 2 * num)
+     size *= 2;
+
+   kh = (struct Keyword_Hash_Type *) SLmalloc (sizeof (struct Keyword_Hash_Type)
+					       + (size - 1) * sizeof (Keyword_Hash_Entry_Type));
+   if (kh == NULL)
+     return NULL;
+   memset ((char *) kh->entries, 0, size * sizeof (Keyword_Hash_Entry_Type));
+   kh->mask = size - 1;
+
+   for (i = 0; i < MAX_KEYWORD_TABLES; i++)
+     {
+	for (len = 1; len <= MAX_KEYWORD_LEN; len++)
+	  {
+	     char *kw = table->keywords[i][len-1];
+	     char *kwmax;
+
+	     if (kw == NULL)
+	       continue;
+
+	     kwmax = kw + strlen (kw);
+	     while (kw < kwmax)
+	       {
+		  unsigned int h = hash_keyword ((unsigned char *) kw, len) & kh->mask;
+		  Keyword_Hash_Entry_Type *e;
+
+		  while (1)
+		    {
+		       e = kh->entries + h;
+		       if ((e->word == NULL)
+			   || ((e->len == len) && (0 == strncmp (e->word, kw, len))))
+			 break;
+		       h = (h + 1) & kh->mask;
+		    }
+
+		  if (e->word == NULL)
+		    {
+		       e->word = kw;
+		       e->len = (unsigned char) len;
+		       e->table_number = (unsigned char) i;
+		    }
+		  kw += len;
+	       }
+	  }
+     }
+
+   table->keyword_hash = kh;
+   return kh;
+}
+
+/* Returns the number of the keyword list that contains the n bytes at p,
+ * or -1 if they do not form a keyword.
+ */
+int jed_find_keyword (Syntax_Table_Type *table, unsigned char *p, unsigned int n)
+{
+   struct Keyword_Hash_Type *kh;
+   unsigned char buf[MAX_KEYWORD_LEN];
+   unsigned int h;
+
+   if ((n == 0) || (n > MAX_KEYWORD_LEN))
+     return -1;
+
+   if ((NULL == (kh = table->keyword_hash))
+       && (NULL == (kh = build_keyword_hash (table))))
+     return -1;
+
+   if (table->flags & SYNTAX_NOT_CASE_SENSITIVE)
+     {
+	unsigned int i;
+	for (i = 0; i < n; i++)
+	  buf[i] = (unsigned char) LOWER_CASE (p[i]);
+	p = buf;
+     }
+
+   h = hash_keyword (p, n) & kh->mask;
+   while (1)
+     {
+	Keyword_Hash_Entry_Type *e = kh->entries + h;
+
+	if (e->word == NULL)
+	  return -1;
+	if ((e->len == n) && (0 == memcmp (e->word, (char *) p, n)))
+	  return e->table_number;
+	h = (h + 1) & kh->mask;
+     }
+}
+
+/*}}}*/
+
 /* Currently this assumes byte-semantics.  It should be changed to assume character
  * semantics.
  */
@@ -1526,16 +1773,52 @@ static void define_keywords (char *name, char *kwords, int *lenp, int *tbl_nump)
      }
 
    table->keywords[table_number][len] = SLang_create_slstring (kwords);
+   free_keyword_hash (table);
 }
 
 /*}}}*/
 
 #if JED_HAS_LINE_ATTRIBUTES
-static void syntax_parse_lines (Syntax_Table_Type *table, Line *l, unsigned int num)
+/* Record the delimiter summary of a line that has just been parsed.  It is
+ * only kept for a line that starts and ends outside of comments and strings,
+ * since only then can the matching routines skip over the line.
+ */
+static void set_line_delims (Syntax_Table_Type *table, Line *l, int lval,
+			     unsigned int *delims)
 {
-   if (l == NULL)
+   l->flags &= ~JED_LINE_DELIM_BITS;
+
+   if ((table->flags & FORTRAN_TYPE)
+       || (JED_GET_LINE_IN_VAL(l) != 0)
+       || ((lval != 0) && (lval != JED_LINE_HAS_EOL_COMMENT))
+       || delims[2]
+       || (delims[0] > JED_LINE_DELIM_MAX)
+       || (delims[1] > JED_LINE_DELIM_MAX))
      return;
 
+   JED_SET_LINE_DELIMS(l, delims[0], delims[1]);
+}
+
+/* Parse the lines starting at l, setting the syntax state of the next num
+ * lines and continuing until the states settle.  If max_lines is non-zero,
+ * at most that many states are set.  The number of states set is returned
+ * via *nsetp.  The function returns 0 if the parse stopped at that limit
+ * with more lines left to do, and the first of them via *nextp.  Otherwise
+ * it returns 1.
+ */
+static int syntax_parse_lines (Syntax_Table_Type *table, Line *l, unsigned int num,
+			       unsigned int max_lines, unsigned int *nsetp,
+			       Line **nextp)
+{
+   unsigned int nset = 0;
+#if JED_HAS_DFA_SYNTAX
+   int use_regions = jed_dfa_has_regions (table);
+#endif
+
+   *nsetp = 0;
+   if (l == NULL)
+     return 1;
+
    if (l->prev != NULL)
      {
 	l = l->prev;
@@ -1544,7 +1827,17 @@ static void syntax_parse_lines (Syntax_Table_Type *table, Line *l, unsigned int
 
    while (1)
      {
-	int lval = parse_to_point1 (table, l, l->data + l->len);
+	unsigned int delims[3];
+	int lval, region = 0;
+
+	delims[0] = delims[1] = delims[2] = 0;
+	lval = parse_to_point2 (table, l, l->data + l->len, delims);
+	set_line_delims (table, l, lval, delims);
+
+#if JED_HAS_DFA_SYNTAX
+	if (use_regions)
+	  region = jed_dfa_line_exit_region (table, l);
+#endif
 	if (lval == JED_LINE_HAS_EOL_COMMENT)
 	  {
 	     l->flags |= JED_LINE_HAS_EOL_COMMENT;
@@ -1561,23 +1854,75 @@ static void syntax_parse_lines (Syntax_Table_Type *table, Line *l, unsigned int
 
 	if (num == 0)
 	  {
-	     if (lval == (int)JED_GET_LINE_IN_VAL(l))
-	       return;
+	     if ((lval == (int)JED_GET_LINE_IN_VAL(l))
+		 && (region == (int)JED_GET_LINE_DFA_REGION(l)))
+	       break;
 	  }
 	else num--;
 
+	if (max_lines && (nset == max_lines))
+	  {
+	     *nsetp = nset;
+	     *nextp = l;
+	     return 0;
+	  }
+
 	l->flags &= ~JED_LINE_HAS_EOL_COMMENT;
 	JED_SET_LINE_IN_VAL(l, lval);
+	JED_SET_LINE_DFA_REGION(l, region);
+	nset++;
      }
+
+   *nsetp = nset;
+   return 1;
 }
 
-void jed_syntax_parse_buffer (int do_all)
+/* Returns the line numbered *nump in the whole of CBuf, whose lines must
+ * all be linked together, starting from the first line or the current
+ * one.  If there are fewer lines, *nump is set to the number of the last.
+ * The line where the last partial parse stopped is found at once, so that
+ * parsing a buffer in chunks does not walk down to each chunk again.
+ */
+static Line *find_line_num (Line *first, unsigned int *nump)
+{
+   unsigned int line_num = *nump;
+   unsigned int n = LineNum + CBuf->nup;
+   Line *l = CLine;
+
+   if (line_num == CBuf->parse_resume_line_num)
+     return CBuf->parse_resume_line;
+
+   if (line_num < n / 2)
+     {
+	l = first;
+	n = 1;
+     }
+   while ((n > line_num) && (l->prev != NULL))
+     {
+	l = l->prev;
+	n--;
+     }
+   while ((n < line_num) && (l->next != NULL))
+     {
+	l = l->next;
+	n++;
+     }
+   *nump = n;
+   return l;
+}
+
+/* Bring the syntax states of the unparsed region up to date.  If max_lines
+ * is non-zero, the parse stops after that many lines and the rest of the
+ * region is left marked as unparsed for a later call.
+ */
+static void syntax_parse_buffer (int do_all, unsigned int max_lines)
 {
    unsigned int min_line_num;
    unsigned int max_line_num;
-   int n;
+   unsigned int next_min_line_num = 0;
+   unsigned int num_lines;
    int is_narrow;
-   Line *l;
+   Line *l, *first;
    Syntax_Table_Type *table;
    unsigned int undo_bit = 0;
    SLang_Name_Type *color_region_hook = NULL;
@@ -1603,9 +1948,11 @@ void jed_syntax_parse_buffer (int do_all)
      }
 
    is_narrow = (CBuf->narrow != NULL);
-   if (is_narrow)
+   if (is_narrow && (color_region_hook != NULL))
      {
-	/* yuk--- a major hack: turn off undo temporally */
+	/* The hook moves about the buffer, so it has to be widened.
+	 * yuk--- a major hack: turn off undo temporally
+	 */
 	undo_bit = CBuf->flags & UNDO_ENABLED;
 	CBuf->flags &= ~UNDO_ENABLED;
 
@@ -1613,16 +1960,32 @@ void jed_syntax_parse_buffer (int do_all)
 	jed_widen_whole_buffer (CBuf);
      }
 
-   CBuf->beg->flags &= ~JED_LINE_SYNTAX_BITS; /* 0.99-17.98 */
+   first = CBuf->beg;
+   num_lines = Max_LineNum;
+   if (is_narrow && (color_region_hook == NULL))
+     {
+	/* The parser only walks the lines, so it can do without widening. */
+	first = jed_join_narrowed_lines ();
+	num_lines += CBuf->nup + CBuf->ndown;
+     }
+
+   first->flags &= ~JED_LINE_SYNTAX_BITS; /* 0.99-17.98 */
 
    if (do_all)
      {
 	min_line_num = 1;
-	max_line_num = Max_LineNum;
+	max_line_num = num_lines;
+	max_lines = 0;
      }
 
    if (color_region_hook != NULL)
      {
+	if (max_lines && (max_line_num - min_line_num >= max_lines))
+	  {
+	     next_min_line_num = min_line_num + max_lines;
+	     max_line_num = next_min_line_num - 1;
+	  }
+
 	(void) SLang_start_arg_list ();
 	if ((0 == SLang_push_integer ((int) min_line_num))
 	    && (0 == SLang_push_integer ((int) max_line_num))
@@ -1634,24 +1997,74 @@ void jed_syntax_parse_buffer (int do_all)
      }
    else
      {
-	n = (int) min_line_num;
+	unsigned int first_line_num, nset;
 
-	push_spot ();
-	goto_line (&n);
-	l = CLine;
-	pop_spot ();
+	first_line_num = min_line_num;
+	l = find_line_num (first, &first_line_num);
 
-	syntax_parse_lines (table, l, 1 + (unsigned int) (max_line_num - min_line_num));
+	if (l->prev != NULL)
+	  first_line_num--;
+
+	CBuf->parse_resume_line_num = 0;
+	if (0 == syntax_parse_lines (table, l, 1 + (unsigned int) (max_line_num - min_line_num),
+				     max_lines, &nset, &l))
+	  {
+	     next_min_line_num = first_line_num + nset + 1;
+	     CBuf->parse_resume_line = l;
+	     CBuf->parse_resume_line_num = next_min_line_num;
+	  }
      }
 
    if (is_narrow)
      {
-	jed_pop_narrow ();
-	CBuf->flags |= undo_bit;       /* hack */
+	if (color_region_hook == NULL)
+	  jed_split_narrowed_lines ();
+	else
+	  {
+	     jed_pop_narrow ();
+	     CBuf->flags |= undo_bit;       /* hack */
+	  }
+     }
+
+   if (next_min_line_num)
+     {
+	CBuf->min_unparsed_line_num = next_min_line_num;
+	if (CBuf->max_unparsed_line_num < next_min_line_num)
+	  CBuf->max_unparsed_line_num = next_min_line_num;
+	return;
      }
 
    CBuf->min_unparsed_line_num = CBuf->max_unparsed_line_num = 0;
 }
+
+void jed_syntax_parse_buffer (int do_all)
+{
+   syntax_parse_buffer (do_all, 0);
+}
+
+/* Make sure that the syntax states are valid up to and including the
+ * specified line.  Lines below it are parsed later, either when they are
+ * needed or while the editor is idle.
+ */
+void jed_syntax_parse_to_line (unsigned int line_num)
+{
+   unsigned int min_line_num = CBuf->min_unparsed_line_num;
+
+   if ((min_line_num == 0) || (min_line_num > line_num))
+     return;
+
+   syntax_parse_buffer (0, 1 + line_num - min_line_num);
+}
+
+/* Parse the remainder of the current buffer in small chunks, stopping as
+ * soon as a key is waiting.
+ */
+void jed_syntax_parse_idle (void)
+{
+   while (CBuf->min_unparsed_line_num
+	  && (0 == input_pending (&Number_Zero)))
+     syntax_parse_buffer (0, JED_SYNTAX_IDLE_CHUNK);
+}
 #endif
 
 static char *what_syntax_table (void)
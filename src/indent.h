@@ -65,6 +65,7 @@ typedef struct Syntax_Table_Type
 					* 1-1 correspondence with keyword colors
 					*/
    char *keywords[MAX_KEYWORD_TABLES][MAX_KEYWORD_LEN];
+   struct Keyword_Hash_Type *keyword_hash;   /* built from keywords[][] */
    struct Syntax_Table_Type *next;     /* pointer to next table */
 #if JED_HAS_DFA_SYNTAX
    struct Highlight *hilite;
@@ -95,10 +96,18 @@ extern void init_syntax_tables (void);
 extern void blink_match(void);
 extern int goto_match(void);
 extern Syntax_Table_Type *jed_find_syntax_table (char *, int);
+extern int jed_find_keyword (Syntax_Table_Type *, unsigned char *, unsigned int);
 extern int jed_init_syntax (void);
 
 #if JED_HAS_LINE_ATTRIBUTES
 extern void jed_syntax_parse_buffer (int);
+extern void jed_syntax_parse_to_line (unsigned int);
+extern void jed_syntax_parse_idle (void);
+#define JED_SYNTAX_IDLE_CHUNK	2000
+# if JED_HAS_DFA_SYNTAX
+extern int jed_dfa_has_regions (Syntax_Table_Type *);
+extern int jed_dfa_line_exit_region (Syntax_Table_Type *, Line *);
+# endif
 #endif
 extern int map_color_object_to_number (char *);
 
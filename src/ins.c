@@ -124,6 +124,89 @@ static void nlinsert_update_marks (Mark *m, unsigned int linenum, int n)
       }
 }
 
+static void linesdelete_update_marks (Mark *m, unsigned int linenum, int n)
+{
+   /* The n lines from linenum on are gone, and CLine took the place of
+    * the first of them.
+    */
+   while (m != NULL)
+     {
+	if (linenum <= m->n)
+	  {
+	     if (m->n < linenum + (unsigned int) n)
+	       {
+		  m->line = CLine;
+		  m->point = 0;
+		  m->n = linenum;
+	       }
+	     else m->n -= n;
+	  }
+	m = m->next;
+     }
+}
+
+static void linesinsert_update_marks (Mark *m, unsigned int linenum, int n)
+{
+   /* n lines were put above CLine, which was at line linenum - n.  The
+    * marks at its beginning stay in front of them.
+    */
+   Line *first = NULL;
+   int i;
+
+   linenum -= n;
+   while (m != NULL)
+     {
+	if (linenum <= m->n)
+	  {
+	     if ((m->line == CLine) && (m->point == 0))
+	       {
+		  if (first == NULL)
+		    {
+		       first = CLine;
+		       for (i = 0; i < n; i++) first = first->prev;
+		    }
+		  m->line = first;
+	       }
+	     else m->n += n;
+	  }
+	m = m->next;
+     }
+}
+
+/* Account for a change to the lines of b from line number first_line_num
+ * to line_num, which need parsing again.  This is done before the change
+ * is recorded for undo.
+ */
+static void note_buffer_change (Buffer *b, unsigned int first_line_num, unsigned int line_num) /*{{{*/
+{
+   Cursor_Motion = 0;
+
+   if (b->flags & UNDO_ENABLED)
+     {
+	if (b->undo == NULL) create_undo_ring();
+	Undo_Buf_Unch_Flag = !(b->flags & BUFFER_MODIFIED);
+     }
+
+   mark_buffer_modified (b, 1, 0);
+
+#if JED_HAS_LINE_ATTRIBUTES
+   b->parse_resume_line_num = 0;
+
+   if ((b->min_unparsed_line_num == 0)
+       || (b->min_unparsed_line_num > first_line_num))
+     b->min_unparsed_line_num = first_line_num;
+
+   if ((b->max_unparsed_line_num == 0)
+       || (b->max_unparsed_line_num < line_num))
+     b->max_unparsed_line_num = line_num;
+#else
+   (void) first_line_num;
+   (void) line_num;
+#endif
+}
+
+/*}}}*/
+
 void jed_update_marks (int type, int n) /*{{{*/
 {
    register Window_Type *w;
@@ -133,7 +216,7 @@ void jed_update_marks (int type, int n) /*{{{*/
    Jed_Save_Narrow_Type *save_narrow;
 #endif
    void (*update_marks_fun) (Mark *, unsigned int, int);
-   unsigned int line_num;
+   unsigned int line_num, first_line_num;
 
    if (!n) return;
 
@@ -159,33 +242,27 @@ void jed_update_marks (int type, int n) /*{{{*/
 	update_marks_fun = nldelete_update_marks;
 	break;
 
-      default:
-	update_marks_fun = NULL;       /* crash.  I want to know about this */
-     }
+      case LINESDELETE:
+	update_marks_fun = linesdelete_update_marks;
+	break;
 
-   Cursor_Motion = 0;
+      case LINESINSERT:
+	update_marks_fun = linesinsert_update_marks;
+	break;
 
-   if (b->flags & UNDO_ENABLED)
-     {
-	if (b->undo == NULL) create_undo_ring();
-	Undo_Buf_Unch_Flag = !(b->flags & BUFFER_MODIFIED);
+      default:
+	update_marks_fun = NULL;       /* crash.  I want to know about this */
      }
 
-   mark_buffer_modified (b, 1, 0);
-
    line_num = LineNum + b->nup;
-#if JED_HAS_LINE_ATTRIBUTES
-   if ((b->min_unparsed_line_num == 0)
-       || (b->min_unparsed_line_num > line_num))
-     b->min_unparsed_line_num = line_num;
+   first_line_num = line_num;
+   if (type == LINESINSERT)
+     first_line_num -= n;	       /* the new lines need parsing too */
+   note_buffer_change (b, first_line_num, line_num);
 
-   if ((b->max_unparsed_line_num == 0)
-       || (b->max_unparsed_line_num < line_num))
-     b->max_unparsed_line_num = line_num;
-#endif
    if ((m = b->spots) != NULL) (*update_marks_fun)(m, line_num, n);
    if ((m = b->marks) != NULL) (*update_marks_fun)(m, line_num, n);
-   if ((m = b->user_marks) != NULL) (*update_marks_fun)(m, line_num, n);
+   if (b->user_marks != NULL) jed_update_user_marks (b, type, line_num, n);
 
 #if JED_HAS_SAVE_NARROW
    save_narrow = b->save_narrow;
@@ -215,6 +292,39 @@ void jed_update_marks (int type, int n) /*{{{*/
 
 /*}}}*/
 
+/* Move the mark m, which is on one of the lines replaced as lm describes,
+ * to the line that takes its place.  That line may be shorter if it only
+ * has the same key in a unique sort.
+ */
+void jed_map_mark (Mark *m, Jed_Line_Map_Type *lm) /*{{{*/
+{
+   unsigned int k = lm->map[m->n - lm->linenum];
+   Line *l = lm->to[k];
+   int max = (int) l->len;
+
+   if (LINE_HAS_NEWLINE (l)) max--;
+   m->line = l;
+   m->n = lm->linenum + k;
+   if (m->point > max) m->point = max;
+}
+
+/*}}}*/
+
+static void map_line_marks (Mark *m, Jed_Line_Map_Type *lm)
+{
+   while (m != NULL)
+     {
+	if (lm->linenum <= m->n)
+	  {
+	     if (m->n < lm->linenum + lm->num_lines)
+	       jed_map_mark (m, lm);
+	     else
+	       m->n = m->n - lm->num_lines + lm->num_to;
+	  }
+	m = m->next;
+     }
+}
+
 int jed_prepare_for_modification (int check_line_readonly)
 {
    if (CBuf->flags & READ_ONLY)
@@ -283,6 +393,7 @@ int _jed_ins_byte (unsigned char c) /*{{{*/
      return -1;
 
 #ifdef KEEP_SPACE_INFO
+   jed_unshare_line ();
    if (CLine->space <= CLine->len + 1)
      remake_line(CLine->space + 15);
 #else
@@ -359,6 +470,9 @@ int jed_del_nbytes (int n) /*{{{*/
    if (-1 == jed_prepare_for_modification (1))
      return -1;
 
+   jed_unshare_line ();
+   p = CLine->data + Point;
+
    jed_update_marks(CDELETE, nn);
    record_deletion(p, nn);
    CLine->len -= nn;
@@ -373,6 +487,262 @@ int jed_del_nbytes (int n) /*{{{*/
 
 /*}}}*/
 
+/* Delete the n whole lines above the current one in one step, rather than
+ * a line at a time.  Returns the number of bytes deleted.
+ */
+int jed_del_lines_above (unsigned int n) /*{{{*/
+{
+   Line *first, *last;
+   unsigned int i;
+   int nbytes = 0, point;
+
+   if (n == 0) return 0;
+
+   last = CLine->prev;
+   first = CLine;
+   for (i = 0; i < n; i++)
+     {
+	if (first->prev == NULL)
+	  {
+	     msg_error ("Top of Buffer.");
+	     return -1;
+	  }
+	first = first->prev;
+	if (nbytes > 0x7FFFFFFF - first->len)
+	  {
+	     msg_error ("Too many lines to delete.");
+	     return -1;
+	  }
+	nbytes += first->len;
+     }
+
+   if (-1 == jed_prepare_for_modification (0))
+     return -1;
+
+   if (first->prev == NULL) CBuf->beg = CLine;
+   else first->prev->next = CLine;
+   CLine->prev = first->prev;
+   last->next = NULL;
+   LineNum -= n;
+   Max_LineNum -= n;
+
+   point = Point;
+   Point = 0;
+   jed_update_marks (LINESDELETE, (int) n);
+   record_lines_deletion (first, nbytes);
+   Point = point;
+
+   jed_free_line_list (first);
+   return nbytes;
+}
+
+/*}}}*/
+
+/* Replace the n lines above the current line, which must be at its
+ * beginning, by the m new lines in the array to, and move the marks on
+ * the old line i to the line to[map[i]].  Both n and m must be positive.
+ * The buffer changes by one splice of lines out and one in, recorded as a
+ * deletion and an insertion of whole lines.  None of the old lines may be
+ * read-only.
+ */
+int jed_replace_lines_above (unsigned int n, Line **to, unsigned int m, unsigned int *map) /*{{{*/
+{
+   Jed_Line_Map_Type lm;
+   Window_Type *w;
+#if JED_HAS_SAVE_NARROW
+   Jed_Save_Narrow_Type *save_narrow;
+#endif
+   Line *first, *last;
+   unsigned int i;
+   int nbytes = 0, point;
+
+   last = CLine->prev;
+   first = CLine;
+   for (i = 0; i < n; i++)
+     {
+	if (first->prev == NULL)
+	  {
+	     msg_error ("Top of Buffer.");
+	     return -1;
+	  }
+	first = first->prev;
+#if JED_HAS_LINE_ATTRIBUTES
+	if (first->flags & JED_LINE_IS_READONLY)
+	  {
+	     msg_error (Line_Read_Only_Error);
+	     return -1;
+	  }
+#endif
+	if (nbytes > 0x7FFFFFFF - first->len)
+	  {
+	     msg_error ("Too many lines to delete.");
+	     return -1;
+	  }
+	nbytes += first->len;
+     }
+
+   if (-1 == jed_prepare_for_modification (0))
+     return -1;
+
+   lm.linenum = LineNum + CBuf->nup - n;
+   lm.num_lines = n;
+   lm.map = map;
+   lm.to = to;
+   lm.num_to = m;
+
+   point = Point;
+   Point = 0;
+   note_buffer_change (CBuf, lm.linenum, lm.linenum + m);
+
+   /* Take the old lines out, and record them while the current line is
+    * where they were.
+    */
+   if (first->prev == NULL) CBuf->beg = CLine;
+   else first->prev->next = CLine;
+   CLine->prev = first->prev;
+   last->next = NULL;
+   LineNum -= n;
+   Max_LineNum -= n;
+   record_lines_deletion (first, nbytes);
+
+   for (i = 0; i < m; i++)
+     {
+	to[i]->prev = (i == 0) ? CLine->prev : to[i - 1];
+	to[i]->next = (i + 1 < m) ? to[i + 1] : CLine;
+     }
+   if (CLine->prev == NULL) CBuf->beg = to[0];
+   else CLine->prev->next = to[0];
+   CLine->prev = to[m - 1];
+   LineNum += m;
+   Max_LineNum += m;
+   record_lines_insertion ((int) m);
+   Point = point;
+
+   if (CBuf->spots != NULL) map_line_marks (CBuf->spots, &lm);
+   if (CBuf->marks != NULL) map_line_marks (CBuf->marks, &lm);
+   if (CBuf->user_marks != NULL) jed_map_user_marks (CBuf, &lm);
+#if JED_HAS_SAVE_NARROW
+   for (save_narrow = CBuf->save_narrow; save_narrow != NULL; save_narrow = save_narrow->next)
+     {
+	map_line_marks (save_narrow->beg, &lm);
+	map_line_marks (save_narrow->end, &lm);
+     }
+#endif
+   w = JWindow;
+   do
+     {
+	if (w->buffer == CBuf)
+	  {
+	     map_line_marks (&w->mark, &lm);
+	     map_line_marks (&w->beg, &lm);
+	  }
+	w = w->next;
+     }
+   while (w != JWindow);
+
+   if (!Suspend_Screen_Update) register_change (LINESDELETE);
+
+   jed_free_line_list (first);
+   return 0;
+}
+
+/*}}}*/
+
+/* Link the list of n new lines from first to last above the current line,
+ * which must be at its beginning, and account for them as one change.
+ */
+static int link_lines_above (Line *first, Line *last, unsigned int n) /*{{{*/
+{
+   if (CLine->prev == NULL) CBuf->beg = first;
+   else CLine->prev->next = first;
+   first->prev = CLine->prev;
+   last->next = CLine;
+   CLine->prev = last;
+   LineNum += n;
+   Max_LineNum += n;
+
+   jed_update_marks (LINESINSERT, (int) n);
+   record_lines_insertion ((int) n);
+   return 0;
+}
+
+/*}}}*/
+
+/* Insert copies of the n lines starting at l above the current line, which
+ * must be at its beginning.  The copies share the data of the lines, which
+ * is only copied once one of them is changed.
+ */
+int jed_insert_line_copies (Line *l, unsigned int n) /*{{{*/
+{
+   Line *first, *last, *copy;
+   unsigned int i;
+
+   if (n == 0) return 0;
+
+   if (-1 == jed_prepare_for_modification (0))
+     return -1;
+
+   first = last = NULL;
+   for (i = 0; i < n; i++)
+     {
+	if (NULL == (copy = dup_line (l)))
+	  {
+	     jed_free_line_list (first);
+	     return -1;
+	  }
+	copy->prev = last;
+	copy->next = NULL;
+	if (last == NULL) first = copy;
+	else last->next = copy;
+	last = copy;
+	l = l->next;
+     }
+
+   return link_lines_above (first, last, n);
+}
+
+/*}}}*/
+
+/* Insert the len bytes at s, which make up whole lines, above the current
+ * line, which must be at its beginning.
+ */
+static int insert_whole_lines (unsigned char *s, unsigned int len) /*{{{*/
+{
+   Line *first, *last, *l;
+   unsigned char *p, *pmax;
+   unsigned int n;
+
+   if (-1 == jed_prepare_for_modification (0))
+     return -1;
+
+   first = last = NULL;
+   n = 0;
+   pmax = s + len;
+   while (s < pmax)
+     {
+	p = s;
+	while (*p != '\n') p++;
+	p++;
+
+	if (NULL == (l = jed_create_line (s, (unsigned int) (p - s))))
+	  {
+	     jed_free_line_list (first);
+	     msg_error ("Malloc Error");
+	     return -1;
+	  }
+	l->prev = last;
+	if (last == NULL) first = l;
+	else last->next = l;
+	last = l;
+	n++;
+	s = p;
+     }
+
+   return link_lines_above (first, last, n);
+}
+
+/*}}}*/
+
 /* delete n characters, crossing nl if necessary */
 int jed_generic_del_nbytes (int n) /*{{{*/
 {
@@ -425,7 +795,8 @@ int jed_insert_newline (void)
      return -1;
    (void) jed_down (1);
 #if JED_HAS_LINE_ATTRIBUTES
-   CLine->flags = flags;
+   /* The delimiter summary described the whole of the line that was split */
+   CLine->flags = flags & ~JED_LINE_DELIM_BITS;
 #endif
    return 0;
 }
@@ -473,6 +844,7 @@ int jed_quick_insert(register unsigned char *s, int n) /*{{{*/
      }
 
 #ifdef KEEP_SPACE_INFO
+   jed_unshare_line ();
    if (CLine->space <= CLine->len + n + 1) remake_line(CLine->space + n + 8);
 #else
    if (n) remake_line (CLine->len + n);
@@ -507,29 +879,37 @@ int jed_quick_insert(register unsigned char *s, int n) /*{{{*/
 
 /*}}}*/
 
-int jed_insert_nbytes (unsigned char *ss, int n) /*{{{*/
+int jed_insert_nbytes (unsigned char *s, int n) /*{{{*/
 {
-   register unsigned char nl, *pmax;
-   register unsigned char *p, *p1, *s = ss;
-   int n1;
+   unsigned char *p, *q, *pmax;
+
+   if (CBuf == MiniBuffer)
+     return jed_quick_insert (s, n);
+
+   /* The text up to the first newline goes into the current line, and
+    * the text after the last one into the line that follows.  The whole
+    * lines in between are put in at once.
+    */
+   pmax = s + n;
+   p = s;
+   while ((p < pmax) && (*p != '\n')) p++;
+   if (p == pmax)
+     return jed_quick_insert (s, n);
+   p++;
+
+   q = pmax;
+   while ((q > p) && (q[-1] != '\n')) q--;
+
+   if (-1 == jed_quick_insert (s, (int) (p - s)))
+     return -1;
 
-   if (CBuf == MiniBuffer) nl = 0; else nl = '\n';
+   if ((q > p)
+       && (-1 == insert_whole_lines (p, (unsigned int) (q - p))))
+     return -1;
 
-   p1 = s;
-   while (1)
-     {
-	p = p1;
-	/* count the number until a new line is reached */
-	pmax = p1 + n;
-	while((p1 < pmax) && (*p1 != nl)) p1++;
-
-	n1 = (int) (p1 - p);
-	if (p1 != pmax) n1++;
-	if (-1 == jed_quick_insert(p, n1))
-	  return -1;
-	if (p1++ == pmax) return 0;
-	n -= n1;
-     }
+   if (q == pmax)
+     return 0;
+   return jed_quick_insert (q, (int) (pmax - q));
 }
 
 /*}}}*/
@@ -12,6 +12,8 @@
 #define NLINSERT	0x8   /* causes marks to be moved to next line */
 #define NLDELETE	0x10    /* opposite of above */
 #define UNDO_POSITION	0x20	       /* records position */
+#define LINESDELETE	0x40	       /* many lines above CLine removed at once */
+#define LINESINSERT	0x80	       /* many lines put above CLine at once */
 
 extern void jed_update_marks(int, int);
 extern int No_Screen_Update;
@@ -19,6 +21,10 @@ extern int jed_del_nbytes (int);
 extern int jed_generic_del_nbytes (int);
 extern int jed_del_wchar(void);
 extern int jed_del_through_eol(void);
+extern int jed_del_lines_above (unsigned int);
+extern int jed_insert_line_copies (Line *, unsigned int);
+extern int jed_replace_lines_above (unsigned int, Line **, unsigned int, unsigned int *);
+extern void jed_map_mark (Mark *, Jed_Line_Map_Type *);
 extern int _jed_ins_byte (unsigned char);   /* \n will not split the line */
 extern int jed_insert_wchar (SLwchar_Type);
 extern int jed_insert_byte (unsigned char);
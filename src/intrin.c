@@ -649,6 +649,24 @@ static void set_line_number_mode (int *statusp)
      status = (CBuf->line_num_display_size == 0);
 
    CBuf->line_num_display_size = (status > 0);
+   CBuf->line_num_relative = (status == 2);
+#else
+   (void) statusp;
+#endif
+}
+
+static void set_soft_wrap_mode (int *statusp)
+{
+#if JED_HAS_SOFT_WRAP
+   int status = *statusp;
+   if (status < 0)
+     status = (CBuf->soft_wrap == 0);
+
+   if (CBuf->soft_wrap != (status > 0))
+     {
+	CBuf->soft_wrap = (status > 0);
+	touch_screen_for_buffer (CBuf);
+     }
 #else
    (void) statusp;
 #endif
@@ -807,6 +825,7 @@ static SLang_Intrin_Fun_Type Jed_Intrinsics [] = /*{{{*/
    MAKE_INTRINSIC_S("bufferp", bufferp, INT_TYPE),
    MAKE_INTRINSIC_I("update", update_cmd, VOID_TYPE),
    MAKE_INTRINSIC_I("update_sans_update_hook", update_sans_update_hook_cmd, VOID_TYPE),
+   MAKE_INTRINSIC_0("_jed_render_buffer", jed_render_buffer_cmd, INT_TYPE),
    MAKE_INTRINSIC("skip_word_chars", skip_word_chars, VOID_TYPE, 0),
    MAKE_INTRINSIC("skip_non_word_chars", skip_non_word_chars, VOID_TYPE, 0),
    MAKE_INTRINSIC("bskip_word_chars", bskip_word_chars, VOID_TYPE, 0),
@@ -894,6 +913,10 @@ static SLang_Intrin_Fun_Type Jed_Intrinsics [] = /*{{{*/
    MAKE_INTRINSIC("move_user_mark", move_user_mark, VOID_TYPE, 0),
    MAKE_INTRINSIC("user_mark_buffer", user_mark_buffer, STRING_TYPE, 0),
    MAKE_INTRINSIC("is_user_mark_in_narrow", jed_is_user_mark_in_narrow, INT_TYPE, 0),
+   MAKE_INTRINSIC("create_buffer_snapshot", create_buffer_snapshot, VOID_TYPE, 0),
+   MAKE_INTRINSIC("buffer_snapshot_num_lines", buffer_snapshot_num_lines, INT_TYPE, 0),
+   MAKE_INTRINSIC_I("buffer_snapshot_line", buffer_snapshot_line, VOID_TYPE),
+   MAKE_INTRINSIC_III("sort_region_lines", sort_region_lines, VOID_TYPE),
 
 #if JED_HAS_LINE_MARKS
    MAKE_INTRINSIC_I("create_line_mark", jed_create_line_mark, VOID_TYPE),
@@ -963,8 +986,12 @@ static SLang_Intrin_Fun_Type Jed_Intrinsics [] = /*{{{*/
 
    MAKE_INTRINSIC_S("run_program", run_program, INT_TYPE),
    MAKE_INTRINSIC_I("set_line_number_mode", set_line_number_mode, INT_TYPE),
+   MAKE_INTRINSIC_I("set_soft_wrap_mode", set_soft_wrap_mode, VOID_TYPE),
    MAKE_INTRINSIC_S("strwidth", intrin_strwidth, INT_TYPE),
    MAKE_INTRINSIC_0("set_undo_position", jed_undo_record_position, VOID_TYPE),
+#ifdef UNDO_HAS_SWAP
+   MAKE_INTRINSIC_S("set_undo_history_dir", jed_set_undo_history_dir, VOID_TYPE),
+#endif
    SLANG_END_INTRIN_FUN_TABLE
 };
 
@@ -1028,6 +1055,8 @@ static SLang_Intrin_Var_Type Jed_Variables [] =
    MAKE_VARIABLE("_jed_secure_mode", &Jed_Secure_Mode, INT_TYPE, 1),
 
    MAKE_VARIABLE("Simulate_Graphic_Chars", &Jed_Simulate_Graphic_Chars, INT_TYPE, 0),
+   MAKE_VARIABLE("Undo_Buffer_Limit", &Jed_Undo_Buffer_Limit, INT_TYPE, 0),
+   MAKE_VARIABLE("Undo_Total_Limit", &Jed_Undo_Total_Limit, INT_TYPE, 0),
 #ifndef IBMPC_SYSTEM
    MAKE_VARIABLE("OUTPUT_RATE", &Obsolete_Int_Variable, INT_TYPE, 0),
    MAKE_VARIABLE("USE_ANSI_COLORS", &tt_Use_Ansi_Colors, INTP_TYPE, 0),
@@ -1064,6 +1093,14 @@ static SLang_Intrin_Var_Type Jed_Variables [] =
    MAKE_VARIABLE(NULL, NULL, 0, 0)
 };
 
+static SLang_IConstant_Type Jed_IConstants [] =
+{
+   MAKE_ICONSTANT("JED_SORT_NUMERIC", JED_SORT_NUMERIC),
+   MAKE_ICONSTANT("JED_SORT_REVERSE", JED_SORT_REVERSE),
+   MAKE_ICONSTANT("JED_SORT_UNIQUE", JED_SORT_UNIQUE),
+   SLANG_END_ICONST_TABLE
+};
+
 size_t cbrief_slang_init(); /* ndc: cbrief.c module */
 
 int init_jed_intrinsics (void) /*{{{*/
@@ -1071,6 +1108,7 @@ int init_jed_intrinsics (void) /*{{{*/
    if ((-1 == SLadd_intrin_fun_table (Jed_Intrinsics, NULL))
        || (-1 == SLadd_intrin_fun_table(Jed_Other_Intrinsics, NULL))
        || (-1 == SLadd_intrin_var_table (Jed_Variables, NULL))
+       || (-1 == SLadd_iconstant_table (Jed_IConstants, NULL))
 #if JED_HAS_LINE_ATTRIBUTES
        || (-1 == SLadd_intrin_fun_table(JedLine_Intrinsics, NULL))
 #endif
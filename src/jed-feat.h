@@ -22,6 +22,9 @@
 
 #define JED_HAS_DISPLAY_LINE_NUMBERS	1
 
+/* Visual wrapping of long lines at the window edge */
+#define JED_HAS_SOFT_WRAP		1
+
 /* Drop down menu support. */
 #define JED_HAS_MENUS		1
 
@@ -10,6 +10,9 @@
 /*{{{ Include Files */
 
 #include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
 #include <slang.h>
 
 #include "jdmacros.h"
@@ -151,6 +154,7 @@ SLKeymap_Function_Type Jed_Functions[] = /*{{{*/
      {"backward_delete_char_untabify", backward_delete_char_untabify},
      {"beep", jed_beep},
      {"begin_macro", begin_keyboard_macro},
+     {"bracketed_paste", bracketed_paste_cmd},
      {"center_line", center_line},
      {"right_line", right_line},
      {"left_line", left_line},
@@ -332,6 +336,7 @@ void init_keymaps(void) /*{{{*/
 #if HAS_MOUSE
    SLkm_define_key ("\033[M", (FVOID_STAR)xterm_mouse_cmd, Global_Map);
 #endif
+   SLkm_define_key ("\033[200~", (FVOID_STAR) bracketed_paste_cmd, Global_Map);
 #ifdef sun
    SLkm_define_key ("\033[216z", (FVOID_STAR) pageup_cmd, Global_Map);
    SLkm_define_key ("\033[222z", (FVOID_STAR) pagedown_cmd, Global_Map);
@@ -477,6 +482,8 @@ static int do_macro_string (char *str, int repeat)
    return ret;
 }
 
+static void key_latency_note_command (SLang_Key_Type *);
+
 static int key_interpret (SLang_Key_Type *key) /*{{{*/
 {
    char *str;
@@ -484,6 +491,7 @@ static int key_interpret (SLang_Key_Type *key) /*{{{*/
 
    strcpy (Last_Kbd_Command_String, Current_Kbd_Command_String);
    Jed_This_Key_Function = key->f.f;
+   key_latency_note_command (key);
 
    switch (key->type)
      {
@@ -577,6 +585,307 @@ static SLFUTURE_CONST char *lookup_key_function_string (SLang_Key_Type *key)
      }
 }
 
+/*{{{ Keystroke latency statistics */
+
+/* The time from the arrival of a key to the end of the screen update that
+ * follows it is recorded per command in a histogram with logarithmic
+ * buckets: values below 16 microseconds get a bucket each, and every power
+ * of two above that is split into 8 buckets.  This keeps the relative
+ * error of the reported percentiles below about 6 percent.
+ */
+#define LATENCY_LINEAR_BUCKETS	16
+#define LATENCY_SUB_BUCKETS	8
+#define LATENCY_NUM_BUCKETS	(LATENCY_LINEAR_BUCKETS + 28 * LATENCY_SUB_BUCKETS)
+
+typedef struct Key_Latency_Type
+{
+   char name[32];
+   unsigned long count;
+   unsigned long max;
+   double sum;
+   unsigned int buckets[LATENCY_NUM_BUCKETS];
+   struct Key_Latency_Type *next;
+}
+Key_Latency_Type;
+
+static Key_Latency_Type *Key_Latency_List;
+static Key_Latency_Type Key_Latency_Total;
+
+static int Key_Latency_Pending;
+static unsigned long Key_Latency_Start_Time;
+static char Key_Latency_Command[32];   /* command the pending key ran */
+static char Key_Latency_Current[32];   /* outermost command being run */
+
+static unsigned int latency_bucket (unsigned long usecs)
+{
+   unsigned int e;
+
+   if (usecs >= 0xFFFFFFFFUL)
+     usecs = 0xFFFFFFFFUL;
+
+   if (usecs < LATENCY_LINEAR_BUCKETS)
+     return (unsigned int) usecs;
+
+   e = 4;
+   while ((usecs >> (e + 1)) != 0)
+     e++;
+
+   return LATENCY_LINEAR_BUCKETS + (e - 4) * LATENCY_SUB_BUCKETS
+     + (unsigned int) ((usecs >> (e - 3)) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+/* Returns the largest value that falls into the bucket */
+static unsigned long latency_bucket_value (unsigned int b)
+{
+   unsigned int e, sub;
+
+   if (b < LATENCY_LINEAR_BUCKETS)
+     return b;
+
+   b -= LATENCY_LINEAR_BUCKETS;
+   e = 4 + b / LATENCY_SUB_BUCKETS;
+   sub = b % LATENCY_SUB_BUCKETS;
+   return ((unsigned long) (LATENCY_SUB_BUCKETS + sub + 1) << (e - 3)) - 1;
+}
+
+static unsigned long latency_percentile (Key_Latency_Type *kl, unsigned int p)
+{
+   unsigned long target, n;
+   unsigned int b;
+
+   if (kl->count == 0)
+     return 0;
+
+   target = (kl->count * p + 99) / 100;
+   if (target == 0) target = 1;
+
+   n = 0;
+   for (b = 0; b < LATENCY_NUM_BUCKETS; b++)
+     {
+	n += kl->buckets[b];
+	if (n >= target)
+	  {
+	     unsigned long v = latency_bucket_value (b);
+	     return (v > kl->max) ? kl->max : v;
+	  }
+     }
+   return kl->max;
+}
+
+static void latency_add (Key_Latency_Type *kl, unsigned long usecs)
+{
+   kl->count++;
+   kl->sum += (double) usecs;
+   if (usecs > kl->max) kl->max = usecs;
+   kl->buckets[latency_bucket (usecs)]++;
+}
+
+static Key_Latency_Type *find_key_latency (char *name, int create)
+{
+   Key_Latency_Type *kl, *prev;
+
+   prev = NULL;
+   kl = Key_Latency_List;
+   while (kl != NULL)
+     {
+	if (0 == strcmp (kl->name, name))
+	  {
+	     /* Move to the front: few commands account for most keys */
+	     if (prev != NULL)
+	       {
+		  prev->next = kl->next;
+		  kl->next = Key_Latency_List;
+		  Key_Latency_List = kl;
+	       }
+	     return kl;
+	  }
+	prev = kl;
+	kl = kl->next;
+     }
+
+   if (create == 0)
+     return NULL;
+
+   if (NULL == (kl = (Key_Latency_Type *) jed_malloc0 (sizeof (Key_Latency_Type))))
+     return NULL;
+   strncpy (kl->name, name, sizeof (kl->name) - 1);
+   kl->next = Key_Latency_List;
+   Key_Latency_List = kl;
+   return kl;
+}
+
+/* Called by my_getkey for each key read */
+void jed_key_latency_start (void)
+{
+   if (Key_Latency_Pending)
+     return;
+
+   Key_Latency_Pending = 1;
+   Key_Latency_Start_Time = sys_usec_clock ();
+   *Key_Latency_Command = 0;
+}
+
+static void key_latency_note_command (SLang_Key_Type *key)
+{
+   SLFUTURE_CONST char *name;
+
+   name = lookup_key_function_string (key);
+   if ((name == NULL) || (*name == 0))
+     name = "** Unknown **";
+
+   /* Keys that a command reads by itself, e.g., via getkey, do not go
+    * through key_interpret.  They are charged to the last command.
+    */
+   strncpy (Key_Latency_Current, name, sizeof (Key_Latency_Current) - 1);
+   Key_Latency_Current[sizeof (Key_Latency_Current) - 1] = 0;
+
+   if (Key_Latency_Pending && (*Key_Latency_Command == 0))
+     {
+	strncpy (Key_Latency_Command, name, sizeof (Key_Latency_Command) - 1);
+	Key_Latency_Command[sizeof (Key_Latency_Command) - 1] = 0;
+     }
+}
+
+/* Called by update when the screen has been flushed to the terminal */
+void jed_key_latency_end (void)
+{
+   Key_Latency_Type *kl;
+   unsigned long usecs;
+   char *name;
+
+   if (Key_Latency_Pending == 0)
+     return;
+   Key_Latency_Pending = 0;
+
+   name = Key_Latency_Command;
+   if (*name == 0)
+     name = Key_Latency_Current;
+   if (*name == 0)
+     return;
+
+   usecs = sys_usec_clock () - Key_Latency_Start_Time;
+   latency_add (&Key_Latency_Total, usecs);
+   if (NULL != (kl = find_key_latency (name, 1)))
+     latency_add (kl, usecs);
+}
+
+static void push_key_latency_stats (Key_Latency_Type *kl)
+{
+   (void) SLang_push_ulong (kl->count);
+   (void) SLang_push_double (kl->count ? kl->sum / kl->count : 0.0);
+   (void) SLang_push_ulong (latency_percentile (kl, 50));
+   (void) SLang_push_ulong (latency_percentile (kl, 90));
+   (void) SLang_push_ulong (latency_percentile (kl, 99));
+   (void) SLang_push_ulong (kl->max);
+}
+
+static void key_latency_stats_intrin (char *name)
+{
+   Key_Latency_Type *kl, empty;
+
+   if (*name == 0)
+     kl = &Key_Latency_Total;
+   else if (NULL == (kl = find_key_latency (name, 0)))
+     {
+	memset ((char *) &empty, 0, sizeof (Key_Latency_Type));
+	kl = &empty;
+     }
+   push_key_latency_stats (kl);
+}
+
+static void key_latency_commands_intrin (void)
+{
+   SLindex_Type j, n;
+   char **names;
+   SLang_Array_Type *at;
+   Key_Latency_Type *kl;
+
+   n = 0;
+   for (kl = Key_Latency_List; kl != NULL; kl = kl->next)
+     n++;
+
+   if (NULL == (at = SLang_create_array (SLANG_STRING_TYPE, 0, NULL, &n, 1)))
+     return;
+
+   names = (char **)at->data;
+   j = 0;
+   for (kl = Key_Latency_List; kl != NULL; kl = kl->next)
+     {
+	if (NULL == (names[j] = SLang_create_slstring (kl->name)))
+	  {
+	     SLang_free_array (at);
+	     return;
+	  }
+	j++;
+     }
+   SLang_push_array (at, 1);
+}
+
+static void key_latency_reset_intrin (void)
+{
+   Key_Latency_Type *kl, *next;
+
+   kl = Key_Latency_List;
+   while (kl != NULL)
+     {
+	next = kl->next;
+	SLfree ((char *) kl);
+	kl = next;
+     }
+   Key_Latency_List = NULL;
+   memset ((char *) &Key_Latency_Total, 0, sizeof (Key_Latency_Type));
+}
+
+static void write_key_latency (FILE *fp, char *name, Key_Latency_Type *kl)
+{
+   fprintf (fp, "%-31s %8lu %10.0f %8lu %8lu %8lu %8lu\n",
+	    name, kl->count, kl->count ? kl->sum / kl->count : 0.0,
+	    latency_percentile (kl, 50), latency_percentile (kl, 90),
+	    latency_percentile (kl, 99), kl->max);
+}
+
+int jed_dump_key_latency (char *file)
+{
+   Key_Latency_Type *kl;
+   FILE *fp;
+
+   if (NULL == (fp = fopen (file, "w")))
+     return -1;
+
+   fprintf (fp, "%-31s %8s %10s %8s %8s %8s %8s\n",
+	    "# command (usecs)", "count", "mean", "p50", "p90", "p99", "max");
+   write_key_latency (fp, "*all*", &Key_Latency_Total);
+   for (kl = Key_Latency_List; kl != NULL; kl = kl->next)
+     write_key_latency (fp, kl->name, kl);
+
+   if (EOF == fclose (fp))
+     return -1;
+   return 0;
+}
+
+static void key_latency_dump_intrin (char *file)
+{
+   if (-1 == jed_dump_key_latency (file))
+     SLang_verror (SL_Write_Error, "Unable to write %s", file);
+}
+
+/* If JED_KEY_LATENCY_FILE is set, the statistics are written there upon
+ * exit.
+ */
+void jed_dump_key_latency_at_exit (void)
+{
+   char *file;
+
+   if ((Key_Latency_Total.count == 0)
+       || (NULL == (file = getenv ("JED_KEY_LATENCY_FILE")))
+       || (*file == 0))
+     return;
+
+   (void) jed_dump_key_latency (file);
+}
+
+/*}}}*/
+
 static int do_key (void) /*{{{*/
 {
    SLang_Key_Type *key;
@@ -759,6 +1068,14 @@ void jed (void) /*{{{*/
 	int had_err = 0;
 	Suspend_Screen_Update = 0;
 
+#if JED_HAS_LINE_ATTRIBUTES
+	/* The screen is up to date, so use the time until the next key to
+	 * finish the syntax parse that the display deferred.
+	 */
+	if (JWindow->trashed == 0)
+	  jed_syntax_parse_idle ();
+#endif
+	jed_trim_line_slack (0);
 	do_jed();
 	if (SLang_get_error ())
 	  {
@@ -1448,6 +1765,10 @@ static SLang_Intrin_Fun_Type Keymap_Intrinsics [] =
    MAKE_INTRINSIC("_getkey", jed_getkey, INT_TYPE, 0),
    MAKE_INTRINSIC_I("_ungetkey", ungetkey, VOID_TYPE),
    MAKE_INTRINSIC_0("getkey", getkey_wchar_intrin, VOID_TYPE),
+   MAKE_INTRINSIC_S("key_latency_stats", key_latency_stats_intrin, VOID_TYPE),
+   MAKE_INTRINSIC_0("key_latency_commands", key_latency_commands_intrin, VOID_TYPE),
+   MAKE_INTRINSIC_0("key_latency_reset", key_latency_reset_intrin, VOID_TYPE),
+   MAKE_INTRINSIC_S("key_latency_dump", key_latency_dump_intrin, VOID_TYPE),
    MAKE_INTRINSIC_1("ungetkey", ungetkey_wchar_intrin, VOID_TYPE, SLANG_LONG_TYPE),
 #ifdef REAL_UNIX_SYSTEM
    MAKE_INTRINSIC_1("set_default_key_wait_time", jed_set_default_key_wait_time, SLANG_INT_TYPE, SLANG_INT_TYPE),
@@ -89,5 +89,10 @@ extern int Jed_Max_Hits;
 
 extern int jed_init_keymap_intrinsics (void);
 
+extern void jed_key_latency_start (void);
+extern void jed_key_latency_end (void);
+extern int jed_dump_key_latency (char *);
+extern void jed_dump_key_latency_at_exit (void);
+
 #endif
 
@@ -400,6 +400,9 @@ int jed_save_buffer_to_file (char *dir, char *file)
 
 #ifdef UNDO_HAS_REDO
    update_undo_unchanged ();
+#endif
+#ifdef UNDO_HAS_SWAP
+   (void) jed_undo_save_history (dirfile);
 #endif
    visit_file (dir, file);
 
@@ -812,6 +815,10 @@ int find_file_cmd (char *filestr)       /* filestr is const ! */ /*{{{*/
 	(void) bob ();
 	set_file_modes();
 	CBuf->flags |= UNDO_ENABLED;
+#ifdef UNDO_HAS_SWAP
+	if (status == 1)
+	  (void) jed_undo_load_history (dirfile);
+#endif
      }
 
    if (-1 == jed_va_run_hooks ("_jed_find_file_after_hooks", JED_HOOKS_RUN_ALL, 0))
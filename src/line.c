@@ -64,6 +64,7 @@ void splice_line (void) /*{{{*/
    n2 = CLine->next->len;
 
 #ifdef KEEP_SPACE_INFO
+   jed_unshare_line ();
    if (n1 + n2 > CLine->space)
 #endif
      remake_line(n1 + n2 + 1);
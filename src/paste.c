@@ -12,6 +12,11 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
+#include <math.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
 
 #include "buffer.h"
 #include "ins.h"
@@ -23,9 +28,6 @@
 
 /*}}}*/
 
-/* SLang user object be larger than 128 */
-#define JED_MARK_TYPE 128
-
 Buffer *Paste_Buffer;
 static Buffer *Rectangle_Buffer;
 
@@ -129,15 +131,17 @@ int jed_init_mark_for_line (Mark *m, Line *l, unsigned int flags) /*{{{*/
 /*}}}*/
 #endif
 #if JED_HAS_SAVE_NARROW
-static Mark *create_mark (unsigned int flags) /*{{{*/
+static Mark *create_mark (Line *l, int point, unsigned int n, unsigned int flags) /*{{{*/
 {
    Mark *m;
 
    if (NULL == (m = (Mark *) jed_malloc0 (sizeof(Mark))))
      exit_error("create-mark: malloc error", 0);
 
-   jed_init_mark (m, flags);
-
+   m->line = l;
+   m->point = point;
+   m->n = n;
+   m->flags = flags;
    return m;
 }
 
@@ -349,29 +353,24 @@ int exchange_point_mark(void) /*{{{*/
   */
 int check_region(int *push) /*{{{*/
 {
-   register Line *beg, *tthis = CLine;
-   int pbeg;
+   Mark *m = CBuf->marks;
 
-   if (CBuf->marks == NULL)
+   if (m == NULL)
      {
 	msg_error("No region defined");
 	return(0);
      }
 
    if (*push) push_spot();
-   beg = CBuf->marks->line;
-   pbeg = CBuf->marks->point;
 
-   if (beg == CLine)
-     {
-	if (pbeg <= Point) return(1);
-     }
-
-   else
+   /* The line numbers of the marks are kept up to date, so they tell the
+    * order without walking the lines in between.
+    */
+   if (m->line == CLine)
      {
-	while((beg != NULL) && (beg != tthis)) beg = beg->next;
-	if (beg == tthis) return(1);
+	if (m->point <= Point) return(1);
      }
+   else if (m->n < LineNum + CBuf->nup) return(1);
 
    exchange_point_mark();
    return(1);
@@ -408,7 +407,7 @@ static int widen_buffer_lines (Buffer *b) /*{{{*/
    if (n->beg != NULL) n->beg->next = b->beg;
    b->end->next = n->end;
    b->beg->prev = n->beg;
-   b->beg = n->beg1;
+   if (n->beg != NULL) b->beg = n->beg1;
    if (n->end != NULL) b->end = n->end1;
 
    Max_LineNum += n->ndown + n->nup;
@@ -718,6 +717,20 @@ int copy_region_to_buffer(Buffer *b) /*{{{*/
 	if (-1 == jed_quick_insert(first->data + first_point, n))
 	  goto the_return;
 
+	/* The whole lines in between are put in at once.  Their copies
+	 * share the data until one side is changed.
+	 */
+	if (first->next != last)
+	  {
+	     unsigned int nlines = 0;
+	     Line *l;
+
+	     for (l = first->next; l != last; l = l->next) nlines++;
+	     if (-1 == jed_insert_line_copies (first->next, nlines))
+	       goto the_return;
+	     first = last->prev;
+	  }
+
 	while (first = first->next, first != last)
 	  {
 	     if (-1 == jed_quick_insert (first->data, first->len))
@@ -788,7 +801,8 @@ static int jed_check_readonly_region (void)
 int delete_region (void) /*{{{*/
 {
    int beg_point, end_point;
-   Line *beg, *end;
+   unsigned int n, nlines;
+   Line *beg, *end, *l;
 
    if (0 != jed_check_readonly_region ())
      return -1;
@@ -801,27 +815,39 @@ int delete_region (void) /*{{{*/
    beg = CLine; beg_point = Point;
    pop_spot();
 
-   if (end != beg)
+   /* The whole lines in between go in one piece, then the rest is deleted
+    * forward from the beginning of the region.  That makes two undo records
+    * at most, which are undone together as part of the same command.
+    */
+   if (beg != end)
      {
-	bol ();
-
-	if (-1 == jed_del_nbytes (end_point))
+	nlines = 0;
+	for (l = beg->next; (l != end) && (l != NULL); l = l->next)
+	  nlines++;
+	if (-1 == jed_del_lines_above (nlines))
 	  return -1;
-
-	/* go back because we do not want to mess with Line structures
-	   changing on us --- shouldn't happen anyway */
-
-	while (jed_up (1) && (CLine != beg))
-	  {
-	     bol ();
-	     if (-1 == jed_del_through_eol ())
-	       return -1;
-	  }
-	end_point = CLine->len;	       /* include \n */
      }
 
+   /* What is left is the rest of the first line and the start of the
+    * last, which may still add up to more than an int holds.
+    */
+   if (beg == end)
+     n = (unsigned int) (end_point - beg_point);
+   else
+     {
+	/* beg is now the line just above end */
+	n = (unsigned int) beg->len - (unsigned int) beg_point
+	  + (unsigned int) end_point;
+	(void) jed_up (1);
+     }
    jed_set_point (beg_point);
-   if (-1 == jed_generic_del_nbytes (end_point - Point))
+   while (n > (unsigned int) INT_MAX)
+     {
+	if (-1 == jed_generic_del_nbytes (INT_MAX))
+	  return -1;
+	n -= (unsigned int) INT_MAX;
+     }
+   if (-1 == jed_generic_del_nbytes ((int) n))
      return -1;
 
    return 1;
@@ -1102,10 +1128,530 @@ typedef struct /*{{{*/
 /*}}}*/
 User_Mark_Type;
 
+/* A buffer may hold many thousands of user marks, e.g., one for every
+ * compiler error or bookmark, so they are not updated one by one upon each
+ * edit.  Instead they are hashed on the line that they are on, and only the
+ * marks on the edited line are visited.  Changes to the line numbers of the
+ * marks are recorded in a table of shifts and applied when the line number
+ * is needed: unless the mark has the MARK_LINENUM_CURRENT flag, its line
+ * number is m->n plus the offset of the last shift whose linenum is at most
+ * m->n.  Marks whose line number had to be set while shifts were pending
+ * carry the MARK_LINENUM_CURRENT flag and are updated right away.
+ */
+typedef struct
+{
+   unsigned int linenum;
+   int offset;
+}
+Mark_Shift_Type;
+
+struct _User_Mark_Index_Type
+{
+   Mark **table;		       /* chained via the next field */
+   unsigned int table_size;	       /* a power of 2 */
+   unsigned int num_marks;
+   Mark_Shift_Type *shifts;	       /* sorted by linenum */
+   unsigned int num_shifts;
+   unsigned int max_shifts;
+   Mark **current;		       /* marks with MARK_LINENUM_CURRENT */
+   unsigned int num_current;
+   unsigned int max_current;
+};
+
+#define USER_MARK_TABLE_SIZE	64
+
+static unsigned int hash_mark_line (User_Mark_Index_Type *idx, Line *l) /*{{{*/
+{
+   unsigned long h = (unsigned long) l;
+
+   h = (h >> 4) ^ (h >> 12);
+   return (unsigned int) h & (idx->table_size - 1);
+}
+
+/*}}}*/
+
+static void link_user_mark (User_Mark_Index_Type *idx, Mark *m) /*{{{*/
+{
+   Mark **b = idx->table + hash_mark_line (idx, m->line);
+
+   m->next = *b;
+   *b = m;
+}
+
+/*}}}*/
+
+static void unlink_user_mark (User_Mark_Index_Type *idx, Mark *m) /*{{{*/
+{
+   Mark **b = idx->table + hash_mark_line (idx, m->line);
+
+   while (*b != m) b = &(*b)->next;
+   *b = m->next;
+}
+
+/*}}}*/
+
+/* The number of shifts or current marks that may accumulate before all
+ * marks are brought up to date.
+ */
+static unsigned int max_pending_shifts (User_Mark_Index_Type *idx) /*{{{*/
+{
+   return 64 + idx->num_marks / 64;
+}
+
+/*}}}*/
+
+static unsigned int shifted_linenum (User_Mark_Index_Type *idx, unsigned int n) /*{{{*/
+{
+   Mark_Shift_Type *s = idx->shifts;
+   unsigned int lo = 0, hi = idx->num_shifts;
+
+   while (lo < hi)
+     {
+	unsigned int mid = (lo + hi) / 2;
+	if (s[mid].linenum <= n) lo = mid + 1;
+	else hi = mid;
+     }
+   if (lo == 0) return n;
+   return (unsigned int) ((long) n + s[lo - 1].offset);
+}
+
+/*}}}*/
+
+static void flush_mark_shifts (User_Mark_Index_Type *idx) /*{{{*/
+{
+   unsigned int i;
+
+   for (i = 0; i < idx->table_size; i++)
+     {
+	Mark *m;
+
+	for (m = idx->table[i]; m != NULL; m = m->next)
+	  {
+	     if (m->flags & MARK_LINENUM_CURRENT)
+	       m->flags &= ~MARK_LINENUM_CURRENT;
+	     else
+	       m->n = shifted_linenum (idx, m->n);
+	  }
+     }
+   idx->num_shifts = 0;
+   idx->num_current = 0;
+}
+
+/*}}}*/
+
+static int grow_mark_array (VOID_STAR *ap, unsigned int *maxp, unsigned int size) /*{{{*/
+{
+   unsigned int max = 2 * (*maxp) + 16;
+   char *a;
+
+   if (NULL == (a = SLrealloc ((char *) *ap, max * size)))
+     return -1;
+   *ap = (VOID_STAR) a;
+   *maxp = max;
+   return 0;
+}
+
+/*}}}*/
+
+/* Add delta to the line numbers of all marks at or below linenum. */
+static void shift_user_marks (User_Mark_Index_Type *idx, unsigned int linenum, int delta) /*{{{*/
+{
+   Mark_Shift_Type *s;
+   unsigned int i, j, num;
+   long t;
+
+   if (idx->num_shifts >= max_pending_shifts (idx))
+     flush_mark_shifts (idx);
+
+   for (i = 0; i < idx->num_current; i++)
+     {
+	Mark *m = idx->current[i];
+	if (m->n >= linenum) m->n += delta;
+     }
+
+   if ((idx->num_shifts == idx->max_shifts)
+       && (-1 == grow_mark_array ((VOID_STAR *) &idx->shifts, &idx->max_shifts,
+				  sizeof (Mark_Shift_Type))))
+     {
+	flush_mark_shifts (idx);
+	for (i = 0; i < idx->table_size; i++)
+	  {
+	     Mark *m;
+	     for (m = idx->table[i]; m != NULL; m = m->next)
+	       if (m->n >= linenum) m->n += delta;
+	  }
+	return;
+     }
+
+   /* Find the smallest unshifted line number that is at least linenum
+    * once shifted.  Since the shifts never reorder lines, it is the first
+    * such one in the first interval between shifts containing one.
+    */
+   s = idx->shifts;
+   num = idx->num_shifts;
+   t = linenum;
+   for (i = 0; i < num; i++)
+     {
+	if (t < (long) s[i].linenum)
+	  break;
+	t = (long) linenum - s[i].offset;
+	if (t < (long) s[i].linenum) t = s[i].linenum;
+     }
+
+   if ((i == 0) || (s[i - 1].linenum != (unsigned int) t))
+     {
+	for (j = num; j > i; j--)
+	  s[j] = s[j - 1];
+	s[i].linenum = (unsigned int) t;
+	s[i].offset = (i == 0) ? 0 : s[i - 1].offset;
+	idx->num_shifts = ++num;
+	i++;
+     }
+   for (j = i - 1; j < num; j++)
+     s[j].offset += delta;
+}
+
+/*}}}*/
+
+static void set_user_mark_linenum (User_Mark_Index_Type *idx, Mark *m, unsigned int n) /*{{{*/
+{
+   if ((idx->num_shifts != 0)
+       && (0 == (m->flags & MARK_LINENUM_CURRENT)))
+     {
+	if ((idx->num_current >= max_pending_shifts (idx))
+	    || ((idx->num_current == idx->max_current)
+		&& (-1 == grow_mark_array ((VOID_STAR *) &idx->current, &idx->max_current,
+					   sizeof (Mark *)))))
+	  {
+	     flush_mark_shifts (idx);
+	  }
+	else
+	  {
+	     idx->current[idx->num_current++] = m;
+	     m->flags |= MARK_LINENUM_CURRENT;
+	  }
+     }
+   m->n = n;
+}
+
+/*}}}*/
+
+static void forget_current_user_mark (User_Mark_Index_Type *idx, Mark *m) /*{{{*/
+{
+   unsigned int i;
+
+   for (i = 0; i < idx->num_current; i++)
+     {
+	if (idx->current[i] == m)
+	  {
+	     idx->current[i] = idx->current[--idx->num_current];
+	     break;
+	  }
+     }
+   m->flags &= ~MARK_LINENUM_CURRENT;
+}
+
+/*}}}*/
+
+static int grow_user_mark_table (User_Mark_Index_Type *idx) /*{{{*/
+{
+   Mark **old_table = idx->table;
+   unsigned int i, old_size = idx->table_size;
+
+   if (NULL == (idx->table = (Mark **) jed_malloc0 (2 * old_size * sizeof (Mark *))))
+     {
+	idx->table = old_table;
+	return -1;
+     }
+   idx->table_size = 2 * old_size;
+
+   for (i = 0; i < old_size; i++)
+     {
+	Mark *m = old_table[i];
+	while (m != NULL)
+	  {
+	     Mark *next = m->next;
+	     link_user_mark (idx, m);
+	     m = next;
+	  }
+     }
+   SLfree ((char *) old_table);
+   return 0;
+}
+
+/*}}}*/
+
+static User_Mark_Index_Type *get_user_mark_index (Buffer *b) /*{{{*/
+{
+   User_Mark_Index_Type *idx;
+
+   if (b->user_marks != NULL)
+     return b->user_marks;
+
+   if (NULL == (idx = (User_Mark_Index_Type *) jed_malloc0 (sizeof (User_Mark_Index_Type))))
+     return NULL;
+
+   if (NULL == (idx->table = (Mark **) jed_malloc0 (USER_MARK_TABLE_SIZE * sizeof (Mark *))))
+     {
+	SLfree ((char *) idx);
+	return NULL;
+     }
+   idx->table_size = USER_MARK_TABLE_SIZE;
+   b->user_marks = idx;
+   return idx;
+}
+
+/*}}}*/
+
+/* Remove the marks on line l that lie beyond point from the index, and
+ * return them as a list.
+ */
+static Mark *detach_user_marks (User_Mark_Index_Type *idx, Line *l, int point) /*{{{*/
+{
+   Mark **b = idx->table + hash_mark_line (idx, l);
+   Mark *list = NULL;
+
+   while (*b != NULL)
+     {
+	Mark *m = *b;
+
+	if ((m->line == l) && (m->point > point))
+	  {
+	     *b = m->next;
+	     m->next = list;
+	     list = m;
+	  }
+	else b = &m->next;
+     }
+   return list;
+}
+
+/*}}}*/
+
+/* Called by jed_update_marks for the user marks of b. */
+void jed_update_user_marks (Buffer *b, int type, unsigned int linenum, int n) /*{{{*/
+{
+   User_Mark_Index_Type *idx = b->user_marks;
+   Mark *m, *next, *moved;
+   Line *first;
+   unsigned int i;
+
+   switch (type)
+     {
+      case CINSERT:
+	m = idx->table[hash_mark_line (idx, CLine)];
+	for (; m != NULL; m = m->next)
+	  {
+	     if ((m->line == CLine) && (m->point > Point))
+	       m->point += n;
+	  }
+	break;
+
+      case CDELETE:
+	m = idx->table[hash_mark_line (idx, CLine)];
+	for (; m != NULL; m = m->next)
+	  {
+	     if ((m->line == CLine) && (m->point > Point))
+	       {
+		  int tmp = m->point - n;
+		  if (tmp < Point) tmp = Point;
+		  m->point = tmp;
+	       }
+	  }
+	break;
+
+      case LDELETE:
+	m = detach_user_marks (idx, CLine, -1);
+	for (; m != NULL; m = next)
+	  {
+	     next = m->next;
+	     m->line = (CLine->prev != NULL) ? CLine->prev : b->beg;
+	     m->point = 0;
+	     link_user_mark (idx, m);
+	  }
+	shift_user_marks (idx, linenum, -1);
+	break;
+
+      case NLDELETE:
+	/* deletion performed at end of a line (CLine->prev)  */
+	m = detach_user_marks (idx, CLine, -1);
+	for (; m != NULL; m = next)
+	  {
+	     next = m->next;
+	     m->line = CLine->prev;
+	     m->point += Point;
+	     link_user_mark (idx, m);
+	  }
+	shift_user_marks (idx, linenum, -1);
+	break;
+
+      case LINESDELETE:
+	/* This happens once for any number of lines, so simply bring all
+	 * of the marks up to date.  See linesdelete_update_marks.
+	 */
+	flush_mark_shifts (idx);
+	moved = NULL;
+	for (i = 0; i < idx->table_size; i++)
+	  {
+	     Mark **b = idx->table + i;
+	     while (NULL != (m = *b))
+	       {
+		  if (linenum <= m->n)
+		    {
+		       if (m->n < linenum + (unsigned int) n)
+			 {
+			    *b = m->next;
+			    m->next = moved;
+			    moved = m;
+			    continue;
+			 }
+		       m->n -= n;
+		    }
+		  b = &m->next;
+	       }
+	  }
+	for (m = moved; m != NULL; m = next)
+	  {
+	     next = m->next;
+	     m->line = CLine;
+	     m->point = 0;
+	     m->n = linenum;
+	     link_user_mark (idx, m);
+	  }
+	break;
+
+      case NLINSERT:
+	shift_user_marks (idx, linenum + 1, 1);
+	/* The marks that move to the new line are not covered by the shift.
+	 * Set their line numbers while they are still in the table, since
+	 * that may bring all of the marks in it up to date.
+	 */
+	m = idx->table[hash_mark_line (idx, CLine)];
+	for (; m != NULL; m = m->next)
+	  {
+	     if ((m->line == CLine) && (m->point > Point))
+	       set_user_mark_linenum (idx, m, linenum + 1);
+	  }
+	m = detach_user_marks (idx, CLine, Point);
+	for (; m != NULL; m = next)
+	  {
+	     next = m->next;
+	     m->line = CLine->next;
+	     m->point -= Point;
+	     if (m->point > m->line->len) m->point = m->line->len;
+	     link_user_mark (idx, m);
+	  }
+	break;
+
+      case LINESINSERT:
+	/* n lines were put above CLine, which was at line linenum - n.
+	 * The marks at its beginning stay in front of them.  See
+	 * linesinsert_update_marks.
+	 */
+	linenum -= n;
+	shift_user_marks (idx, linenum, n);
+	m = idx->table[hash_mark_line (idx, CLine)];
+	for (; m != NULL; m = m->next)
+	  {
+	     if ((m->line == CLine) && (m->point == 0))
+	       set_user_mark_linenum (idx, m, linenum);
+	  }
+	first = NULL;
+	m = detach_user_marks (idx, CLine, -1);
+	for (; m != NULL; m = next)
+	  {
+	     next = m->next;
+	     if (m->point == 0)
+	       {
+		  if (first == NULL)
+		    {
+		       first = CLine;
+		       for (i = 0; i < (unsigned int) n; i++) first = first->prev;
+		    }
+		  m->line = first;
+	       }
+	     link_user_mark (idx, m);
+	  }
+	break;
+     }
+}
+
+/*}}}*/
+
+/* Called by jed_replace_lines_above for the user marks of b.  Like the
+ * LINESDELETE case of jed_update_user_marks, this brings all of the marks
+ * up to date.
+ */
+void jed_map_user_marks (Buffer *b, Jed_Line_Map_Type *lm) /*{{{*/
+{
+   User_Mark_Index_Type *idx = b->user_marks;
+   Mark *m, *next, *moved;
+   unsigned int i;
+
+   flush_mark_shifts (idx);
+   moved = NULL;
+   for (i = 0; i < idx->table_size; i++)
+     {
+	Mark **bp = idx->table + i;
+	while (NULL != (m = *bp))
+	  {
+	     if (lm->linenum <= m->n)
+	       {
+		  if (m->n < lm->linenum + lm->num_lines)
+		    {
+		       *bp = m->next;
+		       m->next = moved;
+		       moved = m;
+		       continue;
+		    }
+		  m->n = m->n - lm->num_lines + lm->num_to;
+	       }
+	     bp = &m->next;
+	  }
+     }
+   for (m = moved; m != NULL; m = next)
+     {
+	next = m->next;
+	jed_map_mark (m, lm);
+	link_user_mark (idx, m);
+     }
+}
+
+/*}}}*/
+
+#if JED_HAS_LINE_MARKS
+Mark *jed_find_line_mark (Buffer *b, Line *l) /*{{{*/
+{
+   User_Mark_Index_Type *idx = b->user_marks;
+   Mark *m;
+
+   if (idx == NULL)
+     return NULL;
+
+   for (m = idx->table[hash_mark_line (idx, l)]; m != NULL; m = m->next)
+     {
+	if ((m->line == l) && (m->flags & JED_LINE_MARK))
+	  return m;
+     }
+   return NULL;
+}
+
+/*}}}*/
+#endif
+
+static unsigned int user_mark_linenum (User_Mark_Type *um) /*{{{*/
+{
+   if (um->m.flags & (MARK_INVALID|MARK_LINENUM_CURRENT))
+     return um->m.n;
+   return shifted_linenum (um->b->user_marks, um->m.n);
+}
+
+/*}}}*/
+
 static void free_user_mark (SLtype type, VOID_STAR um_alias) /*{{{*/
 {
-   Mark *m, *m1;
-   Buffer *b;
+   Mark *m1;
+   User_Mark_Index_Type *idx;
    User_Mark_Type *um;
 
    (void) type;
@@ -1117,19 +1663,16 @@ static void free_user_mark (SLtype type, VOID_STAR um_alias) /*{{{*/
     */
    if ((m1->flags & MARK_INVALID) == 0)
      {
-	/* Unlink the mark from the chain. */
-	b = um->b;
-	m = b->user_marks;
+	/* Remove the mark from the index. */
+	idx = um->b->user_marks;
 #if JED_HAS_LINE_MARKS
 	if (m1->flags & JED_LINE_MARK)
 	  touch_screen ();
 #endif
-	if (m == m1)	b->user_marks = m1->next;
-	else
-	  {
-	     while (m->next != m1) m = m->next;
-	     m->next = m1->next;
-	  }
+	unlink_user_mark (idx, m1);
+	if (m1->flags & MARK_LINENUM_CURRENT)
+	  forget_current_user_mark (idx, m1);
+	idx->num_marks--;
      }
 
    SLfree ((char *)um);
@@ -1139,13 +1682,27 @@ static void free_user_mark (SLtype type, VOID_STAR um_alias) /*{{{*/
 
 void free_user_marks (Buffer *b) /*{{{*/
 {
-   Mark *m = b->user_marks;
+   User_Mark_Index_Type *idx = b->user_marks;
+   unsigned int i;
 
-   while (m != NULL)
+   if (idx == NULL)
+     return;
+
+   for (i = 0; i < idx->table_size; i++)
      {
-	m->flags |= MARK_INVALID;
-	m = m->next;
+	Mark *m = idx->table[i];
+	while (m != NULL)
+	  {
+	     m->flags |= MARK_INVALID;
+	     m = m->next;
+	  }
      }
+
+   SLfree ((char *) idx->table);
+   if (idx->shifts != NULL) SLfree ((char *) idx->shifts);
+   if (idx->current != NULL) SLfree ((char *) idx->current);
+   SLfree ((char *) idx);
+   b->user_marks = NULL;
 }
 
 /*}}}*/
@@ -1200,9 +1757,14 @@ int jed_move_user_object_mark (SLang_MMT_Type *mmt) /*{{{*/
 	return 0;
      }
 
-   m->line = CLine;
+   if (m->line != CLine)
+     {
+	unlink_user_mark (CBuf->user_marks, m);
+	m->line = CLine;
+	link_user_mark (CBuf->user_marks, m);
+     }
    m->point = Point;
-   m->n = LineNum + CBuf->nup;
+   set_user_mark_linenum (CBuf->user_marks, m, LineNum + CBuf->nup);
    return 1;
 }
 
@@ -1232,7 +1794,12 @@ static int x_user_mark_fun (int (*xfun)(Mark *)) /*{{{*/
 
    if (CBuf != um->b) msg_error ("Mark not in buffer.");
    else
-     ret = (*xfun) (&um->m);
+     {
+	Mark m = um->m;
+
+	m.n = user_mark_linenum (um);
+	ret = (*xfun) (&m);
+     }
 
    SLang_free_mmt (mmt);
    return ret;
@@ -1259,10 +1826,18 @@ void goto_user_mark (void)
 
 SLang_MMT_Type *jed_make_user_object_mark (void) /*{{{*/
 {
+   User_Mark_Index_Type *idx;
    User_Mark_Type *um;
    SLang_MMT_Type *mmt;
    Mark *m;
 
+   if (NULL == (idx = get_user_mark_index (CBuf)))
+     return NULL;
+
+   /* Should this fail, the chains just get longer. */
+   if (idx->num_marks >= 2 * idx->table_size)
+     (void) grow_user_mark_table (idx);
+
    if (NULL == (um = (User_Mark_Type *) jed_malloc0 (sizeof(User_Mark_Type))))
      return NULL;
 
@@ -1275,10 +1850,10 @@ SLang_MMT_Type *jed_make_user_object_mark (void) /*{{{*/
    m = &um->m;
 
    jed_init_mark (m, 0);
+   set_user_mark_linenum (idx, m, m->n);
 
-   m->next = CBuf->user_marks;
-
-   CBuf->user_marks = m;
+   link_user_mark (idx, m);
+   idx->num_marks++;
 
    um->b = CBuf;
 
@@ -1378,7 +1953,7 @@ user_mark_bin_op (int op,
 	if ((*a != NULL)
 	    && (NULL != (ua = (User_Mark_Type *) SLang_object_from_mmt (*a))))
 	  {
-	     la = ua->m.n;
+	     la = user_mark_linenum (ua);
 	     pa = ua->m.point;
 	     ba = ua->b;
 	  }
@@ -1386,7 +1961,7 @@ user_mark_bin_op (int op,
 	if ((*b != NULL)
 	    && (NULL != (ub = (User_Mark_Type *) SLang_object_from_mmt (*b))))
 	  {
-	     lb = ub->m.n;
+	     lb = user_mark_linenum (ub);
 	     pb = ub->m.point;
 	     bb = ub->b;
 	  }
@@ -1505,11 +2080,289 @@ int register_jed_classes (void) /*{{{*/
    if (-1 == SLclass_add_binary_op (JED_MARK_TYPE, JED_MARK_TYPE, user_mark_bin_op, user_mark_bin_op_result))
      return -1;
 
-   return 0;
+   return jed_register_snapshot_class ();
+}
+
+/*}}}*/
+
+/*{{{ Sorting the lines of a region */
+
+typedef struct
+{
+   Line *line;
+   unsigned char *key;
+   unsigned int key_len;
+   double value;		       /* of the key for JED_SORT_NUMERIC */
+}
+Sort_Line_Type;
+
+static int compare_sort_lines (Sort_Line_Type *a, Sort_Line_Type *b, int flags) /*{{{*/
+{
+   int cmp;
+
+   if (flags & JED_SORT_NUMERIC)
+     cmp = (a->value > b->value) - (a->value < b->value);
+   else
+     {
+	unsigned int len = a->key_len;
+
+	if (len > b->key_len) len = b->key_len;
+	cmp = memcmp ((char *) a->key, (char *) b->key, len);
+	if (cmp == 0)
+	  cmp = (a->key_len > b->key_len) - (a->key_len < b->key_len);
+     }
+
+   if (flags & JED_SORT_REVERSE)
+     cmp = -cmp;
+   return cmp;
 }
 
 /*}}}*/
 
+/* A merge sort of the n pointers at a, which keeps lines with equal keys
+ * in their order.  tmp must have room for n / 2 pointers.
+ */
+static void merge_sort_lines (Sort_Line_Type **a, Sort_Line_Type **tmp, unsigned int n, int flags) /*{{{*/
+{
+   unsigned int n1, i, j, k;
+
+   if (n < 2)
+     return;
+
+   n1 = n / 2;
+   merge_sort_lines (a, tmp, n1, flags);
+   merge_sort_lines (a + n1, tmp, n - n1, flags);
+
+   if (compare_sort_lines (a[n1 - 1], a[n1], flags) <= 0)
+     return;
+
+   memcpy ((char *) tmp, (char *) a, n1 * sizeof (Sort_Line_Type *));
+   i = 0; j = n1; k = 0;
+   while ((i < n1) && (j < n))
+     {
+	if (compare_sort_lines (a[j], tmp[i], flags) < 0)
+	  a[k++] = a[j++];
+	else
+	  a[k++] = tmp[i++];
+     }
+   while (i < n1)
+     a[k++] = tmp[i++];
+}
+
+/*}}}*/
+
+/* The value of the decimal number that the len bytes at p start with, or
+ * 0 if they do not start with one.  Unlike atof, this does not need a
+ * terminating 0, and a '.' is the decimal point whatever the locale.
+ */
+static double sort_key_value (unsigned char *p, unsigned int len) /*{{{*/
+{
+   unsigned char *pmax = p + len, *digits;
+   double value = 0.0;
+   int sign = 1, expon = 0, esign = 1, e = 0;
+
+   while ((p < pmax) && ((*p == ' ') || (*p == '\t')))
+     p++;
+   if ((p < pmax) && ((*p == '-') || (*p == '+')))
+     {
+	if (*p == '-') sign = -1;
+	p++;
+     }
+   digits = p;
+   while ((p < pmax) && (*p >= '0') && (*p <= '9'))
+     value = 10.0 * value + (*p++ - '0');
+   if ((p < pmax) && (*p == '.'))
+     {
+	p++;
+	digits++;
+	while ((p < pmax) && (*p >= '0') && (*p <= '9'))
+	  {
+	     value = 10.0 * value + (*p++ - '0');
+	     expon--;
+	  }
+     }
+   if ((p == digits) || (value == 0.0))
+     return 0.0;
+   if ((p < pmax) && ((*p == 'e') || (*p == 'E')))
+     {
+	p++;
+	if ((p < pmax) && ((*p == '-') || (*p == '+')))
+	  {
+	     if (*p == '-') esign = -1;
+	     p++;
+	  }
+	while ((p < pmax) && (*p >= '0') && (*p <= '9'))
+	  {
+	     if (e < 1000) e = 10 * e + (*p - '0');
+	     p++;
+	  }
+	expon += esign * e;
+     }
+
+   /* Dividing by an exact power of 10 rounds better than multiplying by
+    * an inexact one.
+    */
+   if (expon < 0)
+     return sign * value / pow (10.0, (double) -expon);
+   return sign * value * pow (10.0, (double) expon);
+}
+
+/*}}}*/
+
+/* Find the key of the current line between columns begc and endc, or the
+ * end of the line if endc is not positive, as sort.sl used to.
+ */
+static void get_sort_key (Sort_Line_Type *sl, int begc, int endc, int flags) /*{{{*/
+{
+   int beg;
+
+   sl->line = CLine;
+   (void) goto_column1 (&begc);
+   beg = Point;
+   if (endc > 0) (void) goto_column1 (&endc);
+   else eol ();
+
+   sl->key = CLine->data + beg;
+   sl->key_len = (Point > beg) ? (unsigned int) (Point - beg) : 0;
+
+   sl->value = 0.0;
+   if (flags & JED_SORT_NUMERIC)
+     sl->value = sort_key_value (sl->key, sl->key_len);
+}
+
+/*}}}*/
+
+/* A copy of l that shares its data, or one that ends in a newline if l
+ * does not.
+ */
+static Line *copy_sort_line (Line *l) /*{{{*/
+{
+   unsigned char *buf;
+   Line *copy;
+
+   if (LINE_HAS_NEWLINE (l))
+     return dup_line (l);
+
+   if (NULL == (buf = (unsigned char *) SLmalloc (l->len + 1)))
+     return NULL;
+   memcpy ((char *) buf, (char *) l->data, l->len);
+   buf[l->len] = '\n';
+   copy = jed_create_line (buf, l->len + 1);
+   SLfree ((char *) buf);
+   return copy;
+}
+
+/*}}}*/
+
+/* Sort the whole lines of the region by the text from column begc up to
+ * column endc.  The sorted lines share the data of the old ones, and
+ * replace them in one splice.  The marks on a line move with it.
+ */
+void sort_region_lines (int *begcp, int *endcp, int *flagsp) /*{{{*/
+{
+   Sort_Line_Type *lines = NULL, **sorted = NULL, **tmp = NULL;
+   Line **to = NULL;
+   unsigned int *map = NULL;
+   unsigned int n, m, i;
+   int flags = *flagsp, status;
+
+   if (!check_region (&Number_Zero))
+     return;
+
+   /* The lines are replaced by copies, so read-only ones are refused here
+    * as del_region would refuse them.
+    */
+   if (-1 == jed_check_readonly_region ())
+     {
+	jed_pop_mark (0);
+	return;
+     }
+
+   n = jed_count_lines_in_region ();
+   jed_pop_mark (0);
+   if (n < 2)
+     return;
+
+   /* Do all of the allocations before anything in the buffer changes. */
+   if ((n > UINT_MAX / sizeof (Sort_Line_Type))
+       || (NULL == (lines = (Sort_Line_Type *) SLmalloc (n * sizeof (Sort_Line_Type))))
+       || (NULL == (sorted = (Sort_Line_Type **) SLmalloc (n * sizeof (Sort_Line_Type *))))
+       || (NULL == (tmp = (Sort_Line_Type **) SLmalloc ((n / 2 + 1) * sizeof (Sort_Line_Type *))))
+       || (NULL == (to = (Line **) SLmalloc (n * sizeof (Line *))))
+       || (NULL == (map = (unsigned int *) SLmalloc (n * sizeof (unsigned int)))))
+     goto the_return;
+
+   if (n - 1 != (unsigned int) jed_up (n - 1))
+     goto the_return;
+   for (i = 0; i < n; i++)
+     {
+	if (i) (void) jed_down (1);
+	get_sort_key (lines + i, *begcp, *endcp, flags);
+	sorted[i] = lines + i;
+     }
+
+   merge_sort_lines (sorted, tmp, n, flags);
+
+   /* A line dropped by JED_SORT_UNIQUE hands its marks to the line with
+    * the same key that is kept.
+    */
+   m = 0;
+   for (i = 0; i < n; i++)
+     {
+	if ((flags & JED_SORT_UNIQUE) && (m > 0)
+	    && (0 == compare_sort_lines (sorted[i], sorted[m - 1], flags)))
+	  {
+	     map[sorted[i] - lines] = m - 1;
+	     continue;
+	  }
+	map[sorted[i] - lines] = m;
+	sorted[m++] = sorted[i];
+     }
+
+   for (i = 0; i < m; i++)
+     {
+	if (NULL == (to[i] = copy_sort_line (sorted[i]->line)))
+	  {
+	     while (i > 0) free_line (to[--i]);
+	     goto the_return;
+	  }
+     }
+
+   /* Group the changes into one step of undo. */
+   mark_undo_boundary (CBuf);
+
+   /* The sorted lines go above the line after the region, so the last
+    * line needs a newline if it has none.
+    */
+   status = 0;
+   if (CLine->next == NULL)
+     {
+	eol ();
+	status = jed_insert_newline ();
+     }
+   else
+     {
+	(void) jed_down (1);
+	bol ();
+     }
+   if ((status == -1) || (-1 == jed_replace_lines_above (n, to, m, map)))
+     {
+	for (i = 0; i < m; i++) free_line (to[i]);
+     }
+   mark_undo_boundary (CBuf);
+
+   the_return:
+   SLfree ((char *) map);
+   SLfree ((char *) to);
+   SLfree ((char *) tmp);
+   SLfree ((char *) sorted);
+   SLfree ((char *) lines);
+}
+
+/*}}}*/
+
+/*}}}*/
+
 void jed_widen_whole_buffer (Buffer *b) /*{{{*/
 {
    while (b->narrow != NULL) widen_buffer (b);
@@ -1517,7 +2370,137 @@ void jed_widen_whole_buffer (Buffer *b) /*{{{*/
 
 /*}}}*/
 
+/* The lines of CBuf visible at a level of narrowing.  The levels are
+ * visited from the innermost outwards, each found from the Narrow_Type of
+ * the one inside it, so nothing has to be widened or counted.
+ */
+typedef struct
+{
+   Narrow_Type *narrow;		       /* the narrow hiding the rest */
+   Line *beg, *end;
+   unsigned int nup;		       /* lines of the buffer above beg */
+   unsigned int num_lines;
+}
+Narrow_Level_Type;
+
+static void first_narrow_level (Narrow_Level_Type *lv) /*{{{*/
+{
+   lv->narrow = CBuf->narrow;
+   lv->beg = CBuf->beg;
+   lv->end = CBuf->end;
+   lv->nup = CBuf->nup;
+   lv->num_lines = Max_LineNum;
+}
+
+/*}}}*/
+
+static void next_narrow_level (Narrow_Level_Type *lv) /*{{{*/
+{
+   Narrow_Type *n = lv->narrow;
+
+   if (n->beg != NULL) lv->beg = n->beg1;
+   if (n->end != NULL) lv->end = n->end1;
+   lv->nup -= n->nup;
+   lv->num_lines += n->nup + n->ndown;
+   lv->narrow = n->next;
+}
+
+/*}}}*/
+
+/* Link the lines hidden by the narrows of CBuf back onto the visible ones
+ * for code that only walks the lines.  As widen_buffer_lines would, the
+ * last line of each narrow gets its newline back, so that no two lines run
+ * together.  Nothing else about the buffer changes: point, marks and line
+ * numbers stay relative to the narrow, and jed_split_narrowed_lines must
+ * be called before anything else is done with it.  Returns the first line
+ * of the whole buffer.
+ */
+Line *jed_join_narrowed_lines (void) /*{{{*/
+{
+   Narrow_Level_Type lv;
+
+   first_narrow_level (&lv);
+   while (lv.narrow != NULL)
+     {
+	Narrow_Type *n = lv.narrow;
+
+	if (n->beg != NULL)
+	  {
+	     n->beg->next = lv.beg;
+	     lv.beg->prev = n->beg;
+	  }
+	n->newline_shown = 0;
+	if (n->end != NULL)
+	  {
+	     n->end->prev = lv.end;
+	     lv.end->next = n->end;
+	     if ((0 == LINE_HAS_NEWLINE (lv.end))
+		 && (0 == jed_show_hidden_newline (lv.end)))
+	       n->newline_shown = 1;
+	  }
+	next_narrow_level (&lv);
+     }
+   return lv.beg;
+}
+
+/*}}}*/
+
+void jed_split_narrowed_lines (void) /*{{{*/
+{
+   Narrow_Level_Type lv;
+
+   first_narrow_level (&lv);
+   while (lv.narrow != NULL)
+     {
+	if (lv.narrow->beg != NULL) lv.beg->prev = NULL;
+	if (lv.narrow->end != NULL) lv.end->next = NULL;
+	if (lv.narrow->newline_shown) lv.end->len--;
+	next_narrow_level (&lv);
+     }
+}
+
+/*}}}*/
+
 #if JED_HAS_SAVE_NARROW
+/* Returns non-zero if CBuf is narrowed just as save_narrow says. */
+static int is_narrow_saved (Jed_Save_Narrow_Type *save_narrow) /*{{{*/
+{
+   Narrow_Level_Type lv;
+   Mark *beg, *end;
+   int i, depth, point;
+
+   depth = 0;
+   for (beg = save_narrow->beg; beg != NULL; beg = beg->next)
+     depth++;
+   if (depth != jed_count_narrows ())
+     return 0;
+
+   /* The marks run from the outermost level in. */
+   first_narrow_level (&lv);
+   while (depth-- > 0)
+     {
+	beg = save_narrow->beg;
+	end = save_narrow->end;
+	for (i = 0; i < depth; i++)
+	  {
+	     beg = beg->next;
+	     end = end->next;
+	  }
+
+	point = lv.end->len;
+	if (LINE_HAS_NEWLINE (lv.end)) point--;
+	if ((beg->line != lv.beg) || (beg->point != 0)
+	    || (end->line != lv.end) || (end->point != point)
+	    || ((0 == (end->flags & NARROW_REGION_MARK)) == (lv.narrow->is_region != 0)))
+	  return 0;
+
+	next_narrow_level (&lv);
+     }
+   return 1;
+}
+
+/*}}}*/
+
 static void restore_saved_narrow (void) /*{{{*/
 {
    Mark *beg, *end;
@@ -1527,6 +2510,9 @@ static void restore_saved_narrow (void) /*{{{*/
    if (NULL == (save_narrow = CBuf->save_narrow))
      return;
 
+   if (is_narrow_saved (save_narrow))
+     return;
+
    push_spot ();
    /* remove current restriction */
    jed_widen_whole_buffer (CBuf);
@@ -1581,6 +2567,7 @@ void jed_free_saved_narrow (Buffer *b) /*{{{*/
 void jed_push_narrow (void) /*{{{*/
 {
    Jed_Save_Narrow_Type *save_narrow;
+   Narrow_Level_Type lv;
 
    if (NULL == (save_narrow = (Jed_Save_Narrow_Type *) jed_malloc0 (sizeof (Jed_Save_Narrow_Type))))
      {
@@ -1590,30 +2577,30 @@ void jed_push_narrow (void) /*{{{*/
    save_narrow->next = CBuf->save_narrow;
    CBuf->save_narrow = save_narrow;
 
-   push_spot ();
-   while (CBuf->narrow != NULL)
+   /* Mark the beginning and end of each level, as bob and eob would. */
+   first_narrow_level (&lv);
+   while (lv.narrow != NULL)
      {
 	Mark *m;
+	int point;
 
-	bob ();
-	m = create_mark (0);
+	m = create_mark (lv.beg, 0, lv.nup + 1, 0);
 	m->next = save_narrow->beg;
 	save_narrow->beg = m;
 
-	eob ();
-	m = create_mark (CBuf->narrow->is_region ? NARROW_REGION_MARK : 0);
+	point = lv.end->len;
+	if (LINE_HAS_NEWLINE (lv.end)) point--;
+	m = create_mark (lv.end, point, lv.nup + lv.num_lines,
+			 lv.narrow->is_region ? NARROW_REGION_MARK : 0);
 	m->next = save_narrow->end;
 	save_narrow->end = m;
 
-	widen_buffer (CBuf);
+	next_narrow_level (&lv);
      }
-
-   restore_saved_narrow ();
-
-   pop_spot ();
 }
 
 /*}}}*/
+
 void jed_pop_narrow (void) /*{{{*/
 {
    restore_saved_narrow ();
@@ -18,6 +18,8 @@ extern int widen_region (void);
 extern int narrow_to_region (void);
 extern int narrow_to_lines (void);
 extern void jed_widen_whole_buffer (Buffer *);
+extern Line *jed_join_narrowed_lines (void);
+extern void jed_split_narrowed_lines (void);
 extern void jed_init_mark (Mark *, unsigned int);
 extern void jed_init_mark_for_buffer (Mark *, Buffer *, unsigned int);
 extern int jed_init_mark_for_line (Mark *, Line *, unsigned int);
@@ -29,6 +31,11 @@ extern void jed_push_narrow (void);
 extern void jed_pop_narrow (void);
 #endif
 extern int jed_count_narrows (void);
+
+#define JED_SORT_NUMERIC	0x01
+#define JED_SORT_REVERSE	0x02
+#define JED_SORT_UNIQUE		0x04
+extern void sort_region_lines (int *, int *, int *);
 extern int exchange_point_mark(void);
 extern int yank(void);
 extern int check_region(int *);
@@ -45,6 +52,8 @@ extern int copy_rectangle(void);
 extern void goto_user_mark (void);
 extern void create_user_mark (void);
 extern void free_user_marks (Buffer *);
+extern void jed_update_user_marks (Buffer *, int, unsigned int, int);
+extern void jed_map_user_marks (Buffer *, Jed_Line_Map_Type *);
 extern void move_user_mark (void);
 extern int jed_is_user_mark_in_narrow (void);
 extern int jed_move_user_object_mark (SLang_MMT_Type *);
@@ -54,6 +63,7 @@ extern int register_jed_classes (void);
 
 #if JED_HAS_LINE_MARKS
 extern void jed_create_line_mark (int *);
+extern Mark *jed_find_line_mark (Buffer *, Line *);
 #endif
 
 extern unsigned int jed_count_lines_in_region (void);
@@ -35,6 +35,7 @@
 #include "version.h"
 #include "indent.h"
 #include "colors.h"
+#include "vterm.h"
 
 #if JED_HAS_SUBPROCESSES
 # include "jprocess.h"
@@ -52,6 +53,15 @@ typedef struct Screen_Type
    Line *line;		       /* buffer line structure */
    int is_modified;
    unsigned char *hi0, *hi1;	       /* beg end of hilights */
+#if JED_HAS_DISPLAY_LINE_NUMBERS
+   unsigned int gutter_num;	       /* number in the gutter, 0 if unknown */
+#endif
+#if JED_HAS_SOFT_WRAP
+   int wrap_row;		       /* row of a wrapped line, or -1 */
+#endif
+#if JED_HAS_LINE_ATTRIBUTES
+   unsigned int syntax_bits;	       /* syntax state the row was drawn with */
+#endif
 }
 Screen_Type;
 
@@ -113,7 +123,382 @@ static Line Eob_Line =
 #endif
 };
 
-static void display_line (Line *line, int sy, int sx)
+/* Return the line before l that is not hidden, and subtract the number of
+ * lines moved over from *np.
+ */
+static Line *prev_shown_line (Line *l, unsigned int *np)
+{
+#if JED_HAS_LINE_ATTRIBUTES
+   do
+     {
+	l = l->prev;
+	(*np)--;
+     }
+   while ((l != NULL) && (l->flags & JED_LINE_HIDDEN));
+#else
+   l = l->prev;
+   (*np)--;
+#endif
+   return l;
+}
+
+#if JED_HAS_SOFT_WRAP
+/* Soft wrap: a line that is wider than the window is continued on the
+ * following screen rows.  Each row of the line is drawn by display_line as
+ * if the line were scrolled horizontally to the column where the row
+ * starts, so that tabs and highlighting come out the same as for an
+ * unwrapped line.  A row ends before a character that would cross the edge
+ * of the window, such as a tab or a double width character, and that
+ * character starts the next row.  The window may start partway through a
+ * line that is taller than the window; JWindow->wrap_top_row is the first
+ * row of JWindow->beg.line that is shown.
+ *
+ * The number of rows that a line needs is kept in a small hash table per
+ * window so that find_top, recenter and the paging commands can work in
+ * screen rows without measuring the same lines over and over.  An entry is
+ * dropped by register_change when its line changes, and it is also checked
+ * against the line's data pointer and length.  The whole table is reset
+ * when the window width, the tab width, or the buffer changes.
+ */
+#define WRAP_CACHE_SIZE		512    /* power of 2 */
+#define WRAP_CACHE_HASH(l) \
+   ((unsigned int) (((unsigned long) (l)) >> 4) & (WRAP_CACHE_SIZE - 1))
+
+typedef struct
+{
+   Line *line;
+   unsigned char *data;
+   int len;
+   unsigned int rows;
+}
+Wrap_Cache_Entry_Type;
+
+typedef struct Wrap_Cache_Type
+{
+   Buffer *buffer;
+   int width;
+   int tab;
+   Wrap_Cache_Entry_Type entries[WRAP_CACHE_SIZE];
+}
+Wrap_Cache_Type;
+
+static int window_wraps (void)
+{
+   return (CBuf->soft_wrap
+	   && (CBuf == JWindow->buffer)
+	   && (0 == IN_MINI_WINDOW));
+}
+
+static int wrap_width (void)
+{
+   int width = JWindow->width;
+#if JED_HAS_DISPLAY_LINE_NUMBERS
+   width -= CBuf->line_num_display_size;
+#endif
+   if (width < 1)
+     width = 1;
+   return width;
+}
+
+typedef struct
+{
+   int col;			       /* column to find the row of, or -1 */
+   int row;			       /* the row, if col is -1 */
+   int start;			       /* column where the row starts */
+   int next;			       /* where the next row starts, or -1 */
+}
+Wrap_Row_Type;
+
+static void init_smg_for_buffer (int *, int *);
+
+static void wrap_note_row (Wrap_Row_Type *r, int row, int col)
+{
+   if (r == NULL)
+     return;
+
+   if (r->col >= 0)
+     {
+	if (col <= r->col)
+	  {
+	     r->row = row;
+	     r->start = col;
+	     r->next = -1;
+	  }
+	else if (r->next == -1)
+	  r->next = col;
+     }
+   else if (row == r->row)
+     r->start = col;
+   else if (row == r->row + 1)
+     r->next = col;
+}
+
+/* Break the line into rows of at most width columns and return the number
+ * of rows.  A line that exactly fills its last row gets an extra row for
+ * the cursor at the end of the line.  If r is not NULL, the row holding the
+ * column r->col, or the row r->row if r->col is -1, is described in *r.
+ */
+static unsigned int wrap_line_layout (Line *line, int width, Wrap_Row_Type *r)
+{
+   unsigned char *p, *pmax;
+   unsigned int nrows;
+   int col, start, srow, scol;
+
+   p = line->data;
+   pmax = p + line->len;
+   if ((pmax > p) && (pmax[-1] == '\n'))
+     pmax--;
+
+   if (r != NULL)
+     {
+	r->start = r->next = -1;
+	if (r->col >= 0)
+	  r->row = 0;
+     }
+   wrap_note_row (r, 0, 0);
+
+   init_smg_for_buffer (&srow, &scol);
+   nrows = 1;
+   col = start = 0;
+   while (p < pmax)
+     {
+	unsigned char *q = jed_multibyte_chars_forward (p, pmax, 1, NULL, 1);
+	int w;
+
+	if ((*p == '\t') && (SLsmg_Tab_Width > 0))
+	  w = SLsmg_Tab_Width - col % SLsmg_Tab_Width;
+	else
+	  w = (int) SLsmg_strwidth (p, q);
+
+	if ((col > start) && (col + w > start + width))
+	  {
+	     start = col;
+	     wrap_note_row (r, (int) nrows++, col);
+	  }
+	col += w;
+	p = q;
+     }
+   if (col >= start + width)
+     wrap_note_row (r, (int) nrows++, col);
+   SLsmg_gotorc (srow, scol);
+
+   /* A row past the end shows nothing */
+   if ((r != NULL) && (r->start < 0))
+     r->start = col;
+   return nrows;
+}
+
+static unsigned int wrap_line_rows (Line *line)
+{
+   Wrap_Cache_Type *c = JWindow->wrap_cache;
+   Wrap_Cache_Entry_Type *e;
+   int width = wrap_width ();
+
+   if ((c == NULL) || (c->buffer != CBuf)
+       || (c->width != width) || (c->tab != Buffer_Local.tab))
+     {
+	if ((c == NULL)
+	    && (NULL == (c = (Wrap_Cache_Type *) SLmalloc (sizeof (Wrap_Cache_Type)))))
+	  {
+	     SLang_set_error (0);
+	     return wrap_line_layout (line, width, NULL);
+	  }
+	memset ((char *) c, 0, sizeof (Wrap_Cache_Type));
+	c->buffer = CBuf;
+	c->width = width;
+	c->tab = Buffer_Local.tab;
+	JWindow->wrap_cache = c;
+     }
+
+   e = c->entries + WRAP_CACHE_HASH(line);
+   if ((e->line == line) && (e->data == line->data) && (e->len == line->len))
+     return e->rows;
+
+   e->line = line;
+   e->data = line->data;
+   e->len = line->len;
+   e->rows = wrap_line_layout (line, width, NULL);
+   return e->rows;
+}
+
+static void wrap_cache_forget_line (Line *line)
+{
+   Window_Type *w = JWindow;
+
+   do
+     {
+	Wrap_Cache_Type *c = w->wrap_cache;
+	if ((c != NULL) && (w->buffer == CBuf))
+	  {
+	     Wrap_Cache_Entry_Type *e = c->entries + WRAP_CACHE_HASH(line);
+	     if (e->line == line)
+	       e->line = NULL;
+	  }
+	w = w->next;
+     }
+   while (w != JWindow);
+}
+
+/* The row of the current line that holds the cursor */
+static int cursor_wrap_row (Line *cline)
+{
+   Wrap_Row_Type r;
+
+   if (cline != CLine)
+     return 0;
+
+   r.col = jed_compute_effective_length (CLine->data, CLine->data + Point);
+   (void) wrap_line_layout (cline, wrap_width (), &r);
+   return r.row;
+}
+
+static Line *wrap_next_line (Line *l)
+{
+#if JED_HAS_LINE_ATTRIBUTES
+   do
+     {
+	l = l->next;
+     }
+   while ((l != NULL) && (l->flags & JED_LINE_HIDDEN));
+#else
+   l = l->next;
+#endif
+   return l;
+}
+
+/* The first row of a line at the top of the window, if the cursor is on
+ * its row `row' and ought to be n rows down.  Only a line that is taller
+ * than the window starts partway through.
+ */
+static int wrap_top_row (int row, int n)
+{
+   if (row < JWindow->rows)
+     return 0;
+   if (n >= JWindow->rows)
+     n = JWindow->rows - 1;
+   if (n < 0)
+     n = 0;
+   return row - n;
+}
+
+/* Find the line to put at the top of the window such that row `row' of the
+ * line l is about n rows below the top.  The first row of it to show goes
+ * to *top_rowp.  *nump holds the number of l, and is changed to that of
+ * the top.
+ */
+static Line *wrap_find_top_above (Line *l, int row, int n,
+				  int *top_rowp, unsigned int *nump)
+{
+   int nrows = n - row;
+
+   *top_rowp = wrap_top_row (row, n);
+   while (nrows > 0)
+     {
+	unsigned int num = *nump;
+	Line *prev = prev_shown_line (l, &num);
+	int rows;
+
+	if (prev == NULL)
+	  break;
+	rows = (int) wrap_line_rows (prev);
+	if (rows > nrows)
+	  break;
+	nrows -= rows;
+	l = prev;
+	*nump = num;
+     }
+   return l;
+}
+
+static Line *wrap_find_top_to_recenter (Line *cline, int *top_rowp,
+					unsigned int *nump)
+{
+   return wrap_find_top_above (cline, cursor_wrap_row (cline),
+			       JWindow->rows / 2, top_rowp, nump);
+}
+
+/* Like find_top, for a window that wraps.  *nump holds the number of cline,
+ * and is changed to that of the top.
+ */
+static Line *wrap_find_top (Line *cline, int *top_rowp, unsigned int *nump)
+{
+   int nrows = JWindow->rows;
+   int used, cursor_row, top_row;
+   unsigned int num;
+   Line *top_window_line, *prev, *next;
+
+   top_window_line = JScreen [JWindow->sy].line;
+   if (top_window_line == NULL)
+     return wrap_find_top_to_recenter (cline, top_rowp, nump);
+   top_row = JScreen [JWindow->sy].wrap_row;
+   if (top_row < 0)
+     top_row = 0;
+
+   cursor_row = cursor_wrap_row (cline);
+
+   /* Still in the window, or moved up or down within a line that is taller
+    * than the window at the top?
+    */
+   if (cline == top_window_line)
+     {
+	if (cursor_row < top_row)
+	  *top_rowp = cursor_row;
+	else if (cursor_row >= top_row + nrows)
+	  *top_rowp = cursor_row - nrows + 1;
+	else
+	  *top_rowp = top_row;
+	return cline;
+     }
+
+   used = cursor_row + 1;
+   prev = cline;
+   num = *nump;
+   while ((prev != NULL) && (used <= nrows + top_row))
+     {
+	prev = prev_shown_line (prev, &num);
+	if (prev == NULL)
+	  break;
+	used += (int) wrap_line_rows (prev);
+	if (prev == top_window_line)
+	  {
+	     if (used - top_row <= nrows)
+	       {
+		  *top_rowp = top_row;
+		  *nump = num;
+		  return prev;
+	       }
+	     break;
+	  }
+     }
+
+   if ((*tt_Term_Cannot_Scroll)
+       && (*tt_Term_Cannot_Scroll != -1))
+     return wrap_find_top_to_recenter (cline, top_rowp, nump);
+
+   /* Just above the window */
+   next = wrap_next_line (cline);
+   if ((next != NULL) && (next == top_window_line) && (top_row == 0))
+     {
+	*top_rowp = wrap_top_row (cursor_row, 0);
+	return cline;
+     }
+
+   /* Just below the window: scroll it onto the last row */
+   num = *nump;
+   prev = prev_shown_line (cline, &num);
+   top_window_line = JScreen [nrows + JWindow->sy - 1].line;
+   if ((top_window_line != NULL)
+       && ((prev == top_window_line) || (cline == top_window_line)))
+     return wrap_find_top_above (cline, cursor_row, nrows - 1, top_rowp, nump);
+
+   return wrap_find_top_to_recenter (cline, top_rowp, nump);
+}
+
+/* The first row of the line returned by find_top to show */
+static int Find_Top_Row;
+#endif				       /* JED_HAS_SOFT_WRAP */
+
+static void display_line (Line *line, int sy, int sx, int wrap_row)
 {
    unsigned int len;
    int hscroll_col;
@@ -124,6 +509,9 @@ static void display_line (Line *line, int sy, int sx)
 #endif
    int num_columns;
    int color_set;
+#if JED_HAS_SOFT_WRAP
+   int wrap_end_col = -1;
+#endif
 
    SLsmg_Tab_Width = Buffer_Local.tab;
    (void) SLsmg_embedded_escape_mode (CBuf->flags & SMG_EMBEDDED_ESCAPE);
@@ -136,6 +524,17 @@ static void display_line (Line *line, int sy, int sx)
 
    s->line = line;
    s->is_modified = 0;
+#if JED_HAS_DISPLAY_LINE_NUMBERS
+   s->gutter_num = 0;
+#endif
+#if JED_HAS_SOFT_WRAP
+   s->wrap_row = wrap_row;
+#else
+   (void) wrap_row;
+#endif
+#if JED_HAS_LINE_ATTRIBUTES
+   s->syntax_bits = (line == NULL) ? 0 : (line->flags & JED_LINE_SYNTAX_BITS);
+#endif
 
    if (line == NULL)
      {
@@ -149,6 +548,19 @@ static void display_line (Line *line, int sy, int sx)
        && Wants_HScroll && HScroll)
      hscroll_col += HScroll;
 
+#if JED_HAS_SOFT_WRAP
+   if (wrap_row >= 0)
+     {
+	Wrap_Row_Type r;
+
+	r.col = -1;
+	r.row = wrap_row;
+	(void) wrap_line_layout (line, wrap_width (), &r);
+	hscroll_col = r.start;
+	wrap_end_col = r.next;
+     }
+#endif
+
    num_columns = JWindow->width;
 
    if (hscroll_col || sx
@@ -197,17 +609,11 @@ static void display_line (Line *line, int sy, int sx)
 	/* ndc: line selection mode -- end */
 
 #if JED_HAS_LINE_MARKS
-   line_marks = CBuf->user_marks;
-   if (color_set == 0) while (line_marks != NULL)
+   if ((color_set == 0)
+       && (NULL != (line_marks = jed_find_line_mark (CBuf, line))))
      {
-	if ((line_marks->line == line)
-	    && (line_marks->flags & JED_LINE_MARK))
-	  {
-	     SLsmg_set_color (line_marks->flags & MARK_COLOR_MASK);
-	     color_set = 1;
-	     break;
-	  }
-	line_marks = line_marks->next;
+	SLsmg_set_color (line_marks->flags & MARK_COLOR_MASK);
+	color_set = 1;
      }
 #endif
 
@@ -267,7 +673,11 @@ static void display_line (Line *line, int sy, int sx)
 #endif
    SLsmg_erase_eol ();
 
-   if (Jed_Dollar)
+   if (Jed_Dollar
+#if JED_HAS_SOFT_WRAP
+       && (wrap_row < 0)
+#endif
+      )
      {
 	char dollar = (char) Jed_Dollar;
 
@@ -343,6 +753,16 @@ static void display_line (Line *line, int sy, int sx)
 		}
 /*	 ndc: column selection -- end */
 
+#if JED_HAS_SOFT_WRAP
+   /* Blank out what belongs to the next row, e.g., a tab that did not fit */
+   if (wrap_end_col >= 0)
+     {
+	SLsmg_set_color (0);
+	SLsmg_gotorc (sy, wrap_end_col);
+	SLsmg_erase_eol ();
+     }
+#endif
+
 	/* if (hscroll_col + sx) */
    SLsmg_set_screen_start (NULL, NULL);
 
@@ -350,49 +770,106 @@ static void display_line (Line *line, int sy, int sx)
 }
 
 #if JED_HAS_DISPLAY_LINE_NUMBERS
-static void display_line_numbers (void)
+/* The line number of the top of the window is kept in JWindow->beg.n.
+ * The mark is patched by jed_update_marks when lines are inserted or
+ * deleted above it, and find_top counts the lines it moves the top by, so
+ * the number is never looked for by walking the buffer.  Each screen row
+ * remembers the number that is in its gutter so that only the rows whose
+ * numbers changed get rewritten.  In relative mode, the gutter of the
+ * current line shows the absolute line number.
+ */
+#define GUTTER_BLANK		((unsigned int) -1)
+
+static Line *Gutter_Line;	       /* CLine when the gutter was drawn */
+static Window_Type *Gutter_Window;
+
+static void write_gutter (int row, unsigned int num)
 {
-   unsigned int i, imin, imax, linenum;
-   Line *line_start, *line;
+   Screen_Type *s = JScreen + row;
    char buf[32];
-   unsigned int c;
+   int size = CBuf->line_num_display_size;
 
-   imin = JWindow->sy;
-   imax = imin + JWindow->rows;
-   line = NULL;
+   if (s->gutter_num == num)
+     return;
+   s->gutter_num = num;
 
-   for (i = imin; i < imax; i++)
+   if (num == GUTTER_BLANK)
      {
-	if (JScreen[i].line != CLine)
-	  continue;
-
-	line = JScreen[i].line;
-	break;
+	memset (buf, ' ', size);
+	buf[size] = 0;
      }
-   if (line == NULL)
-     return;			       /* ??? */
+   else sprintf (buf, "%*u ", size - 1, num);
 
-   line_start = JScreen[imin].line;
-   linenum = LineNum + CBuf->nup;
+   SLsmg_gotorc (row, JWindow->sx);
+   SLsmg_write_string (buf);
+}
 
-   while (line != line_start)
-     {
-	if (line == NULL)
-	  return;		       /* ??? */
+static void display_line_numbers (void)
+{
+   unsigned int i, imin, imax, base, linenum, cline_num;
+   Line *top, *line, *line_start;
+   int relative = CBuf->line_num_relative;
+
+   imin = JWindow->sy;
+   imax = imin + JWindow->rows;
 
-	linenum--;
-	line = line->prev;
+   top = JScreen[imin].line;
+   if (top == NULL)
+     return;			       /* ??? */
+
+   /* The current line is always in the window.  Use it to verify the
+    * cached number before anything is written.
+    */
+   cline_num = LineNum + CBuf->nup;
+   base = (top == JWindow->beg.line) ? JWindow->beg.n : cline_num;
+   linenum = base;
+   line = top;
+   for (i = imin; i < imax; i++)
+     {
+	line_start = JScreen[i].line;
+	if (line_start == NULL)
+	  break;
+#if JED_HAS_SOFT_WRAP
+	if (JScreen[i].wrap_row > 0)
+	  continue;		       /* more of the previous line */
+#endif
+	while (line != line_start)
+	  {
+	     if (line == NULL)
+	       return;		       /* ??? */
+	     linenum++;
+	     line = line->next;
+	  }
+	if (line == CLine)
+	  {
+	     base += cline_num - linenum;
+	     break;
+	  }
+	line = line->next;
+	linenum++;
      }
+   if (top == JWindow->beg.line)
+     JWindow->beg.n = base;
 
    SLsmg_set_color (JLINENUM_COLOR);
-   c = JWindow->sx;
 
+   line = top;
+   linenum = base;
    for (i = imin; i < imax; i++)
      {
+	unsigned int num;
+
 	line_start = JScreen[i].line;
 	if (line_start == NULL)
 	  break;
 
+#if JED_HAS_SOFT_WRAP
+	if (JScreen[i].wrap_row > 0)
+	  {
+	     write_gutter (i, GUTTER_BLANK);
+	     continue;
+	  }
+#endif
         while (line != line_start)
 	  {
 	     if (line == NULL)
@@ -402,36 +879,35 @@ static void display_line_numbers (void)
 	     line = line->next;
 	  }
 
-	SLsmg_gotorc (i, c);
-	sprintf (buf, "%*u ", CBuf->line_num_display_size-1, linenum);
-	SLsmg_write_string (buf);
+	num = linenum;
+	if (relative && (line != CLine))
+	  num = (linenum > cline_num) ? linenum - cline_num : cline_num - linenum;
+
+	write_gutter (i, num);
 
 	line = line->next;
 	linenum++;
      }
 
-   if (i < imax)
-     {
-	memset (buf, ' ', CBuf->line_num_display_size);
-	buf[CBuf->line_num_display_size] = 0;
-
-	while (i < imax)
-	  {
-	     SLsmg_gotorc (i, c);
-	     SLsmg_write_string (buf);
-	     i++;
-	  }
-     }
+   while (i < imax)
+     write_gutter (i++, GUTTER_BLANK);
 
+   Gutter_Line = CLine;
+   Gutter_Window = JWindow;
    SLsmg_set_color (0);
 }
 #endif
 
 #if JED_HAS_LINE_ATTRIBUTES
-static Line *find_non_hidden_line (Line *l, int *non_hidden_pointp)
+/* If linenump is not NULL, it holds the number of l, which is changed to
+ * that of the line that is returned.
+ */
+static Line *find_non_hidden_line (Line *l, int *non_hidden_pointp,
+				   unsigned int *linenump)
 {
    int dir;
    Line *cline;
+   unsigned int n;
 
    if (non_hidden_pointp != NULL) *non_hidden_pointp = 0;
 
@@ -441,24 +917,38 @@ static Line *find_non_hidden_line (Line *l, int *non_hidden_pointp)
      }
 
    cline = l;
+   n = 0;
 
    dir = 1;
    while ((cline != NULL)
 	  && (cline->flags & JED_LINE_HIDDEN))
-     cline = cline->prev;
+     {
+	cline = cline->prev;
+	n++;
+     }
 
    if (cline == NULL)
      {
 	cline = l;
+	n = 0;
 	dir = -1;
 	while ((cline != NULL)
 	       && (cline->flags & JED_LINE_HIDDEN))
-	  cline = cline->next;
+	  {
+	     cline = cline->next;
+	     n++;
+	  }
 
 	if (cline == NULL)
 	  return NULL;
      }
 
+   if (linenump != NULL)
+     {
+	if (dir == 1) *linenump -= n;
+	else *linenump += n;
+     }
+
    if ((dir == 1)
        && (non_hidden_pointp != NULL))
      *non_hidden_pointp = cline->len;
@@ -468,49 +958,78 @@ static Line *find_non_hidden_line (Line *l, int *non_hidden_pointp)
 
 #endif
 
-Line *jed_find_top_to_recenter (Line *cline)
+/* The number of the line returned by find_top */
+static unsigned int Find_Top_Line_Num;
+
+/* Find the line to put at the top of the window to center cline, whose
+ * number is cline_num.  The number of the top goes to Find_Top_Line_Num.
+ */
+static Line *find_top_to_recenter (Line *cline, unsigned int cline_num)
 {
    int n;
+   unsigned int num, last_num;
    Line *prev, *last_prev;
 
+#if JED_HAS_SOFT_WRAP
+   Find_Top_Row = 0;
+   if (window_wraps ())
+     {
+	Find_Top_Line_Num = cline_num;
+	return wrap_find_top_to_recenter (cline, &Find_Top_Row, &Find_Top_Line_Num);
+     }
+#endif
+
    n = JWindow->rows / 2;
 
    last_prev = prev = cline;
+   last_num = num = cline_num;
 
    while ((n > 0) && (prev != NULL))
      {
 	n--;
 	last_prev = prev;
-#if JED_HAS_LINE_ATTRIBUTES
-	do
-	  {
-	     prev = prev->prev;
-	  }
-	while ((prev != NULL)
-	       && (prev->flags & JED_LINE_HIDDEN));
-#else
-	prev = prev->prev;
-#endif
+	last_num = num;
+	prev = prev_shown_line (prev, &num);
      }
 
-   if (prev != NULL) return prev;
+   if (prev != NULL)
+     {
+	Find_Top_Line_Num = num;
+	return prev;
+     }
+   Find_Top_Line_Num = last_num;
    return last_prev;
 }
 
+Line *jed_find_top_to_recenter (Line *cline)
+{
+   return find_top_to_recenter (cline, 0);
+}
+
 Line *find_top (void)
 {
    int nrows, i;
+   unsigned int cline_num, num;
    Line *cline, *prev, *next;
    Line *top_window_line;
 
    cline = CLine;
+   cline_num = LineNum + CBuf->nup;
 
 #if JED_HAS_LINE_ATTRIBUTES
    if (cline->flags & JED_LINE_HIDDEN)
-     cline = find_non_hidden_line (cline, NULL);
+     cline = find_non_hidden_line (cline, NULL, &cline_num);
    if (cline == NULL)
      return NULL;
 #endif
+   Find_Top_Line_Num = cline_num;
+
+#if JED_HAS_SOFT_WRAP
+   /* Even a single row may need to show a later row of the line */
+   Find_Top_Row = 0;
+   if (window_wraps ())
+     return wrap_find_top (cline, &Find_Top_Row, &Find_Top_Line_Num);
+#endif
 
    nrows = JWindow->rows;
 
@@ -523,31 +1042,24 @@ Line *find_top (void)
    top_window_line = JScreen [JWindow->sy].line;
 
    if (top_window_line == NULL)
-     return jed_find_top_to_recenter (cline);
+     return find_top_to_recenter (cline, cline_num);
 
    /* Chances are that the current line is visible in the window.  This means
     * that the top window line should be above it.
     */
    prev = cline;
+   num = cline_num;
 
    i = 0;
    while ((i < nrows) && (prev != NULL))
      {
 	if (prev == top_window_line)
 	  {
+	     Find_Top_Line_Num = num;
 	     return top_window_line;
 	  }
 
-#if JED_HAS_LINE_ATTRIBUTES
-	do
-	  {
-	     prev = prev->prev;
-	  }
-	while ((prev != NULL)
-	       && (prev->flags & JED_LINE_HIDDEN));
-#else
-	prev = prev->prev;
-#endif
+	prev = prev_shown_line (prev, &num);
 	i++;
      }
 
@@ -557,7 +1069,7 @@ Line *find_top (void)
 
    if ((*tt_Term_Cannot_Scroll)
        && (*tt_Term_Cannot_Scroll != -1))
-     return jed_find_top_to_recenter (cline);
+     return find_top_to_recenter (cline, cline_num);
 
    next = cline->next;
 #if JED_HAS_LINE_ATTRIBUTES
@@ -569,17 +1081,14 @@ Line *find_top (void)
        && (next == top_window_line))
      return cline;
 
-   prev = cline->prev;
-#if JED_HAS_LINE_ATTRIBUTES
-   while ((prev != NULL) && (prev->flags & JED_LINE_HIDDEN))
-     prev = prev->prev;
-#endif
+   num = cline_num;
+   prev = prev_shown_line (cline, &num);
 
    top_window_line = JScreen [nrows + JWindow->sy - 1].line;
 
    if ((prev == NULL)
        || (prev != top_window_line))
-     return jed_find_top_to_recenter (cline);
+     return find_top_to_recenter (cline, cline_num);
 
    /* It looks like cline is below window by one line.  See what line should
     * be at top to scroll it into view.
@@ -588,23 +1097,17 @@ Line *find_top (void)
    i = 2;
    while ((i < nrows) && (prev != NULL))
      {
-#if JED_HAS_LINE_ATTRIBUTES
-	do
-	  {
-	     prev = prev->prev;
-	  }
-	while ((prev != NULL)
-	       && (prev->flags & JED_LINE_HIDDEN));
-#else
-	prev = prev->prev;
-#endif
+	prev = prev_shown_line (prev, &num);
 	i++;
      }
 
    if (prev != NULL)
-     return prev;
+     {
+	Find_Top_Line_Num = num;
+	return prev;
+     }
 
-   return jed_find_top_to_recenter (cline);
+   return find_top_to_recenter (cline, cline_num);
 }
 
 static void init_smg_for_buffer (int *rowp, int *colp)
@@ -674,7 +1177,7 @@ void point_cursor (int c)
    if (cline->flags & JED_LINE_HIDDEN)
      {
 	int non_hidden_point;
-	cline = find_non_hidden_line (cline, &non_hidden_point);
+	cline = find_non_hidden_line (cline, &non_hidden_point, NULL);
 	if (cline != NULL)
 	  c = non_hidden_point;
      }
@@ -704,9 +1207,30 @@ void point_cursor (int c)
 
    if (c == 0)
      c = calculate_column ();
-   c -= (JWindow->hscroll_column - 1);
 
-   if (cline == HScroll_Line) c -= HScroll;
+#if JED_HAS_SOFT_WRAP
+   if ((cline != NULL) && window_wraps ())
+     {
+	Wrap_Row_Type wr;
+	int first_row = JScreen[r-1].wrap_row;
+
+	if (!Cursor_Motion) Goal_Column = c;
+	wr.col = c - 1;
+	(void) wrap_line_layout (cline, wrap_width (), &wr);
+	/* The first row of the line in the window may not be its first */
+	if ((JScreen[r-1].line == cline) && (first_row > 0))
+	  r -= first_row;
+	r += wr.row;
+	if (r > JWindow->sy + JWindow->rows)
+	  r = JWindow->sy + JWindow->rows;
+	c -= wr.start;
+     }
+   else
+#endif
+     {
+	c -= (JWindow->hscroll_column - 1);
+	if (cline == HScroll_Line) c -= HScroll;
+     }
    if (c < 1) c = 1; else if (c > JWindow->width) c = JWindow->width;
 
    c += JWindow->sx;
@@ -720,6 +1244,10 @@ void point_cursor (int c)
 
    SLsmg_refresh ();
 
+#if JED_HAS_SOFT_WRAP
+   if (window_wraps ())
+     return;
+#endif
    if (!Cursor_Motion) Goal_Column = c;
 }
 
@@ -1109,6 +1637,104 @@ static int screen_input_pending (int tsec)
  * the current line (or nearest visible one) can be assumed to lie in
  * the window.
  */
+#if JED_HAS_SOFT_WRAP
+/* Like the code below, but each line may cover several rows */
+static void mark_wrapped_window_attributes (Line *l, Line *cline, int point,
+					    Line *ml, int mpoint, int dn)
+{
+   Screen_Type *s = &JScreen[JWindow->sy], *smax = s + JWindow->rows;
+   Line *beg, *end;
+   int beg_point, end_point, inside, skip_rows;
+
+   if (dn > 0)
+     {
+	beg = ml; beg_point = mpoint;
+	end = cline; end_point = point;
+     }
+   else if (dn < 0)
+     {
+	beg = cline; beg_point = point;
+	end = ml; end_point = mpoint;
+     }
+   else
+     {
+	beg = end = cline;
+	beg_point = (point < mpoint) ? point : mpoint;
+	end_point = (point < mpoint) ? mpoint : point;
+     }
+
+   /* The region starts above the window if its end comes first.  The
+    * current line is in the window, so one of them will be found.
+    */
+   inside = 0;
+   if (beg != end)
+     {
+	Line *ll = l;
+	int nrows = JWindow->rows + JWindow->wrap_top_row;
+	while ((ll != NULL) && (nrows > 0) && (ll != beg))
+	  {
+	     if (ll == end)
+	       {
+		  inside = 1;
+		  break;
+	       }
+	     nrows -= (int) wrap_line_rows (ll);
+	     ll = wrap_next_line (ll);
+	  }
+     }
+
+   /* The rows of the top line above the window */
+   skip_rows = JWindow->wrap_top_row;
+   while ((s < smax) && (l != NULL))
+     {
+	unsigned char *hi0 = NULL, *hi1 = NULL;
+	int rows;
+
+	if (l == beg)
+	  {
+	     hi0 = l->data + beg_point;
+	     hi1 = l->data + ((l == end) ? end_point : l->len);
+	     inside = (l != end);
+	  }
+	else if (inside && (l == end))
+	  {
+	     hi0 = l->data;
+	     hi1 = l->data + end_point;
+	     inside = 0;
+	  }
+	else if (inside)
+	  {
+	     hi0 = l->data;
+	     hi1 = l->data + l->len;
+	  }
+
+	rows = (int) wrap_line_rows (l) - skip_rows;
+	skip_rows = 0;
+	while ((rows > 0) && (s < smax))
+	  {
+	     if ((s->hi0 != hi0) || (s->hi1 != hi1))
+	       {
+		  s->hi0 = hi0; s->hi1 = hi1;
+		  s->is_modified = 1;
+	       }
+	     s++;
+	     rows--;
+	  }
+	l = wrap_next_line (l);
+     }
+
+   while (s < smax)
+     {
+	if (s->hi0 != NULL)
+	  {
+	     s->hi0 = s->hi1 = NULL;
+	     s->is_modified = 1;
+	  }
+	s++;
+     }
+}
+#endif
+
 static void mark_window_attributes (int wa)
 {
    Screen_Type *s = &JScreen[JWindow->sy],
@@ -1121,7 +1747,7 @@ static void mark_window_attributes (int wa)
    s1 = s;
 
 #if JED_HAS_LINE_ATTRIBUTES
-   cline = find_non_hidden_line (CLine, &point);
+   cline = find_non_hidden_line (CLine, &point, NULL);
    if (cline == CLine)
      point = Point;
 #else
@@ -1148,7 +1774,7 @@ static void mark_window_attributes (int wa)
    dn = pn - mn;
 
 #if JED_HAS_LINE_ATTRIBUTES
-   ml = find_non_hidden_line (ml, &non_hidden_point);
+   ml = find_non_hidden_line (ml, &non_hidden_point, NULL);
    if (ml == cline) dn = 0;
    if (ml != m->line)
      {
@@ -1159,6 +1785,14 @@ static void mark_window_attributes (int wa)
    mpoint = m->point;
 #endif
 
+#if JED_HAS_SOFT_WRAP
+   if (window_wraps ())
+     {
+	mark_wrapped_window_attributes (l, cline, point, ml, mpoint, dn);
+	return;
+     }
+#endif
+
    /* find Screen Pos of point in window.  It has to be there */
    while (l != cline)
      {
@@ -1323,8 +1957,14 @@ static void compute_line_display_size (void)
    max_num_len++;		       /* add one as a separator */
    if (CBuf->line_num_display_size != max_num_len)
      {
+	int i, imax;
+
 	JWindow->trashed = 1;
 	CBuf->line_num_display_size = max_num_len;
+
+	imax = JWindow->sy + JWindow->rows;
+	for (i = JWindow->sy; i < imax; i++)
+	  JScreen[i].gutter_num = 0;
      }
 #endif
 }
@@ -1380,12 +2020,25 @@ static int update_1(Line *top, int force)
        && (User_Prefers_Line_Numbers
 	   || time_has_expired))
      {
+#if JED_HAS_DISPLAY_LINE_NUMBERS
+	if (CBuf->line_num_relative && CBuf->line_num_display_size
+	    && ((Gutter_Line != CLine) || (Gutter_Window != JWindow)))
+	  display_line_numbers ();
+#endif
 	update_status_line(0);
 	return(1);
      }
 
    if (!JWindow->trashed && Cursor_Motion)
      {
+#if JED_HAS_DISPLAY_LINE_NUMBERS
+	/* Relative numbers change with the current line, but only the
+	 * gutter needs to be redrawn.
+	 */
+	if (CBuf->line_num_relative && CBuf->line_num_display_size
+	    && ((Gutter_Line != CLine) || (Gutter_Window != JWindow)))
+	  display_line_numbers ();
+#endif
 #if JED_HAS_LINE_ATTRIBUTES
 	if (CLine->flags & JED_LINE_IS_READONLY)
 	  update_status_line (0);
@@ -1398,25 +2051,56 @@ static int update_1(Line *top, int force)
      {
 	int imax;
 	unsigned int start_column;
+	int wrap_row, first_wrap_row, top_row;
 
 #if JED_HAS_LINE_ATTRIBUTES
+	/* Only the lines that can appear in the window are needed now */
 	if (CBuf->min_unparsed_line_num)
-	  jed_syntax_parse_buffer (0);
+	  jed_syntax_parse_to_line (LineNum + CBuf->nup + (unsigned int) JWindow->rows);
 #endif
 	if (Wants_Syntax_Highlight) init_syntax_highlight ();
 
+	/* A top that is passed in is the old one, whose number is known */
+	top_row = 0;
+	if ((top != NULL) && (top != JWindow->beg.line))
+	  JWindow->beg.n = 0;	       /* display_line_numbers will fix it */
+#if JED_HAS_SOFT_WRAP
+	if ((top != NULL) && (top == JWindow->beg.line))
+	  top_row = JWindow->wrap_top_row;
+#endif
 #if JED_HAS_LINE_ATTRIBUTES
-	if (top != NULL) top = find_non_hidden_line (top, NULL);
+	if (top != NULL)
+	  {
+	     Line *shown = find_non_hidden_line (top, NULL, &JWindow->beg.n);
+	     if (shown != top) top_row = 0;
+	     top = shown;
+	  }
 #endif
 
 	/* (void) SLsmg_utf8_enable (CBuf->local_vars.is_utf8); */
 	if (top == NULL)
 	  {
 	     top = find_top();
-	     if (top == NULL) top = CLine;
+	     if (top == NULL)
+	       {
+		  top = CLine;
+		  Find_Top_Line_Num = LineNum + CBuf->nup;
+	       }
+#if JED_HAS_SOFT_WRAP
+	     else top_row = Find_Top_Row;
+#endif
+	     JWindow->beg.n = Find_Top_Line_Num;
 	  }
+#if JED_HAS_SOFT_WRAP
+	if ((top_row > 0)
+	    && (!window_wraps () || (top_row >= (int) wrap_line_rows (top))))
+	  top_row = 0;
+#endif
 
 	JWindow->beg.line = top;
+#if JED_HAS_SOFT_WRAP
+	JWindow->wrap_top_row = top_row;
+#endif
 #if JED_HAS_LINE_ATTRIBUTES
 	if (top->flags & JED_LINE_HIDDEN)
 	  top = NULL;
@@ -1432,6 +2116,15 @@ static int update_1(Line *top, int force)
 	compute_line_display_size ();
 	start_column = JWindow->sx;
 
+	first_wrap_row = -1;
+#if JED_HAS_SOFT_WRAP
+	if (window_wraps ())
+	  first_wrap_row = 0;
+#endif
+	wrap_row = first_wrap_row;
+	if (wrap_row == 0)
+	  wrap_row = top_row;
+
 	while (i < imax)
 	  {
 #if JED_HAS_LINE_ATTRIBUTES
@@ -1450,6 +2143,16 @@ static int update_1(Line *top, int force)
 
 	     if ((JScreen[i].line != top)
 		 || JScreen[i].is_modified
+#if JED_HAS_SOFT_WRAP
+		 || (JScreen[i].wrap_row != wrap_row)
+#endif
+#if JED_HAS_LINE_ATTRIBUTES
+		 /* The parse may have changed the state of a line that was
+		  * not itself edited, e.g., below a new comment delimiter.
+		  */
+		 || ((top != NULL)
+		     && (JScreen[i].syntax_bits != (top->flags & JED_LINE_SYNTAX_BITS)))
+#endif
 		 || (Want_Eob
 		     && !did_eob
 		     && (i != Jed_Num_Screen_Rows - 1)
@@ -1458,17 +2161,25 @@ static int update_1(Line *top, int force)
 		  if (((top == NULL) || (top->len == 0))
 		      && (Want_Eob && !did_eob && !(CBuf->flags & READ_ONLY)))
 		    {
-		       display_line(&Eob_Line, i, start_column);
+		       display_line(&Eob_Line, i, start_column, wrap_row);
 
 		       /* JScreen[i].line = top; */
 		       did_eob = 1;
 		    }
-		  else display_line(top, i, start_column);
+		  else display_line(top, i, start_column, wrap_row);
 	       }
+	     i++;
+
+#if JED_HAS_SOFT_WRAP
+	     /* Continue a wrapped line on the next row */
+	     if ((wrap_row >= 0) && (top != NULL)
+		 && (++wrap_row < (int) wrap_line_rows (top)))
+	       continue;
+#endif
+	     wrap_row = first_wrap_row;
 
 	     if (top != NULL)
 	       top = top->next;
-	     i++;
 	  }
 
 	HScroll_Line = NULL;
@@ -1614,7 +2325,7 @@ static void update_minibuffer(void)
 
 	JWindow->beg.line = CLine;
 	mark_window_attributes (1);
-	display_line(CLine, Jed_Num_Screen_Rows-1, 0);
+	display_line(CLine, Jed_Num_Screen_Rows-1, 0, -1);
 	while (w != JWindow) other_window();
 	Mini_Ghost = 1;
      }
@@ -1627,7 +2338,7 @@ static void update_minibuffer(void)
    else Mini_Ghost = ((*Message_Buffer) || (*Error_Buffer));
 
    if (Mini_Ghost == 0)
-     display_line(NULL, Jed_Num_Screen_Rows-1, 0);
+     display_line(NULL, Jed_Num_Screen_Rows-1, 0, -1);
 }
 
 #if 0
@@ -1892,7 +2603,13 @@ void update(Line *line, int force, int flag, int run_update_hook)
 #endif
    col = calculate_column ();
    HScroll_Line = NULL;
-   if (Wants_HScroll) set_hscroll(col); else HScroll = 0;
+   if (Wants_HScroll
+#if JED_HAS_SOFT_WRAP
+       && !window_wraps ()
+#endif
+      )
+     set_hscroll(col);
+   else HScroll = 0;
    hscroll_line_save = HScroll_Line;
 
    if (SLang_get_error ()) flag = 0;	       /* update hook invalidates flag */
@@ -1954,6 +2671,7 @@ void update(Line *line, int force, int flag, int run_update_hook)
    if (X_Update_Close_Hook != NULL) (*X_Update_Close_Hook) ();
 
    SLsmg_refresh ();
+   jed_key_latency_end ();
 }
 
 /* search for the CLine in the SCreen and flag it as changed */
@@ -1968,6 +2686,28 @@ void register_change(int n)
      return;
 
    JWindow->trashed = 1;
+   if ((n == LINESDELETE) || (n == LINESINSERT))
+     {
+	/* Any window may be showing some of the lines, which have come or
+	 * gone.
+	 */
+#if JED_HAS_SOFT_WRAP
+	w = JWindow;
+	do
+	  {
+	     if (w->wrap_cache != NULL)
+	       w->wrap_cache->buffer = NULL;
+	     w = w->next;
+	  }
+	while (w != JWindow);
+#endif
+	No_Screen_Update = 0;
+	touch_window_hard (JWindow, 1);
+	return;
+     }
+#if JED_HAS_SOFT_WRAP
+   wrap_cache_forget_line (cl);
+#endif
    if (Suspend_Screen_Update) return;
    if (No_Screen_Update)
      {
@@ -2145,26 +2885,45 @@ void recenter(int *np)
 {
    Line *l = CLine;
    int i, n = *np;
+   unsigned int num;
 
    if (Batch)
      return;
 
    JWindow->trashed = 1;
+#if JED_HAS_SOFT_WRAP
+   if ((n == 0) && window_wraps ())
+     {
+	int top_row;
+
+	num = LineNum + CBuf->nup;
+	l = wrap_find_top_above (l, cursor_wrap_row (l), JWindow->rows / 2,
+				 &top_row, &num);
+	JWindow->beg.line = l;
+	JWindow->beg.n = num;
+	JWindow->beg.point = 0;
+	JWindow->wrap_top_row = top_row;
+	jed_redraw_screen (0);
+	return;
+     }
+#endif
    if (n == 0)
      {
 	n = JWindow->rows / 2;
+	num = LineNum + CBuf->nup;
 	i = 0;
 	while (i < n)
 	  {
 	     if (l->prev == NULL) break;
 	     l = l->prev;
+	     num--;
 #if JED_HAS_LINE_ATTRIBUTES
 	     if (l->flags & JED_LINE_HIDDEN) continue;
 #endif
 	     i++;
 	  }
 	JWindow->beg.line = l;
-	JWindow->beg.n -= i;
+	JWindow->beg.n = num;
 	JWindow->beg.point = 0;
 	jed_redraw_screen (0);
 	return;
@@ -2174,6 +2933,21 @@ void recenter(int *np)
 
    if ((n <= 0) || (n > JWindow->rows)) n = JWindow->rows / 2;
 
+#if JED_HAS_SOFT_WRAP
+   if (window_wraps ())
+     {
+	int top_row;
+
+	/* Count screen rows instead of lines */
+	num = LineNum + CBuf->nup;
+	l = wrap_find_top_above (l, cursor_wrap_row (l), n - 1, &top_row, &num);
+	JScreen [JWindow->sy].line = l;
+	JScreen [JWindow->sy].wrap_row = top_row;
+	JScreen [JWindow->sy].is_modified = 1;
+	return;
+     }
+#endif
+
    while (n > 1)
      {
 	l = l->prev;
@@ -2204,13 +2978,26 @@ int window_line (void)
    top = find_top ();
 
 #if JED_HAS_LINE_ATTRIBUTES
-   cline = find_non_hidden_line (CLine, NULL);
+   cline = find_non_hidden_line (CLine, NULL, NULL);
 #else
    cline = CLine;
 #endif
 
    n = 1;
 
+#if JED_HAS_SOFT_WRAP
+   if (window_wraps ())
+     {
+	n -= Find_Top_Row;
+	while ((top != NULL) && (top != cline))
+	  {
+	     n += (int) wrap_line_rows (top);
+	     top = wrap_next_line (top);
+	  }
+	return n + cursor_wrap_row (cline);
+     }
+#endif
+
    while ((top != NULL) && (top != cline))
      {
 	top = top->next;
@@ -2223,6 +3010,46 @@ int window_line (void)
    return n;
 }
 
+/* Get the number of lines from the top of the window to the current line,
+ * and the number of lines that start in the window.  Without soft wrap,
+ * the latter is the number of rows.
+ */
+void jed_window_line_span (int *abovep, int *nlinesp)
+{
+#if JED_HAS_SOFT_WRAP
+   if ((CBuf == JWindow->buffer) && window_wraps ())
+     {
+	Line *l, *cline;
+	int nrows, nlines, above;
+
+	l = find_top ();
+# if JED_HAS_LINE_ATTRIBUTES
+	cline = find_non_hidden_line (CLine, NULL, NULL);
+# else
+	cline = CLine;
+# endif
+	nrows = JWindow->rows + Find_Top_Row;
+	nlines = 0;
+	above = 0;
+	while ((l != NULL) && (nrows > 0))
+	  {
+	     if (l == cline)
+	       above = nlines;
+	     nrows -= (int) wrap_line_rows (l);
+	     nlines++;
+	     l = wrap_next_line (l);
+	  }
+	if (nlines == 0)
+	  nlines = 1;
+	*abovep = above;
+	*nlinesp = nlines;
+	return;
+     }
+#endif
+   *abovep = window_line () - 1;
+   *nlinesp = JWindow->rows;
+}
+
 void touch_window (void)
 {
    Screen_Type *s, *smax;
@@ -2259,6 +3086,11 @@ void touch_screen (void)
    do
      {
 	touch_window();
+#if JED_HAS_SOFT_WRAP
+	/* Lines may have changed while register_change was suspended */
+	if (JWindow->wrap_cache != NULL)
+	  JWindow->wrap_cache->buffer = NULL;
+#endif
 	JWindow = JWindow->next;
      }
    while(w != JWindow);
@@ -2368,3 +3200,65 @@ void update_sans_update_hook_cmd (int *force)
    update((Line *) NULL, *force, 0, 0);
 }
 
+/* Draw the whole of the current buffer, a screenful at a time, through
+ * SLsmg onto the virtual terminal of vterm.c.  This exists to time the
+ * syntax highlighting from a batch mode script, where there is no display.
+ * It returns 2 if the DFA highlighter was used, 1 for the traditional one,
+ * or 0 if the buffer has no syntax highlighting.
+ */
+int jed_render_buffer_cmd (void)
+{
+   static int vterm_ok;
+   Line *l;
+   int row, type;
+
+   if (Batch == 0)
+     {
+	msg_error ("_jed_render_buffer is only available in batch mode");
+	return -1;
+     }
+
+   if (vterm_ok == 0)
+     {
+	if (-1 == vterm_init_smg (24, 80))
+	  {
+	     msg_error ("Unable to initialize the virtual terminal");
+	     return -1;
+	  }
+	vterm_ok = 1;
+     }
+
+#if JED_HAS_LINE_ATTRIBUTES
+   if (CBuf->min_unparsed_line_num)
+     jed_syntax_parse_buffer (0);
+#endif
+   type = jed_syntax_highlight_type ();
+
+   row = 0;
+   for (l = CBuf->beg; l != NULL; l = l->next)
+     {
+	unsigned int len = (unsigned int) l->len;
+
+	if (len && (l->data[len - 1] == '\n'))
+	  len--;
+
+	SLsmg_gotorc (row, 0);
+	if (len)
+	  {
+	     if (type)
+	       write_syntax_highlight (row, l, len);
+	     else
+	       SLsmg_write_nchars ((char *) l->data, len);
+	  }
+	SLsmg_erase_eol ();
+
+	if (++row == VTerm_Num_Rows)
+	  {
+	     SLsmg_refresh ();
+	     row = 0;
+	  }
+     }
+   SLsmg_refresh ();
+   return type;
+}
+
@@ -16,6 +16,7 @@ extern int Cursor_Motion;	       /* cursor movement only */
 
 extern void recenter(int *);
 extern int window_line(void);
+extern void jed_window_line_span (int *, int *);
 extern void scroll_down(int, int, int);
 extern int scroll_up(int, int, int);
 
@@ -48,6 +49,8 @@ extern void set_status_format(char *, int *);
 
 extern void init_syntax_highlight (void);
 extern void write_syntax_highlight (int, Line *, unsigned int);
+extern int jed_syntax_highlight_type (void);
+extern int jed_render_buffer_cmd (void);
 extern int Mode_Has_Syntax_Highlight;
 extern int Wants_HScroll;
 extern int Mini_Ghost;
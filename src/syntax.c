@@ -19,8 +19,7 @@
 #include "indent.h"
 
 static unsigned short *Char_Syntax;
-static char **Keywords = NULL;	       /* array of keywords */
-static int Keyword_Not_Case_Sensitive;
+static Syntax_Table_Type *Keyword_Table;   /* table whose keywords are used */
 
 static unsigned char *write_using_color (unsigned char *p,
 					 unsigned char *pmax,
@@ -92,49 +91,6 @@ static void color_columns (int row, register unsigned char *p, register unsigned
 }
 #endif				       /* JED_HAS_COLOR_COLUMNS */
 
-static int try_keyword (register unsigned char *q, int n, register char *t, unsigned char color) /*{{{*/
-{
-   unsigned char *p;
-   int ignore_case = Keyword_Not_Case_Sensitive;
-
-   while (*t)
-     {
-	unsigned char ch;
-
-	p = q - n;
-	if (Keyword_Not_Case_Sensitive == 0)
-	  {
-	     while ((p < q) && (*t == (char) *p))
-	       {
-		  p++; t++;
-	       }
-	  }
-	else while ((p < q) && (*t == (char) LOWER_CASE (*p)))
-	  {
-	     p++; t++;
-	  }
-
-	if (p == q)
-	  {
-	     p = q - n;
-	     write_using_color (p, q, color);
-	     return 0;
-	  }
-	ch = *p;
-
-	if (ignore_case && (0 == (ch & 0x80))) ch |= 0x20;
-
-	/* alphabetical */
-	if ((unsigned char) *t > ch)
-	  break;
-
-	t += (int) (q - p);
-     }
-   return -1;
-}
-
-/*}}}*/
-
 static unsigned char *get_wchar_syntax (unsigned char *p, unsigned char *pmax, unsigned short *syntaxp)
 {
    SLwchar_Type wch;
@@ -185,31 +141,15 @@ static unsigned char *find_word_end (unsigned char *p, unsigned char *pmax)
 
 static unsigned char *highlight_word (unsigned char *p, unsigned char *pmax) /*{{{*/
 {
-   char **kwds;
-   register unsigned char *q;
-   int n;
+   unsigned char *q;
    int i;
-   int color;
 
    q = find_word_end (p, pmax);
-   n = (int) (q - p);
 
-   kwds = Keywords;
-   if ((kwds != NULL) && (n <= MAX_KEYWORD_LEN))
-     {
-	for (i = 0; i < MAX_KEYWORD_TABLES; i++)
-	  {
-	     char *t;
-	     t = kwds[n - 1];
-	     if (t != NULL)
-	       {
-		  color = (JKEY_COLOR + i);
-		  if (0 == try_keyword (q, n, t, color))
-		    return q;
-	       }
-	     kwds += MAX_KEYWORD_LEN;
-	  }
-     }
+   if ((Keyword_Table != NULL)
+       && (-1 != (i = jed_find_keyword (Keyword_Table, p, (unsigned int) (q - p)))))
+     return write_using_color (p, q, JKEY_COLOR + i);
+
    return write_using_color (p, q, 0);
 }
 
@@ -347,9 +287,13 @@ void write_syntax_highlight (int row, Line *l, unsigned int len)
 #if JED_HAS_DFA_SYNTAX
    if (st->use_dfa_syntax
        && (st->hilite != NULL)
-       && (st->hilite->dfa != NULL))
+       && (st->hilite->trans != NULL))
      {
-	dfa_syntax_highlight (p, pmax, st);
+#if JED_HAS_LINE_ATTRIBUTES
+	dfa_syntax_highlight (p, pmax, st, (int) JED_GET_LINE_DFA_REGION(l));
+#else
+	dfa_syntax_highlight (p, pmax, st, 0);
+#endif
 	return;
      }
 #endif
@@ -618,19 +562,33 @@ void init_syntax_highlight (void) /*{{{*/
 
 #if JED_HAS_DFA_SYNTAX
    if (st->use_dfa_syntax
-       && ((NULL != st->hilite) && (NULL != st->hilite->dfa)))
+       && ((NULL != st->hilite) && (NULL != st->hilite->trans)))
      return;
 #endif
 
    Char_Syntax = st->char_syntax;
-
-   if (st->flags & SYNTAX_NOT_CASE_SENSITIVE)
-     Keyword_Not_Case_Sensitive = 0x20;
-   else
-     Keyword_Not_Case_Sensitive = 0;
-
-   Keywords = (char **) st->keywords;
+   Keyword_Table = st;
 }
 
 /*}}}*/
 
+/* Set up the highlighting of the current buffer and return 2 if it uses
+ * the DFA rules, 1 if it uses the traditional scheme, or 0 if it is not
+ * highlighted.
+ */
+int jed_syntax_highlight_type (void)
+{
+   Syntax_Table_Type *st = CBuf->syntax_table;
+
+   init_syntax_highlight ();
+   if (Mode_Has_Syntax_Highlight == 0)
+     return 0;
+
+#if JED_HAS_DFA_SYNTAX
+   if ((st != NULL) && st->use_dfa_syntax
+       && (st->hilite != NULL) && (st->hilite->trans != NULL))
+     return 2;
+#endif
+   return 1;
+}
+
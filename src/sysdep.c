@@ -202,9 +202,11 @@ int my_getkey() /*{{{*/
 		  ch = Meta_Char;		       /* escape char */
 	       }
 	  }
+	jed_key_latency_start ();
 	return((int) ch);
      }
 
+   jed_key_latency_start ();
    ch = Input_Buffer[0];
    if ((ch & 0x80) && ((Meta_Char != -1) || ((ch < 160) && eightbit_hack)))
      {
@@ -383,6 +385,22 @@ unsigned long sys_time(void) /*{{{*/
 
 /*}}}*/
 
+/* A clock with microsecond resolution for measuring intervals.  Only
+ * differences between two values are meaningful; the value wraps around.
+ */
+unsigned long sys_usec_clock (void) /*{{{*/
+{
+#ifdef REAL_UNIX_SYSTEM
+   struct timeval tv;
+
+   if (0 == gettimeofday (&tv, NULL))
+     return (unsigned long) tv.tv_sec * 1000000UL + (unsigned long) tv.tv_usec;
+#endif
+   return (unsigned long) time ((time_t *) 0) * 1000000UL;
+}
+
+/*}}}*/
+
 char *slash2slash(char *dir) /*{{{*/
 {
 #ifndef VMS
@@ -55,6 +55,7 @@ extern int sys_findfirst(char *);
 extern int sys_findnext(char *);
 
 extern unsigned long  sys_time(void);
+extern unsigned long sys_usec_clock (void);
 extern int Meta_Char;
 extern int DEC_8Bit_Hack;
 extern void map_character(int *, int *);
@@ -0,0 +1,113 @@
+/*
+ * Sample input for bench_syntax.sl.  It is not meant to be compiled.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef MAX_ITEMS
+# define MAX_ITEMS 100
+#endif
+#define ITEM_NAME_LEN	32
+#define ITEM_PRICE(i) ((i)->qty * (i)->price)
+
+typedef struct _Item_Type
+{
+   char name[ITEM_NAME_LEN];
+   unsigned int qty;
+   double price;
+   struct _Item_Type *next;
+}
+Item_Type;
+
+static Item_Type *Items;
+static unsigned int Num_Items = 0;
+static const char *Owner = "nobody";
+
+/* Add an item, replacing any old one of the same name */
+static int add_item (const char *name, unsigned int qty, double price) /*{{{*/
+{
+   Item_Type *it;
+
+   for (it = Items; it != NULL; it = it->next)
+     {
+	if (0 == strcmp (it->name, name))
+	  break;
+     }
+
+   if (it == NULL)
+     {
+	if (Num_Items >= MAX_ITEMS)
+	  {
+	     fprintf (stderr, "Too many items in \"%s\"\n", name);
+	     return -1;
+	  }
+	if (NULL == (it = (Item_Type *) malloc (sizeof (Item_Type))))
+	  return -1;
+	strncpy (it->name, name, ITEM_NAME_LEN - 1);
+	it->name[ITEM_NAME_LEN - 1] = '\0';
+	it->next = Items;
+	Items = it;
+	Num_Items++;
+     }
+   it->qty = qty;
+   it->price = price;
+   return 0;
+}
+
+/*}}}*/
+
+static double total (void) /*{{{*/
+{
+   Item_Type *it;
+   double sum = 0.0;
+
+   for (it = Items; it != NULL; it = it->next)
+     sum += ITEM_PRICE(it);	       /* qty times price */
+   return sum;
+}
+
+/*}}}*/
+
+static void list_items (FILE *fp) /*{{{*/
+{
+   Item_Type *it;
+   unsigned int i = 0;
+
+   for (it = Items; it != NULL; it = it->next)
+     {
+	switch (it->qty)
+	  {
+	   case 0:
+	     fputs ("  (none)\t", fp);
+	     break;
+	   case 1:
+	     fputc ('*', fp);
+	     /* drop */
+	   default:
+	     fprintf (fp, "%3u %-20s %8.2f\n", i++, it->name, it->price);
+	  }
+     }
+   fprintf (fp, "Total for %s: %.2f (0x%04X items)\n", Owner, total (), Num_Items);
+}
+
+/*}}}*/
+
+int main (int argc, char **argv) /*{{{*/
+{
+   int i;
+
+   if (argc > 1) Owner = argv[1];
+   for (i = 2; i + 2 < argc; i += 3)
+     {
+	if (-1 == add_item (argv[i], (unsigned int) atoi (argv[i+1]),
+			    atof (argv[i+2])))
+	  return 1;
+     }
+   (void) add_item ("apple", 3, 0.25);
+   (void) add_item ("pear", 10, 1.5e-1);
+   list_items (stdout);
+   return (total () > 1000.0L) ? 2 : 0;
+}
+
+/*}}}*/
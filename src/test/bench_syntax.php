@@ -0,0 +1,75 @@
+<?php
+/*
+ * Sample input for bench_syntax.sl.  It is not meant to be run.
+ */
+define ('MAX_ITEMS', 100);
+
+class Inventory
+{
+   private $items = array ();
+   protected $owner;
+   public static $count = 0;
+
+   public function __construct ($owner)
+     {
+	$this->owner = $owner;
+	self::$count++;
+     }
+
+   // Add an item, replacing any old one of the same name
+   public function add ($name, $qty = 1, $price = 0.0)
+     {
+	if (count ($this->items) >= MAX_ITEMS)
+	  throw new Exception ("Too many items in \"$name\"");
+	$this->items[$name] = array ('qty' => $qty, 'price' => $price);
+	return $this;
+     }
+
+   public function total ()
+     {
+	$sum = 0;
+	foreach ($this->items as $name => $item)
+	  {
+	     $sum += $item['qty'] * $item['price'];
+	  }
+	return round ($sum, 2);
+     }
+
+   # Render the items as an html table
+   public function render ()
+     {
+	$html = "<table class='inventory'>\n";
+	foreach ($this->items as $name => $item)
+	  {
+	     $html .= sprintf ("<tr><td>%s</td><td>%d</td><td>%.2f</td></tr>\n",
+			       htmlspecialchars ($name), $item['qty'], $item['price']);
+	  }
+	return $html . "</table>\n";
+     }
+}
+
+function parse_line ($line)
+{
+   if (preg_match ('/^(\w+)\s*=\s*(\d+)\s*@\s*([0-9.]+)$/', trim ($line), $m))
+     return array ($m[1], (int) $m[2], (float) $m[3]);
+   return null;
+}
+
+$inv = new Inventory ('warehouse');
+$lines = file ('inventory.txt', FILE_IGNORE_NEW_LINES);
+while (list ($i, $line) = each ($lines))
+{
+   $item = parse_line ($line);
+   if ($item === null || $item[1] <= 0)
+     continue;
+   switch ($item[0])
+     {
+      case 'sample':
+	break;
+      default:
+	$inv->add ($item[0], $item[1], $item[2]);
+     }
+}
+echo $inv->render ();
+printf ("Total: %0.2f (%d inventories)\n", $inv->total (), Inventory::$count);
+?>
@@ -0,0 +1,54 @@
+#!/usr/bin/perl -w
+# Sample input for bench_syntax.sl.  It is not meant to be run.
+use strict;
+use warnings;
+
+my %totals = ();
+my @order;
+my $file = shift @ARGV || "inventory.txt";
+
+=pod
+
+Read lines of the form C<name = qty @ price> and print a summary.
+
+=cut
+
+sub parse_line {
+    my ($line) = @_;
+    $line =~ s/^\s+|\s+$//g;
+    return unless $line =~ m{^(\w+)\s*=\s*(\d+)\s*\@\s*([0-9.]+)$};
+    return ($1, $2, $3);
+}
+
+sub add_item {
+    my ($name, $qty, $price) = @_;
+    push @order, $name unless exists $totals{$name};
+    $totals{$name} += $qty * $price;
+}
+
+open (my $fh, '<', $file) or die "Unable to open $file: $!\n";
+while (my $line = <$fh>) {
+    next if $line =~ /^#/;
+    my ($name, $qty, $price) = parse_line ($line);
+    next unless defined $name;
+    if ($qty <= 0) {
+	warn "Ignoring '$name' with no items\n";
+	next;
+    }
+    add_item ($name, $qty, $price);
+}
+close ($fh);
+
+my $sum = 0;
+foreach my $name (sort { $totals{$b} <=> $totals{$a} } @order) {
+    printf "%-20s %10.2f\n", $name, $totals{$name};
+    $sum += $totals{$name};
+}
+print <<"EOT";
+Total: $sum
+Items: @{[ scalar @order ]}
+EOT
+my $report = join (", ", map { qq("$_") } @order);
+$report =~ tr/a-z/A-Z/;
+print "$report\n" if length $report;
+exit 0;
@@ -9,24 +9,54 @@
 #include "jed-feat.h"
 
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
 #include "buffer.h"
 #include "undo.h"
+#ifdef UNDO_HAS_SWAP
+# include <stdint.h>
+# include "xxhash.h"
+# include "c-hash.h"
+#endif
 #include "ins.h"
 #include "line.h"
 #include "misc.h"
 #include "screen.h"
+#include "file.h"
+#include "sysdep.h"
+
+/* Records are aligned on int boundaries within a chunk */
+#define UNDO_ALIGN(n) \
+   (((n) + (sizeof (int) - 1)) & ~(unsigned int) (sizeof (int) - 1))
+#define UNDO_HEADER_SIZE UNDO_ALIGN(sizeof (Undo_Object_Type))
+
+#define UNDO_CHUNK_DATA(c) ((c)->data)
+#define UNDO_OBJECT(c, ofs) ((Undo_Object_Type *) (UNDO_CHUNK_DATA(c) + (ofs)))
+#define UNDO_DATA(uo) ((unsigned char *) (uo) + UNDO_HEADER_SIZE)
 
-#define LAST_UNDO CBuf->undo->Last_Undo
-#define FIRST_UNDO CBuf->undo->First_Undo
-#define UNDO_RING CBuf->undo->Undo_Ring
+#define LAST_UNDO \
+   UNDO_OBJECT(CBuf->undo->Last_Chunk, CBuf->undo->Last_Chunk->last)
+#define FIRST_UNDO UNDO_OBJECT(CBuf->undo->First_Chunk, 0)
 
 #ifdef UNDO_HAS_REDO
-# define CURRENT_UNDO CBuf->undo->Current_Undo
+# define CURRENT_UNDO \
+   UNDO_OBJECT(CBuf->undo->Current_Chunk, CBuf->undo->Current_Offset)
+#endif
+
+#ifdef UNDO_HAS_SWAP
+# define UNDO_LOG_CHANGED(u) ((u)->Num_Changes++)
+#else
+# define UNDO_LOG_CHANGED(u) ((void) 0)
 #endif
 
 static int Undo_In_Progress = 0;
 int Undo_Buf_Unch_Flag;	       /* 1 if buffer prev not modified */
 
+/* Values less than or equal to 0 mean no limit */
+int Jed_Undo_Buffer_Limit = JED_UNDO_BUFFER_LIMIT;
+int Jed_Undo_Total_Limit = JED_UNDO_TOTAL_LIMIT;
+static unsigned long Undo_Total_Bytes;
+
 #ifdef UNDO_HAS_REDO
 #define DONT_RECORD_UNDO  (!(CBuf->flags & UNDO_ENABLED)\
 			   || (CBuf->undo == NULL))
@@ -44,75 +74,508 @@ int Undo_Buf_Unch_Flag;	       /* 1 if buffer prev not modified */
 # define IS_UNDO_BD (LAST_UNDO->type & UNDO_BD_FLAG)
 #endif
 
-static void prepare_next_undo(void) /*{{{*/
+static Undo_Chunk_Type *alloc_undo_chunk (Undo_Type *u, unsigned int size) /*{{{*/
 {
-   LAST_UNDO++;
-   if (LAST_UNDO >= UNDO_RING + MAX_UNDOS) LAST_UNDO = UNDO_RING;
-   if (LAST_UNDO == FIRST_UNDO)
+   Undo_Chunk_Type *c;
+
+   size = UNDO_ALIGN(size);
+   if (NULL == (c = (Undo_Chunk_Type *) SLmalloc (sizeof (Undo_Chunk_Type))))
+     return NULL;
+   if (NULL == (c->data = (unsigned char *) SLmalloc (size)))
      {
-	FIRST_UNDO++;
-#ifdef UNDO_HAS_REDO
-	if (FIRST_UNDO >= UNDO_RING + MAX_UNDOS) FIRST_UNDO = UNDO_RING;
+	SLfree ((char *) c);
+	return NULL;
+     }
+
+   c->next = c->prev = NULL;
+   c->size = size;
+   c->used = 0;
+   c->last = 0;
+#ifdef UNDO_HAS_SWAP
+   c->swap_offset = -1;
+   c->clear_unchanged = 0;
 #endif
+
+   u->Num_Bytes += size;
+   Undo_Total_Bytes += size;
+   return c;
+}
+
+/*}}}*/
+
+static void free_undo_chunk (Undo_Type *u, Undo_Chunk_Type *c) /*{{{*/
+{
+   if (c->data != NULL)
+     {
+	u->Num_Bytes -= c->size;
+	Undo_Total_Bytes -= c->size;
+	SLfree ((char *) c->data);
      }
+   SLfree ((char *) c);
+}
+
+/*}}}*/
+
+static void append_undo_chunk (Undo_Type *u, Undo_Chunk_Type *c) /*{{{*/
+{
+   c->prev = u->Last_Chunk;
+   c->next = NULL;
+   if (u->Last_Chunk != NULL)
+     u->Last_Chunk->next = c;
+   else
+     u->First_Chunk = c;
+   u->Last_Chunk = c;
+}
+
+/*}}}*/
+
+/* Start a chunk with a single empty record */
+static void init_undo_chunk (Undo_Chunk_Type *c) /*{{{*/
+{
+   Undo_Object_Type *uo = UNDO_OBJECT(c, 0);
+
+   c->last = 0;
+   c->used = UNDO_HEADER_SIZE;
+   memset ((char *) uo, 0, sizeof (Undo_Object_Type));
+}
+
+/*}}}*/
+
+static void drop_first_undo_chunk (Undo_Type *u) /*{{{*/
+{
+   Undo_Chunk_Type *c = u->First_Chunk;
+
+   u->First_Chunk = c->next;
+   c->next->prev = NULL;
+#ifdef UNDO_HAS_SWAP
+   if (u->Page_Out_Hint == c)
+     u->Page_Out_Hint = c->next;
+#endif
 #ifdef UNDO_HAS_REDO
-   if (LAST_UNDO == CURRENT_UNDO)      /*  undo-ring overflow will trash  */
-     CURRENT_UNDO = NULL;	       /*  further undos  */
-#else
-   if (FIRST_UNDO >= UNDO_RING + MAX_UNDOS) FIRST_UNDO = UNDO_RING;
+   /* The oldest history is gone, and with it whatever was left to undo */
+   if (u->Current_Chunk == c)
+     u->Current_Chunk = NULL;
 #endif
+   free_undo_chunk (u, c);
+   UNDO_LOG_CHANGED(u);
+}
+
+/*}}}*/
+
+#ifdef UNDO_HAS_SWAP
+/* Write the records of a chunk to the swap file of the log, unless a copy
+ * is already there, and free them.
+ */
+static int page_out_undo_chunk (Undo_Type *u, Undo_Chunk_Type *c) /*{{{*/
+{
+   if (c->swap_offset < 0)
+     {
+	if (u->Swap_Fp == NULL)
+	  {
+	     if (u->Swap_Failed
+		 || (NULL == (u->Swap_Fp = tmpfile ())))
+	       {
+		  u->Swap_Failed = 1;
+		  return -1;
+	       }
+	  }
+
+	if ((-1 == fseek (u->Swap_Fp, 0, SEEK_END))
+	    || (-1 == (c->swap_offset = ftell (u->Swap_Fp)))
+	    || (c->used != fwrite ((char *) c->data, 1, c->used, u->Swap_Fp))
+	    || (EOF == fflush (u->Swap_Fp)))
+	  {
+	     c->swap_offset = -1;
+	     u->Swap_Failed = 1;
+	     return -1;
+	  }
+	c->clear_unchanged = 0;
+     }
 
-   LAST_UNDO->type = 0;
-   LAST_UNDO->misc = 0;
+   SLfree ((char *) c->data);
+   c->data = NULL;
+   u->Num_Bytes -= c->size;
+   Undo_Total_Bytes -= c->size;
+   return 0;
 }
 
 /*}}}*/
 
-#ifdef UNDO_HAS_REDO
-/*  Returns True if there is still  undo info to be processed. */
-#define MORE_UNDO_INFO (CURRENT_UNDO && (CURRENT_UNDO->type))
+static int page_in_undo_chunk (Undo_Type *u, Undo_Chunk_Type *c) /*{{{*/
+{
+   unsigned char *data;
+
+   if (c->data != NULL)
+     return 0;
+
+   if (NULL == (data = (unsigned char *) SLmalloc (c->size)))
+     return -1;
+
+   if ((-1 == fseek (u->Swap_Fp, c->swap_offset, SEEK_SET))
+       || (c->used != fread ((char *) data, 1, c->used, u->Swap_Fp)))
+     {
+	SLfree ((char *) data);
+	msg_error ("Unable to read the undo information from the swap file");
+	return -1;
+     }
+   c->data = data;
+   u->Num_Bytes += c->size;
+   Undo_Total_Bytes += c->size;
+
+   if (c->clear_unchanged)
+     {
+	unsigned int ofs = c->last;
+	while (1)
+	  {
+	     Undo_Object_Type *uo = UNDO_OBJECT(c, ofs);
+	     uo->type &= ~UNDO_UNCHANGED_FLAG;
+	     if (ofs == 0)
+	       break;
+	     ofs = uo->prev;
+	  }
+     }
+
+   /* It may be earlier than the hint */
+   u->Page_Out_Hint = u->First_Chunk;
+   return 0;
+}
+
+/*}}}*/
 #endif
 
-void record_deletion (unsigned char *p, int n) /*{{{*/
+/* Release the memory of the oldest chunk in memory, by paging it out or
+ * by freeing it.  The last chunk is never released.  Returns 0 if nothing
+ * could be released.
+ */
+static int release_undo_chunk (Undo_Type *u) /*{{{*/
 {
-   int misc;
-   unsigned char *pb;
+#ifdef UNDO_HAS_SWAP
+   Undo_Chunk_Type *c = u->Page_Out_Hint;
 
-   if (DONT_RECORD_UNDO || (n == 0)) return;
+   if (c == NULL)
+     c = u->First_Chunk;
+   while ((c != u->Last_Chunk) && (c->data == NULL))
+     c = c->next;
+   u->Page_Out_Hint = c;
 
-   while (1)
+   if (c == u->Last_Chunk)
+     return 0;
+
+   if (0 == page_out_undo_chunk (u, c))
+     return 1;
+#endif
+   if (u->First_Chunk == u->Last_Chunk)
+     return 0;
+
+   drop_first_undo_chunk (u);
+   return 1;
+}
+
+/*}}}*/
+
+/* Release the oldest chunks of the undo logs that are over their limits.
+ * The last chunk of a log is always kept, so a single change larger than
+ * the limit is still recorded in full.
+ */
+static void enforce_undo_limits (void) /*{{{*/
+{
+   Undo_Type *u = CBuf->undo;
+
+   /* Undo reads the records of the chunks while it records its own changes */
+   if (Undo_In_Progress)
+     return;
+
+   if (Jed_Undo_Buffer_Limit > 0)
      {
-	if (((LAST_UNDO->type & 0xFF) == 0)
-	    || ((LAST_UNDO->type & CDELETE)
-		&& (LAST_UNDO->linenum == LineNum + CBuf->nup)
-		&& (LAST_UNDO->point == Point)))
+	while ((u->Num_Bytes > (unsigned long) Jed_Undo_Buffer_Limit)
+	       && release_undo_chunk (u))
+	  ;
+     }
+
+   if (Jed_Undo_Total_Limit <= 0)
+     return;
+
+   while (Undo_Total_Bytes > (unsigned long) Jed_Undo_Total_Limit)
+     {
+	Buffer *b = CBuf, *largest = NULL;
+
+	/* Take from the buffer with the most history in memory */
+	do
 	  {
-	     if (LAST_UNDO->type != 0) misc = LAST_UNDO->misc; else misc = 0;
-	     pb = LAST_UNDO->buf + misc;
-	     while ((misc < 8) && n)
-	       {
-		  *pb++ = *p++;
-		  misc++;
-		  n--;
-	       }
-	     LAST_UNDO->misc = misc;
-	     LAST_UNDO->type |= CDELETE;
-	     LAST_UNDO->linenum = LineNum + CBuf->nup;
-	     LAST_UNDO->point = Point;
-	     if (Undo_Buf_Unch_Flag) LAST_UNDO->type |= UNDO_UNCHANGED_FLAG;
-	     Undo_Buf_Unch_Flag = 0;
+	     if ((b->undo != NULL)
+		 && (b->undo->Num_Bytes > b->undo->Last_Chunk->size)
+		 && ((largest == NULL)
+		     || (b->undo->Num_Bytes > largest->undo->Num_Bytes)))
+	       largest = b;
+	     b = b->next;
 	  }
+	while (b != CBuf);
 
-	if (n == 0)
+	if ((largest == NULL)
+	    || (0 == release_undo_chunk (largest->undo)))
 	  break;
+     }
+}
+
+/*}}}*/
+
+/* Called when memory runs out: start over with an empty log */
+static void reset_undo_log (Undo_Type *u) /*{{{*/
+{
+   while (u->First_Chunk != u->Last_Chunk)
+     drop_first_undo_chunk (u);
+
+   init_undo_chunk (u->Last_Chunk);
+#ifdef UNDO_HAS_REDO
+   u->Current_Chunk = NULL;
+#endif
+   UNDO_LOG_CHANGED(u);
+   msg_error ("Not enough memory for undo.  The undo information was discarded.");
+}
+
+/*}}}*/
+
+static int prepare_next_undo(void) /*{{{*/
+{
+   Undo_Type *u = CBuf->undo;
+   Undo_Chunk_Type *c = u->Last_Chunk;
+   Undo_Object_Type *uo;
+   unsigned int prev;
+
+   if (c->used + UNDO_HEADER_SIZE > c->size)
+     {
+	if (NULL == (c = alloc_undo_chunk (u, JED_UNDO_CHUNK_SIZE)))
+	  {
+	     reset_undo_log (u);
+	     return -1;
+	  }
+	append_undo_chunk (u, c);
+     }
+
+   prev = c->last;
+   c->last = c->used;
+   c->used += UNDO_HEADER_SIZE;
+
+   uo = UNDO_OBJECT(c, c->last);
+   memset ((char *) uo, 0, sizeof (Undo_Object_Type));
+   uo->prev = prev;
+
+   enforce_undo_limits ();
+   return 0;
+}
+
+/*}}}*/
+
+/* Make room for nbytes of deleted text after the last record and return
+ * it.  A record that outgrows its chunk is moved to a chunk of its own,
+ * which is then grown geometrically.  Only deletion_record_bytes grows a
+ * record, and only one it has just started or one it is continuing within
+ * the same command, i.e., with no undo boundary marked since, so a command
+ * is never merged into the one before it.
+ */
+static Undo_Object_Type *grow_last_undo (unsigned int nbytes) /*{{{*/
+{
+   Undo_Type *u = CBuf->undo;
+   Undo_Chunk_Type *c = u->Last_Chunk, *c1;
+   Undo_Object_Type *uo;
+   unsigned int need, ofs;
+
+   ofs = c->last;
+   need = ofs + UNDO_HEADER_SIZE + nbytes;
+   if ((need >= nbytes) && (need <= c->size))
+     {
+	c->used = UNDO_ALIGN(need);
+	return UNDO_OBJECT(c, ofs);
+     }
+
+   need = UNDO_HEADER_SIZE + nbytes;
+   if ((need < nbytes) || (need > need * 2))
+     {
+	reset_undo_log (u);
+	return NULL;
+     }
+   need = need * 2;
+   if (need < JED_UNDO_CHUNK_SIZE)
+     need = JED_UNDO_CHUNK_SIZE;
+
+   if (NULL == (c1 = alloc_undo_chunk (u, need)))
+     {
+	reset_undo_log (u);
+	return NULL;
+     }
+
+   uo = UNDO_OBJECT(c, ofs);
+   SLMEMCPY ((char *) UNDO_CHUNK_DATA(c1), (char *) uo,
+	     UNDO_HEADER_SIZE + ((uo->type & CDELETE) ? uo->misc : 0));
+
+   if (ofs == 0)
+     {
+	/* The record was alone in its chunk, so the new one replaces it */
+	c1->prev = c->prev;
+	if (c->prev != NULL) c->prev->next = c1;
+	else u->First_Chunk = c1;
+	u->Last_Chunk = c1;
+#ifdef UNDO_HAS_SWAP
+	if (u->Page_Out_Hint == c)
+	  u->Page_Out_Hint = c1;
+#endif
+	free_undo_chunk (u, c);
+     }
+   else
+     {
+	c->used = ofs;
+	c->last = uo->prev;
+	append_undo_chunk (u, c1);
+     }
 
-	prepare_next_undo();
+#ifdef UNDO_HAS_REDO
+   if ((u->Current_Chunk == c) && (u->Current_Offset == ofs))
+     {
+	u->Current_Chunk = c1;
+	u->Current_Offset = 0;
      }
+#endif
+
+   uo = UNDO_OBJECT(c1, 0);
+   uo->prev = 0;
+   c1->last = 0;
+   c1->used = UNDO_ALIGN(UNDO_HEADER_SIZE + nbytes);
+
+   enforce_undo_limits ();
+   return uo;
+}
+
+/*}}}*/
+
+#ifdef UNDO_HAS_REDO
+/*  Returns True if there is still  undo info to be processed. */
+#define MORE_UNDO_INFO ((CBuf->undo->Current_Chunk != NULL) && (CURRENT_UNDO->type))
+
+/* Move the current record back by one.  Returns 0 if there is none. */
+static int previous_undo (Undo_Type *u) /*{{{*/
+{
+   Undo_Chunk_Type *c = u->Current_Chunk;
+
+   if (u->Current_Offset != 0)
+     {
+	u->Current_Offset = UNDO_OBJECT(c, u->Current_Offset)->prev;
+	return 1;
+     }
+   if ((NULL == (c = c->prev))
+#ifdef UNDO_HAS_SWAP
+       || (-1 == page_in_undo_chunk (u, c))
+#endif
+       )
+     {
+	u->Current_Chunk = NULL;
+	return 0;
+     }
+   u->Current_Chunk = c;
+   u->Current_Offset = c->last;
+   return 1;
+}
+
+/*}}}*/
+#else
+/* Remove the last record */
+static void pop_last_undo (Undo_Type *u) /*{{{*/
+{
+   Undo_Chunk_Type *c = u->Last_Chunk;
+
+   if (c->last != 0)
+     {
+	c->used = c->last;
+	c->last = UNDO_OBJECT(c, c->last)->prev;
+	return;
+     }
+   if (c == u->First_Chunk)
+     {
+	init_undo_chunk (c);
+	return;
+     }
+   u->Last_Chunk = c->prev;
+   c->prev->next = NULL;
+   free_undo_chunk (u, c);
+}
+
+/*}}}*/
+#endif
+
+/* Returns where the n deleted bytes at the point go in the log, or NULL
+ * if they are not to be recorded.
+ */
+static unsigned char *deletion_record_bytes (int n) /*{{{*/
+{
+   Undo_Object_Type *uo;
+   unsigned int linenum;
+   int misc = 0;
+
+   if (DONT_RECORD_UNDO || (n <= 0)) return NULL;
+
+   linenum = LineNum + CBuf->nup;
+   uo = LAST_UNDO;
+
+   /* A deletion that continues the previous one within the same command,
+    * e.g., the next line of a large deletion, is added to its record.  A
+    * boundary on the record means that the command which made it is over.
+    */
+   if (((uo->type & (0xFF | UNDO_BD_FLAG)) == CDELETE)
+       && (uo->linenum == linenum)
+       && (uo->point == Point)
+       && (uo->misc <= INT_MAX - n)
+       && (Undo_Buf_Unch_Flag == 0)
+       && (Undo_In_Progress == 0))
+     misc = uo->misc;
+   else if ((uo->type != 0) && (-1 == prepare_next_undo ()))
+     return NULL;
+
+   if (NULL == (uo = grow_last_undo ((unsigned int) (misc + n))))
+     return NULL;
+
+   uo->misc = misc + n;
+   uo->type |= CDELETE;
+   uo->linenum = linenum;
+   uo->point = Point;
+   if (Undo_Buf_Unch_Flag) uo->type |= UNDO_UNCHANGED_FLAG;
+   Undo_Buf_Unch_Flag = 0;
+   UNDO_LOG_CHANGED(CBuf->undo);
 
-   if (Undo_Buf_Unch_Flag) LAST_UNDO->type |= UNDO_UNCHANGED_FLAG;
 #ifdef UNDO_HAS_REDO
    set_current_undo ();
 #endif
+   return UNDO_DATA(uo) + misc;
+}
+
+/*}}}*/
+
+void record_deletion (unsigned char *p, int n) /*{{{*/
+{
+   unsigned char *b;
+
+   if (NULL != (b = deletion_record_bytes (n)))
+     SLMEMCPY ((char *) b, (char *) p, n);
+}
+
+/*}}}*/
+
+/* Record the deletion of the nbytes of the lines starting at l, which have
+ * been removed from above the point in one piece.
+ */
+void record_lines_deletion (Line *l, int nbytes) /*{{{*/
+{
+   unsigned char *b;
+
+   if (NULL == (b = deletion_record_bytes (nbytes)))
+     return;
+
+   while ((l != NULL) && (nbytes > 0))
+     {
+	int len = (l->len < nbytes) ? l->len : nbytes;
+	SLMEMCPY ((char *) b, (char *) l->data, len);
+	b += len;
+	nbytes -= len;
+	l = l->next;
+     }
 }
 
 /*}}}*/
@@ -120,35 +583,45 @@ void record_deletion (unsigned char *p, int n) /*{{{*/
 int undo (void) /*{{{*/
 {
    int line;
+   Undo_Type *u;
+   Undo_Object_Type *uo;
+
    CHECK_READ_ONLY
    if (!(CBuf->flags & UNDO_ENABLED))
      {
 	msg_error("Undo not enabled for this buffer.");
 	return(0);
      }
-   else if ((CBuf->undo == NULL)
+#ifdef UNDO_HAS_SWAP
+   if ((CBuf->undo != NULL) && (CBuf->undo->Current_Chunk != NULL)
+       && (-1 == page_in_undo_chunk (CBuf->undo, CBuf->undo->Current_Chunk)))
+     return 0;
+#endif
+   if ((CBuf->undo == NULL)
 #ifdef UNDO_HAS_REDO
-	    || (0 == MORE_UNDO_INFO)
+       || (0 == MORE_UNDO_INFO)
 #else
-	    || (LAST_UNDO->type == 0)
+       || (LAST_UNDO->type == 0)
 #endif
-	    )
+       )
      {
 	msg_error("No more undo information.");
 	return(0);
      }
    Undo_In_Progress = 1;
+   u = CBuf->undo;
 
    do
      {
 	int undo_type;
 #ifdef UNDO_HAS_REDO
-	line = (int) CURRENT_UNDO->linenum;
-	undo_type = CURRENT_UNDO->type & 0xFF;
+	uo = CURRENT_UNDO;
 #else
-	line = (int) LAST_UNDO->linenum;
-	undo_type = LAST_UNDO->type & 0xFF;
+	uo = LAST_UNDO;
 #endif
+	line = (int) uo->linenum;
+	undo_type = uo->type & 0xFF;
+
 	if ((line <= (int) CBuf->nup)
 	    || ((unsigned int) line >= CBuf->nup + Max_LineNum))
 	  {
@@ -161,11 +634,7 @@ int undo (void) /*{{{*/
 	  }
 	line -= CBuf->nup;
 	goto_line(&line);
-#ifdef UNDO_HAS_REDO
-	Point = CURRENT_UNDO->point;
-#else
-	Point = LAST_UNDO->point;
-#endif
+	Point = uo->point;
 	if (Point > CLine->len)
 	  {
 	     Point = 0;
@@ -173,22 +642,15 @@ int undo (void) /*{{{*/
 	     break;
 	  }
 
+	/* The chunks are not freed or moved while the undo is in
+	 * progress, so uo stays valid across the changes made here.
+	 */
 	switch (undo_type)
 	  {
-#ifdef UNDO_HAS_REDO
-	   case CDELETE: (void) jed_insert_nbytes (CURRENT_UNDO->buf, CURRENT_UNDO->misc);
-	     /* Point = CURRENT_UNDO->point; */
-#else
-	   case CDELETE: (void) jed_insert_nbytes (LAST_UNDO->buf, LAST_UNDO->misc);
-	     /* Point = LAST_UNDO->point; */
-#endif
+	   case CDELETE: (void) jed_insert_nbytes (UNDO_DATA(uo), uo->misc);
 	     break;
 
-#ifdef UNDO_HAS_REDO
-	   case CINSERT: (void) jed_del_nbytes (CURRENT_UNDO->misc);
-#else
-	   case CINSERT: (void) jed_del_nbytes (LAST_UNDO->misc);
-#endif
+	   case CINSERT: (void) jed_del_nbytes (uo->misc);
 	     break;
 
 	   case UNDO_POSITION:
@@ -196,39 +658,30 @@ int undo (void) /*{{{*/
 
 	   case NLINSERT: jed_del_wchar (); break;
 
+	   case LINESINSERT: (void) jed_del_lines_above ((unsigned int) uo->misc);
+	     break;
+
 	   default: return(1);
 	  }
 
 #ifdef UNDO_HAS_REDO
-	if (CURRENT_UNDO == NULL) break;
+	if (u->Current_Chunk == NULL) break;
 	/*  no more undo info after overflow */
 
-	/*  above calls to ins_chars/deln/del may overflow the undo-ring */
 	if (CURRENT_UNDO->type & UNDO_UNCHANGED_FLAG)
 	  {
 	     mark_buffer_modified (CBuf, 0, 1);
 	  }
 
-	if (CURRENT_UNDO == FIRST_UNDO)
-	  {
-	     CURRENT_UNDO = NULL ;
-	     break ;			/*  no more undo info  */
-	  }
-
-	CURRENT_UNDO--;
-	if (CURRENT_UNDO < UNDO_RING) CURRENT_UNDO = UNDO_RING + MAX_UNDOS - 1;
+	if (0 == previous_undo (u))
+	  break;			/*  no more undo info  */
 #else
 	if (LAST_UNDO->type & UNDO_UNCHANGED_FLAG)
 	  {
 	     mark_buffer_modified (CBuf, 0, 1);
 	  }
 
-	if (LAST_UNDO == FIRST_UNDO) LAST_UNDO->type = 0;
-	else
-	  {
-	     LAST_UNDO--;
-	     if (LAST_UNDO < UNDO_RING) LAST_UNDO = UNDO_RING + MAX_UNDOS - 1;
-	  }
+	pop_last_undo (u);
 #endif
      }
 #ifdef UNDO_HAS_REDO
@@ -239,6 +692,7 @@ int undo (void) /*{{{*/
 
    message("Undo!");
    Undo_In_Progress = 0;
+   enforce_undo_limits ();
    return(1);
 }
 
@@ -246,34 +700,41 @@ int undo (void) /*{{{*/
 
 void record_insertion(int n) /*{{{*/
 {
+   Undo_Object_Type *uo;
+
    if (DONT_RECORD_UNDO || !n) return;
 
    if ((Undo_Buf_Unch_Flag) && (LAST_UNDO->type))
      {
-	prepare_next_undo ();
+	if (-1 == prepare_next_undo ())
+	  return;
      }
 
-   if (LAST_UNDO->type == 0)
+   uo = LAST_UNDO;
+   if (uo->type == 0)
      {
-	LAST_UNDO->misc = n;
-	LAST_UNDO->point = Point;
+	uo->misc = n;
+	uo->point = Point;
      }
-   else if ((LAST_UNDO->type & CINSERT) && (LAST_UNDO->linenum == LineNum + CBuf->nup)
-	    && (LAST_UNDO->point + LAST_UNDO->misc == Point)
-	    && (LAST_UNDO->misc <= 32))
+   else if ((uo->type & CINSERT) && (uo->linenum == LineNum + CBuf->nup)
+	    && (uo->point + uo->misc == Point)
+	    && (uo->misc <= 32))
      {
-	LAST_UNDO->misc += n;
+	uo->misc += n;
      }
    else
      {
-	prepare_next_undo();
-	LAST_UNDO->point = Point;
-	LAST_UNDO->misc = n;
+	if (-1 == prepare_next_undo())
+	  return;
+	uo = LAST_UNDO;
+	uo->point = Point;
+	uo->misc = n;
      }
 
-   LAST_UNDO->type |= CINSERT;
-   if (Undo_Buf_Unch_Flag) LAST_UNDO->type |= UNDO_UNCHANGED_FLAG;
-   LAST_UNDO->linenum = LineNum + CBuf->nup;
+   uo->type |= CINSERT;
+   if (Undo_Buf_Unch_Flag) uo->type |= UNDO_UNCHANGED_FLAG;
+   uo->linenum = LineNum + CBuf->nup;
+   UNDO_LOG_CHANGED(CBuf->undo);
 #ifdef UNDO_HAS_REDO
    set_current_undo ();
 #endif
@@ -281,39 +742,71 @@ void record_insertion(int n) /*{{{*/
 
 /*}}}*/
 
-void record_newline_insertion() /*{{{*/
+static int record_at_point (int type) /*{{{*/
 {
-   if (DONT_RECORD_UNDO) return;
-   if (LAST_UNDO->type != 0) prepare_next_undo();
-   if (Undo_Buf_Unch_Flag) LAST_UNDO->type |= UNDO_UNCHANGED_FLAG;
-   LAST_UNDO->point = Point;
-   LAST_UNDO->misc = 0;
-   LAST_UNDO->type |= NLINSERT;
-   LAST_UNDO->linenum = LineNum + CBuf->nup;
+   Undo_Object_Type *uo;
+
+   if (DONT_RECORD_UNDO) return -1;
+   if ((LAST_UNDO->type != 0) && (-1 == prepare_next_undo()))
+     return -1;
+
+   uo = LAST_UNDO;
+   if (Undo_Buf_Unch_Flag) uo->type |= UNDO_UNCHANGED_FLAG;
+   uo->point = Point;
+   uo->misc = 0;
+   uo->type |= type;
+   uo->linenum = LineNum + CBuf->nup;
+   UNDO_LOG_CHANGED(CBuf->undo);
 #ifdef UNDO_HAS_REDO
    set_current_undo ();
 #endif
+   return 0;
+}
+
+/*}}}*/
+
+void record_newline_insertion() /*{{{*/
+{
+   (void) record_at_point (NLINSERT);
+}
+
+/*}}}*/
+
+/* Record that n whole lines were put above the current line at once. */
+void record_lines_insertion (int n) /*{{{*/
+{
+   if ((n > 0) && (0 == record_at_point (LINESINSERT)))
+     LAST_UNDO->misc = n;
 }
 
 /*}}}*/
 
 void jed_undo_record_position (void)
 {
-   if (DONT_RECORD_UNDO) return;
-   if (LAST_UNDO->type != 0) prepare_next_undo();
-   if (Undo_Buf_Unch_Flag) LAST_UNDO->type |= UNDO_UNCHANGED_FLAG;
-   LAST_UNDO->point = Point;
-   LAST_UNDO->misc = 0;
-   LAST_UNDO->type |= UNDO_POSITION;
-   LAST_UNDO->linenum = LineNum + CBuf->nup;
-#ifdef UNDO_HAS_REDO
-   set_current_undo ();
-#endif
+   (void) record_at_point (UNDO_POSITION);
 }
 
 void delete_undo_ring(Buffer *b) /*{{{*/
 {
-   SLfree ((char *)b->undo);
+   Undo_Type *u = b->undo;
+   Undo_Chunk_Type *c, *next;
+
+   if (u == NULL)
+     return;
+
+   c = u->First_Chunk;
+   while (c != NULL)
+     {
+	next = c->next;
+	free_undo_chunk (u, c);
+	c = next;
+     }
+#ifdef UNDO_HAS_SWAP
+   if (u->Swap_Fp != NULL)
+     fclose (u->Swap_Fp);
+   SLfree (u->History_File);
+#endif
+   SLfree ((char *)u);
 }
 
 /*}}}*/
@@ -321,27 +814,24 @@ void delete_undo_ring(Buffer *b) /*{{{*/
 void create_undo_ring() /*{{{*/
 {
    Undo_Type *ur;
-   Undo_Object_Type *uo;
-   int n;
+   Undo_Chunk_Type *c;
 
    if (NULL == (ur = (Undo_Type *) SLmalloc (sizeof(Undo_Type))))
      {
 	msg_error("Unable to malloc space for undo!");
 	return;
      }
-   CBuf->undo = ur;
-   uo = ur->Undo_Ring;
-   ur->Last_Undo = ur->First_Undo = uo;
-#ifdef UNDO_HAS_REDO
-   ur->Current_Undo = NULL;
-#endif
+   memset ((char *) ur, 0, sizeof (Undo_Type));
 
-   n = MAX_UNDOS;
-   while (n--)
+   if (NULL == (c = alloc_undo_chunk (ur, JED_UNDO_CHUNK_SIZE)))
      {
-	uo->type = 0;
-	uo++;
+	SLfree ((char *) ur);
+	msg_error("Unable to malloc space for undo!");
+	return;
      }
+   init_undo_chunk (c);
+   append_undo_chunk (ur, c);
+   CBuf->undo = ur;
 }
 
 /*}}}*/
@@ -352,9 +842,11 @@ void mark_undo_boundary (Buffer *b) /*{{{*/
 
    CBuf = b;
 
-   if (!DONT_RECORD_UNDO && (LAST_UNDO->type != 0))
+   if (!DONT_RECORD_UNDO && (LAST_UNDO->type != 0)
+       && (0 == (LAST_UNDO->type & UNDO_BD_FLAG)))
      {
 	LAST_UNDO->type |= UNDO_BD_FLAG;
+	UNDO_LOG_CHANGED(CBuf->undo);
      }
    CBuf = s;
 }
@@ -370,9 +862,10 @@ void unmark_undo_boundary (Buffer *b) /*{{{*/
 
    CBuf = b;
 
-   if (!DONT_RECORD_UNDO && (LAST_UNDO->type != 0))
+   if (!DONT_RECORD_UNDO && (LAST_UNDO->type & UNDO_BD_FLAG))
      {
 	LAST_UNDO->type &= ~UNDO_BD_FLAG;
+	UNDO_LOG_CHANGED(CBuf->undo);
      }
    CBuf = s;
 #endif
@@ -385,7 +878,8 @@ void set_current_undo()		/*  Called when text is inserted, deleted,  */ /*{{{*/
 {				/*  or the abort key is pressed.  */
    if ((!Undo_In_Progress) && CBuf->undo)
      {
-	CURRENT_UNDO = LAST_UNDO ;
+	CBuf->undo->Current_Chunk = CBuf->undo->Last_Chunk;
+	CBuf->undo->Current_Offset = CBuf->undo->Last_Chunk->last;
      }
 }
 
@@ -396,22 +890,349 @@ void update_undo_unchanged (void) /*{{{*/
  * that after a save, undoing on the buffer does not affect the disk file.
  */
 {
-   Undo_Object_Type *uo;
-   int n;
+   Undo_Chunk_Type *c;
 
    if (DONT_RECORD_UNDO) return;
 
-   uo = UNDO_RING ;
-   n = MAX_UNDOS;
-   while (n--)
+   for (c = CBuf->undo->First_Chunk; c != NULL; c = c->next)
      {
-	uo->type &= ~UNDO_UNCHANGED_FLAG;
-	uo++;
+	unsigned int ofs = c->last;
+
+#ifdef UNDO_HAS_SWAP
+	/* Fix the copy in the swap file when it is paged in again */
+	if (c->swap_offset >= 0)
+	  c->clear_unchanged = 1;
+	if (c->data == NULL)
+	  continue;
+#endif
+	while (1)
+	  {
+	     Undo_Object_Type *uo = UNDO_OBJECT(c, ofs);
+	     uo->type &= ~UNDO_UNCHANGED_FLAG;
+	     if (ofs == 0)
+	       break;
+	     ofs = uo->prev;
+	  }
      }
 
-   CURRENT_UNDO = LAST_UNDO ;
+   set_current_undo ();
 }
 
 /*}}}*/
 #endif
 
+#ifdef UNDO_HAS_SWAP
+/*{{{ Keeping the history of a file between sessions */
+
+/* The history of a file is written to Undo_History_Dir when it is saved,
+ * under a name made from the hash of the file's contents and of its
+ * canonical path.  When the file is read again with the same contents,
+ * the history is loaded back.  The path is also kept in the history file
+ * and checked, so that a hash collision cannot mix up two files.
+ */
+static char *Undo_History_Dir;
+
+#define UNDO_HISTORY_MAGIC	0x4A554E44     /* JUND */
+#define UNDO_HISTORY_VERSION	2
+
+/* The header and the sizes of the chunks have the same layout on every
+ * system with the same byte order.  record_size tells whether the records
+ * themselves do.
+ */
+typedef struct
+{
+   uint32_t magic;
+   uint32_t version;
+   uint32_t record_size;	       /* sizeof (Undo_Object_Type) */
+   uint32_t num_chunks;
+   uint64_t num_lines;		       /* of the buffer the history belongs to */
+   uint64_t num_bytes;
+   uint32_t path_len;		       /* the canonical path follows */
+   uint32_t reserved;
+}
+Undo_History_Header;
+
+void jed_set_undo_history_dir (char *dir) /*{{{*/
+{
+   SLang_free_slstring (Undo_History_Dir);
+   Undo_History_Dir = NULL;
+   if ((dir != NULL) && (*dir != 0))
+     Undo_History_Dir = SLang_create_slstring (dir);
+}
+
+/*}}}*/
+
+/* Returns the name of the history file for file, or NULL.  The canonical
+ * path of file is returned via *pathp.
+ */
+static char *undo_history_file (char *file, char **pathp) /*{{{*/
+{
+   char name[64];
+   char *path, *hist_file;
+   uint64_t h;
+
+   if (Undo_History_Dir == NULL)
+     return NULL;
+
+   if (NULL == (path = jed_get_canonical_pathname (file)))
+     return NULL;
+
+   if (0 == (h = (uint64_t) xxh64_hash_file (file)))
+     {
+	SLfree (path);
+	return NULL;
+     }
+   h = XXH3_64bits_withSeed (path, strlen (path), h);
+
+   sprintf (name, "%08lx%08lx.undo",
+	    (unsigned long) ((h >> 32) & 0xFFFFFFFFUL),
+	    (unsigned long) (h & 0xFFFFFFFFUL));
+   if (NULL == (hist_file = jed_dir_file_merge (Undo_History_Dir, name)))
+     {
+	SLfree (path);
+	return NULL;
+     }
+   *pathp = path;
+   return hist_file;
+}
+
+/*}}}*/
+
+static void get_buffer_size (uint64_t *nlines, uint64_t *nbytes) /*{{{*/
+{
+   Line *l;
+
+   *nlines = *nbytes = 0;
+   for (l = CBuf->beg; l != NULL; l = l->next)
+     {
+	*nlines += 1;
+	*nbytes += (uint64_t) l->len;
+     }
+}
+
+/*}}}*/
+
+/* Write the undo history of the current buffer after it was saved to
+ * file.  Returns 0 upon success, or -1 if the history was not written.
+ */
+int jed_undo_save_history (char *file) /*{{{*/
+{
+   Undo_Type *u = CBuf->undo;
+   Undo_History_Header h;
+   Undo_Chunk_Type *c;
+   char *hist_file, *path;
+   FILE *fp;
+   int status = -1;
+
+   if ((u == NULL) || (CBuf->narrow != NULL)
+       || (NULL == (hist_file = undo_history_file (file, &path))))
+     return -1;
+
+   /* Saving the same text again with the same history changes nothing */
+   if ((u->History_File != NULL) && (u->History_Changes == u->Num_Changes)
+       && (0 == strcmp (u->History_File, hist_file))
+       && (1 == file_status (hist_file)))
+     {
+	SLfree (path);
+	SLfree (hist_file);
+	return 0;
+     }
+
+   if (NULL == (fp = fopen (hist_file, "wb")))
+     {
+	SLfree (path);
+	SLfree (hist_file);
+	return -1;
+     }
+
+   memset ((char *) &h, 0, sizeof (h));
+   h.magic = UNDO_HISTORY_MAGIC;
+   h.version = UNDO_HISTORY_VERSION;
+   h.record_size = sizeof (Undo_Object_Type);
+   for (c = u->First_Chunk; c != NULL; c = c->next)
+     h.num_chunks++;
+   get_buffer_size (&h.num_lines, &h.num_bytes);
+   h.path_len = strlen (path);
+
+   if ((1 != fwrite ((char *) &h, sizeof (h), 1, fp))
+       || (h.path_len != fwrite (path, 1, h.path_len, fp)))
+     goto close_and_return;
+
+   for (c = u->First_Chunk; c != NULL; c = c->next)
+     {
+	uint32_t info[2];
+	int paged_out = (c->data == NULL);
+
+	if (paged_out && (-1 == page_in_undo_chunk (u, c)))
+	  goto close_and_return;
+
+	info[0] = c->used;
+	info[1] = c->last;
+	if ((1 != fwrite ((char *) info, sizeof (info), 1, fp))
+	    || (c->used != fwrite ((char *) c->data, 1, c->used, fp)))
+	  goto close_and_return;
+
+	if (paged_out)
+	  (void) page_out_undo_chunk (u, c);
+     }
+   status = 0;
+
+close_and_return:
+   SLfree (path);
+   if ((EOF == fclose (fp)) || (status == -1))
+     {
+	(void) sys_delete_file (hist_file);
+	SLfree (hist_file);
+	return -1;
+     }
+
+   /* The previous history of the file is contained in this one */
+   if ((u->History_File != NULL) && strcmp (u->History_File, hist_file))
+     (void) sys_delete_file (u->History_File);
+   SLfree (u->History_File);
+   u->History_File = hist_file;
+   u->History_Changes = u->Num_Changes;
+   return 0;
+}
+
+/*}}}*/
+
+/* Check that the records of a chunk read from a file are all inside it */
+static int is_valid_undo_chunk (Undo_Chunk_Type *c) /*{{{*/
+{
+   unsigned int ofs = c->last, end = c->used;
+
+   while (1)
+     {
+	Undo_Object_Type *uo = UNDO_OBJECT(c, ofs);
+	unsigned int len = UNDO_HEADER_SIZE;
+
+	if (ofs + len > end)
+	  return 0;
+	if ((uo->type & 0xFF) == CDELETE)
+	  {
+	     if ((uo->misc < 0)
+		 || ((unsigned int) uo->misc > end - ofs - UNDO_HEADER_SIZE))
+	       return 0;
+	  }
+	if (ofs == 0)
+	  return 1;
+	if ((uo->prev >= ofs) || (uo->prev % sizeof (int)))
+	  return 0;
+	end = ofs;
+	ofs = uo->prev;
+     }
+}
+
+/*}}}*/
+
+/* Load the undo history of file, which was just read into the current
+ * buffer.  Returns 0 upon success, or -1 if there is no usable history.
+ */
+int jed_undo_load_history (char *file) /*{{{*/
+{
+   Undo_History_Header h;
+   Undo_Type *u;
+   Undo_Chunk_Type *c, *first = NULL, *last = NULL;
+   uint64_t nlines, nbytes;
+   unsigned int i;
+   char *hist_file, *path, *hist_path = NULL;
+   FILE *fp;
+
+   if ((CBuf->narrow != NULL) || (CBuf->flags & BUFFER_MODIFIED)
+       || (0 == (CBuf->flags & UNDO_ENABLED))
+       || (NULL == (hist_file = undo_history_file (file, &path))))
+     return -1;
+
+   if (NULL == (fp = fopen (hist_file, "rb")))
+     {
+	SLfree (path);
+	SLfree (hist_file);
+	return -1;
+     }
+
+   get_buffer_size (&nlines, &nbytes);
+   if ((1 != fread ((char *) &h, sizeof (h), 1, fp))
+       || (h.magic != UNDO_HISTORY_MAGIC)
+       || (h.version != UNDO_HISTORY_VERSION)
+       || (h.record_size != sizeof (Undo_Object_Type))
+       || (h.num_chunks == 0)
+       || (h.num_lines != nlines)
+       || (h.num_bytes != nbytes)
+       || (h.path_len != strlen (path))
+       || (NULL == (hist_path = SLmalloc (h.path_len + 1)))
+       || (h.path_len != fread (hist_path, 1, h.path_len, fp))
+       || (0 != memcmp (hist_path, path, h.path_len)))
+     goto return_error;
+
+   if (CBuf->undo == NULL)
+     {
+	create_undo_ring ();
+	if (CBuf->undo == NULL)
+	  goto return_error;
+     }
+   u = CBuf->undo;
+
+   for (i = 0; i < h.num_chunks; i++)
+     {
+	uint32_t info[2];
+
+	if ((1 != fread ((char *) info, sizeof (info), 1, fp))
+	    || (info[0] < UNDO_HEADER_SIZE) || (info[1] >= info[0])
+	    || (info[1] % sizeof (int))
+	    || (NULL == (c = alloc_undo_chunk (u, (info[0] > JED_UNDO_CHUNK_SIZE)
+					       ? info[0] : JED_UNDO_CHUNK_SIZE))))
+	  goto free_and_return_error;
+
+	c->prev = last;
+	if (last == NULL) first = c; else last->next = c;
+	last = c;
+
+	c->used = info[0];
+	c->last = info[1];
+	if ((c->used != fread ((char *) c->data, 1, c->used, fp))
+	    || (0 == is_valid_undo_chunk (c)))
+	  goto free_and_return_error;
+     }
+   fclose (fp);
+
+   /* Replace the empty log by the history */
+   while (u->First_Chunk != NULL)
+     {
+	c = u->First_Chunk;
+	u->First_Chunk = c->next;
+	free_undo_chunk (u, c);
+     }
+   u->First_Chunk = first;
+   u->Last_Chunk = last;
+   u->Page_Out_Hint = first;
+   u->Current_Chunk = last;
+   u->Current_Offset = last->last;
+   SLfree (u->History_File);
+   u->History_File = hist_file;
+   u->History_Changes = ++u->Num_Changes;
+   SLfree (hist_path);
+   SLfree (path);
+
+   enforce_undo_limits ();
+   return 0;
+
+free_and_return_error:
+   while (first != NULL)
+     {
+	c = first->next;
+	free_undo_chunk (u, first);
+	first = c;
+     }
+return_error:
+   fclose (fp);
+   SLfree (hist_path);
+   SLfree (path);
+   SLfree (hist_file);
+   return -1;
+}
+
+/*}}}*/
+
+/*}}}*/
+#endif
@@ -8,39 +8,81 @@
  */
 
 #if defined (__MSDOS_16BIT__) || defined (__os2_16__)
-/* size is something like 2000 x (16) = 32K */
-#define MAX_UNDOS 2000
+# define JED_UNDO_CHUNK_SIZE	512
+# define JED_UNDO_BUFFER_LIMIT	0x4000
+# define JED_UNDO_TOTAL_LIMIT	0x7FFF
 #else
-#define UNDO_HAS_REDO
-/* 24 bytes * 10K = 240K */
-#define MAX_UNDOS 10000
+# define UNDO_HAS_REDO
+/* Old history may be paged out to a temporary file, and the history of a
+ * file may be kept on disk between sessions.
+ */
+# define UNDO_HAS_SWAP
+# define JED_UNDO_CHUNK_SIZE	4096
+/* 16MB of history per buffer, 64MB for all of them */
+# define JED_UNDO_BUFFER_LIMIT	0x1000000
+# define JED_UNDO_TOTAL_LIMIT	0x4000000
 #endif
 
+/* An undo record.  The bytes removed by a deletion are stored right after
+ * it, so a deletion of any size is a single record.
+ */
 typedef struct
 {
    unsigned short type;		       /* type of damage */
    unsigned int linenum;	       /* where damage was */
    int point;			       /*  */
-   int misc;			       /* misc information */
-   unsigned char buf[8];	       /* buffer for chars */
+   int misc;			       /* number of bytes inserted or deleted */
+   unsigned int prev;		       /* offset of the previous record in the chunk */
 } Undo_Object_Type;
 
+/* The records are kept in a doubly linked list of chunks.  When the log
+ * grows beyond Jed_Undo_Buffer_Limit, or all of the logs together grow
+ * beyond Jed_Undo_Total_Limit, the oldest chunks are paged out to the swap
+ * file of the log, or freed if there is none.
+ */
+typedef struct Undo_Chunk_Type
+{
+   struct Undo_Chunk_Type *next;
+   struct Undo_Chunk_Type *prev;
+   unsigned char *data;		       /* NULL if paged out */
+   unsigned int size;		       /* bytes available for records */
+   unsigned int used;		       /* bytes used by the records */
+   unsigned int last;		       /* offset of the last record */
+#ifdef UNDO_HAS_SWAP
+   long swap_offset;		       /* offset of the copy in the swap file, or -1 */
+   int clear_unchanged;		       /* the copy has stale unchanged flags */
+#endif
+}
+Undo_Chunk_Type;
+
 typedef struct Undo_Type
 {
-   Undo_Object_Type *Last_Undo;
-   Undo_Object_Type *First_Undo;
+   Undo_Chunk_Type *First_Chunk;
+   Undo_Chunk_Type *Last_Chunk;
 #ifdef UNDO_HAS_REDO
-   Undo_Object_Type *Current_Undo;
+   Undo_Chunk_Type *Current_Chunk;     /* NULL if there is nothing to undo */
+   unsigned int Current_Offset;
+#endif
+   unsigned long Num_Bytes;	       /* bytes of the chunks in memory */
+#ifdef UNDO_HAS_SWAP
+   FILE *Swap_Fp;
+   int Swap_Failed;
+   Undo_Chunk_Type *Page_Out_Hint;     /* the chunks before it are paged out */
+   char *History_File;		       /* last written or read by jed_undo_*_history */
+   unsigned long Num_Changes;	       /* counts the changes to the records */
+   unsigned long History_Changes;      /* Num_Changes when History_File was */
 #endif
-   Undo_Object_Type Undo_Ring[MAX_UNDOS];
 } Undo_Type;
 
 void record_deletion(unsigned char *, int);
 extern void record_insertion(int);
 extern void record_newline_insertion(void);
+extern void record_lines_insertion (int);
 extern int undo(void);
 extern void create_undo_ring(void);
 extern int Undo_Buf_Unch_Flag;	       /* 1 if buffer prev not modified */
+extern int Jed_Undo_Buffer_Limit;
+extern int Jed_Undo_Total_Limit;
 
 #ifdef UNDO_HAS_REDO
 extern void set_current_undo(void);
@@ -51,4 +93,10 @@ extern void unmark_undo_boundary (Buffer *);
 
 extern void jed_undo_record_position (void);
 
+#ifdef UNDO_HAS_SWAP
+extern int jed_undo_save_history (char *);
+extern int jed_undo_load_history (char *);
+extern void jed_set_undo_history_dir (char *);
+#endif
+
 #endif
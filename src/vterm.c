@@ -13,6 +13,7 @@
 #include <slang.h>
 
 #include "vterm.h"
+#include "buffer.h"
 #include "misc.h"
 
 /* This is a virtual terminal used by the window system displays. */
@@ -259,6 +260,78 @@ void vterm_write_nchars (char *s, unsigned int len)
    vterm_forward_cursor (len);
 }
 
+/* A tt_smart_puts for SLsmg: copy the new contents of a row */
+static void vterm_smart_puts (SLsmg_Char_Type *neww, SLsmg_Char_Type *oldd,
+			      int len, int row)
+{
+   (void) oldd;
+
+   if (VTerm_Suspend_Update) return;
+
+   if ((VTerm_Display == NULL) || (row < 0) || (row >= VTerm_Num_Rows))
+     return;
+
+   if (len > VTerm_Num_Cols) len = VTerm_Num_Cols;
+   if (len <= 0) return;
+
+   memcpy ((char *) VTerm_Display[row], (char *) neww,
+	   len * sizeof (SLsmg_Char_Type));
+   Current_Row = row;
+   Current_Col = len - 1;
+}
+
+static void vterm_normal_video (void)
+{
+   vterm_reverse_video (0);
+}
+
+static void vterm_reset_scroll_region (void)
+{
+   vterm_set_scroll_region (0, VTerm_Num_Rows - 1);
+}
+
+static int vterm_no_op (void)
+{
+   return 0;
+}
+
+static int VTerm_Zero = 0;
+
+/* Make SLsmg draw onto the virtual terminal.  This is used where there is
+ * no real one, e.g., to time the display code in batch mode.
+ */
+int vterm_init_smg (int rows, int cols)
+{
+   SLsmg_Term_Type tt;
+
+   if (-1 == vterm_init_display (rows, cols))
+     return -1;
+
+   memset ((char *) &tt, 0, sizeof (SLsmg_Term_Type));
+
+   tt.tt_normal_video = vterm_normal_video;
+   tt.tt_set_scroll_region = vterm_set_scroll_region;
+   tt.tt_goto_rc = vterm_goto_rc;
+   tt.tt_reverse_index = vterm_reverse_index;
+   tt.tt_reset_scroll_region = vterm_reset_scroll_region;
+   tt.tt_delete_nlines = vterm_delete_nlines;
+   tt.tt_cls = vterm_cls;
+   tt.tt_del_eol = vterm_del_eol;
+   tt.tt_smart_puts = vterm_smart_puts;
+   tt.tt_flush_output = vterm_no_op;
+   tt.tt_reset_video = vterm_no_op;
+   tt.tt_init_video = vterm_no_op;
+
+   tt.tt_screen_rows = &VTerm_Num_Rows;
+   tt.tt_screen_cols = &VTerm_Num_Cols;
+   tt.tt_term_cannot_scroll = &VTerm_Zero;
+   tt.tt_has_alt_charset = &VTerm_Zero;
+   tt.unicode_ok = &Jed_UTF8_Mode;
+
+   SLsmg_set_terminal_info (&tt);
+   return SLsmg_init_smg ();
+}
+
 /* This is commented out until I can test it.  It was submitted by */
 #if 0
 /* // return number of wide characters written */
@@ -19,4 +19,5 @@ extern void vterm_reverse_video (int);
 extern void vterm_cls (void);
 extern void vterm_write_nchars (char *, unsigned int);
 extern void vterm_forward_cursor (int);
+extern int vterm_init_smg (int, int);
 /* extern void vterm_write (unsigned short *, unsigned int); */
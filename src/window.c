@@ -92,6 +92,10 @@ static void free_window (Window_Type *w)
    if (jed_free_window_cb != NULL)
      (*jed_free_window_cb)(w);
 
+#if JED_HAS_SOFT_WRAP
+   if (w->wrap_cache != NULL)
+     SLfree ((char *) w->wrap_cache);
+#endif
    SLfree ((char *) w);
 }
 
@@ -23,6 +23,10 @@ typedef struct Window_Type
    int flags;			       /* Note that trashed should be a bit here */
 
    void *private_data;		       /* used by the callback functions */
+#if JED_HAS_SOFT_WRAP
+   struct Wrap_Cache_Type *wrap_cache; /* wrapped row counts, see screen.c */
+   int wrap_top_row;		       /* first row of beg.line in the window */
+#endif
 }
 Window_Type;
 